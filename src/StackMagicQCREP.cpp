@@ -0,0 +1,49 @@
+// Includes:
+#include "StackMagicQCREP.h"
+#include "StackMagicQOSC.h"
+#include <cstring>
+#include <arpa/inet.h>
+
+/// Appends the CREP packet for an operation to a buffer of elements (a
+/// big-endian size followed by the packet, as for OSC bundle elements, so that
+/// the transport can treat both protocols alike). Returns the new length of
+/// the data in the buffer, which is unchanged if the packet would not fit. The
+/// forward sequence number is left as zero for the transport to fill in
+/// @param elements The buffer to append to
+/// @param offset The current length of the data in the buffer
+/// @param size The total size of the buffer
+size_t stack_magicq_crep_append_operation(char *elements, size_t offset, size_t size, MagicQOperation operation, int16_t playback, int16_t level, const char *cue_id)
+{
+	// The command text is the same as that of an /rpc address, e.g. "1,50L"
+	char command[STACK_MAGICQ_OSC_MAX_ADDRESS];
+	size_t command_length = stack_magicq_osc_append_rpc_command(command, 0, operation, playback, level, cue_id);
+
+	size_t packet_length = STACK_MAGICQ_CREP_HEADER_SIZE + command_length;
+	if (command_length == 0 || offset + 4 + packet_length > size)
+	{
+		return offset;
+	}
+
+	// Element size
+	uint32_t element_size = htonl((uint32_t)packet_length);
+	memcpy(&elements[offset], &element_size, 4);
+	offset += 4;
+
+	// Header
+	char *header = &elements[offset];
+	memcpy(header, "CREP", 4);
+	header[4] = (char)(STACK_MAGICQ_CREP_VERSION & 0xff);
+	header[5] = (char)(STACK_MAGICQ_CREP_VERSION >> 8);
+	header[STACK_MAGICQ_CREP_SEQUENCE_OFFSET] = 0;
+	header[7] = 0;
+	header[8] = (char)(command_length & 0xff);
+	header[9] = (char)(command_length >> 8);
+	offset += STACK_MAGICQ_CREP_HEADER_SIZE;
+
+	// Command text (not NUL terminated)
+	memcpy(&elements[offset], command, command_length);
+	offset += command_length;
+
+	return offset;
+}
+
@@ -0,0 +1,27 @@
+#ifndef _STACKMAGICQCREP_H_INCLUDED
+#define _STACKMAGICQCREP_H_INCLUDED
+
+// Includes:
+#include "StackMagicQCommand.h"
+#include <cstddef>
+#include <cstdint>
+
+// Defines:
+// The UDP port MagicQ listens for the ChamSys Remote Ethernet Protocol on
+#define STACK_MAGICQ_CREP_PORT 6553
+
+// The size of a CREP header: the "CREP" identifier, then the version (16-bit),
+// forward and backward sequence numbers (8-bit each) and the length of the
+// command text (16-bit), all little-endian
+#define STACK_MAGICQ_CREP_HEADER_SIZE 10
+
+// The version of the protocol that we speak
+#define STACK_MAGICQ_CREP_VERSION 0
+
+// The offset of the forward sequence number within a CREP header
+#define STACK_MAGICQ_CREP_SEQUENCE_OFFSET 6
+
+// Functions: Encoding
+size_t stack_magicq_crep_append_operation(char *elements, size_t offset, size_t size, MagicQOperation operation, int16_t playback, int16_t level, const char *cue_id);
+
+#endif
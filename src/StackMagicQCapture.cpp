@@ -0,0 +1,137 @@
+// Includes:
+#include "StackLog.h"
+#include "StackMagicQCapture.h"
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+// Global: The mapped capture file (NULL if capture is disabled)
+static StackMagicQCaptureHeader *smqc_header = NULL;
+
+// Global: The records in the capture file
+static StackMagicQCaptureRecord *smqc_records = NULL;
+
+// TODO: Put this into an app-wide settings UI
+static uint64_t stack_magicq_capture_get_record_count()
+{
+	char *env = getenv("STACK_MAGICQ_CAPTURE_RECORDS");
+	if (env != NULL)
+	{
+		long long count = atoll(env);
+		if (count > 0)
+		{
+			return (uint64_t)count;
+		}
+	}
+
+	return STACK_MAGICQ_CAPTURE_DEFAULT_RECORDS;
+}
+
+/// Opens and maps the capture file, if one is configured by the
+/// STACK_MAGICQ_CAPTURE_FILE environment variable. Any existing capture in the
+/// file is overwritten. Should be called once from stack_init_plugin()
+bool stack_magicq_capture_init()
+{
+	// TODO: Put this into an app-wide settings UI
+	char *filename = getenv("STACK_MAGICQ_CAPTURE_FILE");
+	if (filename == NULL || smqc_header != NULL)
+	{
+		return true;
+	}
+
+	uint64_t record_count = stack_magicq_capture_get_record_count();
+	size_t file_size = sizeof(StackMagicQCaptureHeader) + record_count * sizeof(StackMagicQCaptureRecord);
+
+	int fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+	{
+		stack_log("stack_magicq_capture_init(): Failed to open %s\n", filename);
+		return false;
+	}
+
+	// Size the file. Records that have never been written read as zero, and so
+	// are seen as empty
+	if (ftruncate(fd, (off_t)file_size) != 0)
+	{
+		stack_log("stack_magicq_capture_init(): Failed to size %s\n", filename);
+		close(fd);
+		return false;
+	}
+
+	void *mapping = mmap(NULL, file_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (mapping == MAP_FAILED)
+	{
+		stack_log("stack_magicq_capture_init(): Failed to map %s\n", filename);
+		return false;
+	}
+
+	StackMagicQCaptureHeader *header = (StackMagicQCaptureHeader*)mapping;
+	memcpy(header->magic, STACK_MAGICQ_CAPTURE_MAGIC, sizeof(header->magic));
+	header->version = STACK_MAGICQ_CAPTURE_VERSION;
+	header->record_size = sizeof(StackMagicQCaptureRecord);
+	header->record_count = record_count;
+	header->write_index = 0;
+
+	smqc_records = (StackMagicQCaptureRecord*)((char*)mapping + sizeof(StackMagicQCaptureHeader));
+	smqc_header = header;
+
+	stack_log("stack_magicq_capture_init(): Capturing up to %lu datagrams to %s\n", record_count, filename);
+	return true;
+}
+
+/// Returns whether capture is turned on
+bool stack_magicq_capture_enabled()
+{
+	return smqc_header != NULL;
+}
+
+/// Writes a datagram to the capture ring. This never blocks: each writer claims
+/// its own record, so it is safe to call from any number of threads at once.
+/// Once the ring is full, the oldest records are overwritten
+/// @param direction Whether the datagram was sent or received
+/// @param source The unique ID of the cue that sent the datagram, or zero
+/// @param peer The address the datagram was sent to or received from
+/// @param iov The pieces of the datagram
+/// @param iov_count The number of pieces in iov
+void stack_magicq_capture_write(StackMagicQCaptureDirection direction, uint64_t source, const struct sockaddr_in *peer, const struct iovec *iov, size_t iov_count)
+{
+	if (smqc_header == NULL)
+	{
+		return;
+	}
+
+	// Claim a record, and mark it as being written
+	uint64_t index = smqc_header->write_index.fetch_add(1, std::memory_order_relaxed);
+	StackMagicQCaptureRecord *record = &smqc_records[index % smqc_header->record_count];
+	record->sequence.store(0, std::memory_order_release);
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	record->timestamp = (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+	record->source = source;
+	record->direction = (uint32_t)direction;
+	record->address = peer != NULL ? peer->sin_addr.s_addr : 0;
+	record->port = peer != NULL ? peer->sin_port : 0;
+	record->reserved = 0;
+
+	// Gather the datagram
+	size_t length = 0;
+	for (size_t i = 0; i < iov_count && length < STACK_MAGICQ_CAPTURE_MAX_DATA; i++)
+	{
+		size_t piece = iov[i].iov_len;
+		if (length + piece > STACK_MAGICQ_CAPTURE_MAX_DATA)
+		{
+			piece = STACK_MAGICQ_CAPTURE_MAX_DATA - length;
+		}
+		memcpy(&record->data[length], iov[i].iov_base, piece);
+		length += piece;
+	}
+	record->length = (uint32_t)length;
+
+	// Publish the record
+	record->sequence.store(index + 1, std::memory_order_release);
+}
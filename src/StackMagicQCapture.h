@@ -0,0 +1,91 @@
+#ifndef _STACKMAGICQCAPTURE_H_INCLUDED
+#define _STACKMAGICQCAPTURE_H_INCLUDED
+
+// Includes:
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <netinet/in.h>
+#include <sys/uio.h>
+
+// Defines:
+// Identifies a capture file (including the NUL terminator)
+#define STACK_MAGICQ_CAPTURE_MAGIC "SMQCAPT"
+
+// The version of the capture file layout
+#define STACK_MAGICQ_CAPTURE_VERSION 1
+
+// The most data captured from a single datagram (anything beyond is truncated)
+#define STACK_MAGICQ_CAPTURE_MAX_DATA 1472
+
+// The default number of records in the capture ring
+#define STACK_MAGICQ_CAPTURE_DEFAULT_RECORDS 65536
+
+// The direction of a captured datagram
+typedef enum StackMagicQCaptureDirection
+{
+	STACK_MAGICQ_CAPTURE_OUTGOING = 0,
+	STACK_MAGICQ_CAPTURE_INCOMING = 1,
+} StackMagicQCaptureDirection;
+
+// The header at the start of a capture file. This is shared between the plugin
+// and the replay tool, so must only contain fixed-size types
+struct StackMagicQCaptureHeader
+{
+	// STACK_MAGICQ_CAPTURE_MAGIC
+	char magic[8];
+
+	// STACK_MAGICQ_CAPTURE_VERSION
+	uint32_t version;
+
+	// The size of each record, in bytes
+	uint32_t record_size;
+
+	// The number of records in the ring
+	uint64_t record_count;
+
+	// The total number of records ever claimed. The next record to be written
+	// is at write_index % record_count
+	std::atomic<uint64_t> write_index;
+
+	// Padding to keep the records aligned
+	char reserved[32];
+};
+
+// A single captured datagram
+struct StackMagicQCaptureRecord
+{
+	// The write index of the record plus one, or zero if the record is empty
+	// or partially written
+	std::atomic<uint64_t> sequence;
+
+	// When the datagram was sent or received (CLOCK_MONOTONIC, nanoseconds)
+	int64_t timestamp;
+
+	// The unique ID of the cue that sent the datagram, or zero if none
+	uint64_t source;
+
+	// A StackMagicQCaptureDirection
+	uint32_t direction;
+
+	// The length of the captured data
+	uint32_t length;
+
+	// The address and port the datagram was sent to or received from, in
+	// network byte order
+	uint32_t address;
+	uint16_t port;
+	uint16_t reserved;
+
+	// The datagram itself
+	char data[STACK_MAGICQ_CAPTURE_MAX_DATA];
+};
+
+// Functions: Capture lifecycle
+bool stack_magicq_capture_init();
+bool stack_magicq_capture_enabled();
+
+// Functions: Capturing
+void stack_magicq_capture_write(StackMagicQCaptureDirection direction, uint64_t source, const struct sockaddr_in *peer, const struct iovec *iov, size_t iov_count);
+
+#endif
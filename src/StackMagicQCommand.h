@@ -0,0 +1,42 @@
+#ifndef _STACKMAGICQCOMMAND_H_INCLUDED
+#define _STACKMAGICQCOMMAND_H_INCLUDED
+
+// Includes:
+#include <cstdint>
+
+// Defines:
+// The highest playback number that we keep track of
+#define STACK_MAGICQ_MAX_PLAYBACK 255
+
+// The operations we can ask MagicQ to perform on a playback
+typedef enum MagicQOperation {
+	MAGICQ_OPERATION_ACTIVATE,
+	MAGICQ_OPERATION_RELEASE,
+	MAGICQ_OPERATION_GO,
+	MAGICQ_OPERATION_STOP,
+	MAGICQ_OPERATION_SET_LEVEL,
+	MAGICQ_OPERATION_JUMP_TO_CUE_ID,
+} MagicQOperation;
+
+// A single compiled command: the operation, its target, and where its encoded
+// message lives within a buffer of bundle elements
+struct StackMagicQCommand
+{
+	// The operation and its arguments
+	MagicQOperation operation;
+	uint16_t playback;
+	int16_t level;
+
+	// The cue ID to jump to, in thousandths (so 1.5 is 1500), so that it can be
+	// compared with MagicQ's feedback
+	uint32_t cue_id;
+
+	// The offset and length of the encoded bundle element (including its size)
+	uint32_t offset;
+	uint32_t length;
+
+	// Whether the command was left out of the last send as being redundant
+	bool suppressed;
+};
+
+#endif
@@ -4,82 +4,112 @@
 #include "StackMagicQCue.h"
 #include "StackGtkHelper.h"
 #include "StackJson.h"
+#include "StackMagicQOSC.h"
+#include "StackMagicQCREP.h"
+#include "StackMagicQFeedback.h"
+#include "StackMagicQLedger.h"
+#include "StackMagicQMetrics.h"
+#include "StackMagicQCapture.h"
+#include "StackMagicQReliable.h"
 #include <cstring>
 #include <cstdlib>
 #include <string>
 #include <cmath>
-#include <sys/wait.h>
-#include <sys/socket.h>
-#include <arpa/inet.h>
+#include <ctime>
+#include <cstdarg>
+#include <atomic>
 
 // Global: A single instance of our builder so we don't have to keep reloading
 // it every time we change the selected cue
 static GtkBuilder *smc_builder = NULL;
 
+// The widgets of the MagicQ tab that we update, looked up once when the UI is
+// loaded rather than every time the selection changes
+struct StackMagicQCueWidgets
+{
+	GtkWidget *grid;
+	GtkEntry *entry_program;
+	GtkEntry *entry_start_level;
+	GtkToggleButton *check_force_send;
+	GtkComboBox *combo_fade_curve;
+};
+
+// Global: The widgets from smc_builder
+static StackMagicQCueWidgets smc_widgets;
+
 // Global: A single instace of our icon
 static GdkPixbuf *icon = NULL;
 
-typedef enum MagicQOperation {
-	MAGICQ_OPERATION_ACTIVATE,
-	MAGICQ_OPERATION_RELEASE,
-	MAGICQ_OPERATION_GO,
-	MAGICQ_OPERATION_STOP,
-	MAGICQ_OPERATION_SET_LEVEL,
-	MAGICQ_OPERATION_JUMP_TO_CUE_ID,
-} MagicQOperation;
+// Global: The interval between level updates during a fade
+static stack_time_t smc_fade_interval = NANOSECS_PER_SEC / 25;
+
+// Global: How far ahead of the end of its pre-wait a cue hands its messages to
+// the transport, to be sent at exactly the right time (zero to disable)
+static stack_time_t smc_schedule_ahead = 50 * NANOSECS_PER_MILLISEC;
 
 // TODO: Put this into an app-wide settings UI
-static int16_t stack_magicq_cue_get_osc_port()
+static stack_time_t stack_magicq_cue_get_schedule_ahead()
 {
-	char *env = getenv("STACK_MAGICQ_OSC_PORT");
+	char *env = getenv("STACK_MAGICQ_SCHEDULE_AHEAD");
 	if (env != NULL)
 	{
-		int16_t port = atoi(env);
-		if (port >= 1 && port <= 65535)
+		int ms = atoi(env);
+		if (ms >= 0 && ms <= 10000)
 		{
-			return port;
+			return ms * NANOSECS_PER_MILLISEC;
 		}
 	}
 
-	return 8000;
+	return 50 * NANOSECS_PER_MILLISEC;
 }
 
-static bool stack_magicq_cue_update_error_state(StackMagicQCue *cue)
+// TODO: Put this into an app-wide settings UI
+static stack_time_t stack_magicq_cue_get_fade_interval()
 {
-	int16_t playback = 0, level = 0;
-	char buffer[64];
-	char *cue_id = NULL;
-	bool action_activate = false, action_level = false, action_go = false,
-		 action_stop = false, action_jump = false, action_release = false, error = false;
-
-	// Get the values from the properties
-	stack_property_get_int16(stack_cue_get_property(STACK_CUE(cue), "playback"), STACK_PROPERTY_VERSION_DEFINED, &playback);
-	stack_property_get_int16(stack_cue_get_property(STACK_CUE(cue), "level"), STACK_PROPERTY_VERSION_DEFINED, &level);
-	stack_property_get_string(stack_cue_get_property(STACK_CUE(cue), "jump_cue_id"), STACK_PROPERTY_VERSION_DEFINED, &cue_id);
-	stack_property_get_bool(stack_cue_get_property(STACK_CUE(cue), "action_activate"), STACK_PROPERTY_VERSION_DEFINED, &action_activate);
-	stack_property_get_bool(stack_cue_get_property(STACK_CUE(cue), "action_level"), STACK_PROPERTY_VERSION_DEFINED, &action_level);
-	stack_property_get_bool(stack_cue_get_property(STACK_CUE(cue), "action_go"), STACK_PROPERTY_VERSION_DEFINED, &action_go);
-	stack_property_get_bool(stack_cue_get_property(STACK_CUE(cue), "action_stop"), STACK_PROPERTY_VERSION_DEFINED, &action_stop);
-	stack_property_get_bool(stack_cue_get_property(STACK_CUE(cue), "action_jump"), STACK_PROPERTY_VERSION_DEFINED, &action_jump);
-	stack_property_get_bool(stack_cue_get_property(STACK_CUE(cue), "action_release"), STACK_PROPERTY_VERSION_DEFINED, &action_release);
-
-	// We must have a playback ID
-	if (playback == 0)
+	char *env = getenv("STACK_MAGICQ_FADE_RATE");
+	if (env != NULL)
 	{
-		error = true;
+		int rate = atoi(env);
+		if (rate >= 1 && rate <= 1000)
+		{
+			return NANOSECS_PER_SEC / rate;
+		}
 	}
 
+	return NANOSECS_PER_SEC / 25;
+}
+
+/// Updates the validation state of the cue after a change to its program,
+/// parsing the program once so that nothing else needs to
+static void stack_magicq_cue_validate_program(StackMagicQCue *cue)
+{
+	char *program_text = NULL;
+	stack_property_get_string(cue->prop_program, STACK_PROPERTY_VERSION_DEFINED, &program_text);
+	stack_magicq_program_parse(program_text != NULL ? program_text : "", &cue->program);
+
+	cue->errors = 0;
+
 	// We must have an action
-	if (!action_activate && !action_level && !action_go && !action_stop && !action_jump && !action_release)
+	if (cue->program.step_count == 0)
 	{
-		error = true;
+		cue->errors |= STACK_MAGICQ_CUE_ERROR_NO_ACTION;
 	}
 
 	// If we're jumping, we must have a cue number
-	if (action_jump && strlen(cue_id) == 0)
+	for (size_t i = 0; i < cue->program.step_count; i++)
 	{
-		error = true;
+		if (cue->program.steps[i].operation == MAGICQ_OPERATION_JUMP_TO_CUE_ID && cue->program.steps[i].cue_id[0] == '\0')
+		{
+			cue->errors |= STACK_MAGICQ_CUE_ERROR_NO_JUMP_CUE_ID;
+		}
 	}
+}
+
+/// Puts the cue in to (or takes it out of) the error state to match its
+/// validation state. Returns true if the cue is in error
+static bool stack_magicq_cue_update_error_state(StackMagicQCue *cue)
+{
+	bool error = cue->errors != 0;
 
 	if (error)
 	{
@@ -96,7 +126,48 @@ static bool stack_magicq_cue_update_error_state(StackMagicQCue *cue)
 	return error;
 }
 
-static void stack_magicq_cue_ccb_action(StackProperty *property, StackPropertyVersion version, void *user_data)
+/// Marks the rendered fields that depend on a property as needing to be
+/// rendered again
+static void stack_magicq_cue_invalidate_fields(StackMagicQCue *cue, StackProperty *property)
+{
+	if (property == cue->prop_program)
+	{
+		cue->dirty_fields |= (1 << STACK_MAGICQ_CUE_FIELD_PLAYBACK) | (1 << STACK_MAGICQ_CUE_FIELD_LEVEL) |
+			(1 << STACK_MAGICQ_CUE_FIELD_JUMP_TARGET) | (1 << STACK_MAGICQ_CUE_FIELD_ACTIONS);
+	}
+}
+
+/// Emits update-selected-cue on a window from the main loop, once any pending
+/// property changes have all been made
+static gboolean stack_magicq_cue_refresh_ui_idle(gpointer user_data)
+{
+	GObject *window = G_OBJECT(user_data);
+	g_object_set_data(window, "stack-magicq-refresh-pending", NULL);
+	g_signal_emit_by_name((gpointer)window, "update-selected-cue");
+	g_object_unref(window);
+
+	return G_SOURCE_REMOVE;
+}
+
+/// Asks the window showing the cue to refresh (we might have changed state).
+/// Rather than refreshing on every property change, the refreshes are combined
+/// in to one, which happens when the main loop is next idle
+static void stack_magicq_cue_queue_ui_refresh(StackMagicQCue *cue)
+{
+	if (cue->magicq_tab == NULL)
+	{
+		return;
+	}
+
+	GObject *window = G_OBJECT(gtk_widget_get_toplevel(GTK_WIDGET(cue->magicq_tab)));
+	if (g_object_get_data(window, "stack-magicq-refresh-pending") == NULL)
+	{
+		g_object_set_data(window, "stack-magicq-refresh-pending", GINT_TO_POINTER(1));
+		g_idle_add(stack_magicq_cue_refresh_ui_idle, g_object_ref(window));
+	}
+}
+
+static void stack_magicq_cue_ccb_setting(StackProperty *property, StackPropertyVersion version, void *user_data)
 {
 	// If a defined-version property has changed, we should notify the cue list
 	// that we're now different
@@ -107,20 +178,12 @@ static void stack_magicq_cue_ccb_action(StackProperty *property, StackPropertyVe
 		// Notify cue list that we've changed
 		stack_cue_list_changed(STACK_CUE(cue)->parent, STACK_CUE(cue), property);
 
-		// Update our error state
-		stack_magicq_cue_update_error_state(cue);
-
-		// Fire an updated-selected-cue signal to signal the UI to change (we might
-		// have changed state)
-		if (cue->magicq_tab)
-		{
-			StackAppWindow *window = (StackAppWindow*)gtk_widget_get_toplevel(GTK_WIDGET(cue->magicq_tab));
-			g_signal_emit_by_name((gpointer)window, "update-selected-cue");
-		}
+		// Ask the UI to refresh (we might have changed state)
+		stack_magicq_cue_queue_ui_refresh(cue);
 	}
 }
 
-static void stack_magicq_cue_ccb_playback(StackProperty *property, StackPropertyVersion version, void *user_data)
+static void stack_magicq_cue_ccb_program(StackProperty *property, StackPropertyVersion version, void *user_data)
 {
 	// If a defined-version property has changed, we should notify the cue list
 	// that we're now different
@@ -132,20 +195,17 @@ static void stack_magicq_cue_ccb_playback(StackProperty *property, StackProperty
 		stack_cue_list_changed(STACK_CUE(cue)->parent, STACK_CUE(cue), property);
 
 		// Update our error state
+		stack_magicq_cue_validate_program(cue);
 		stack_magicq_cue_update_error_state(cue);
+		stack_magicq_cue_invalidate_fields(cue, property);
 
-		// Fire an updated-selected-cue signal to signal the UI to change (we might
-		// have changed state)
+		// Ask the UI to refresh (we might have changed state)
+		stack_magicq_cue_queue_ui_refresh(cue);
 		if (cue->magicq_tab)
 		{
-			StackAppWindow *window = (StackAppWindow*)gtk_widget_get_toplevel(GTK_WIDGET(cue->magicq_tab));
-			g_signal_emit_by_name((gpointer)window, "update-selected-cue");
-
-			int16_t playback;
-			char buffer[32];
-			stack_property_get_int16(property, STACK_PROPERTY_VERSION_DEFINED, &playback);
-			snprintf(buffer, 32, "%d", playback);
-			gtk_entry_set_text(GTK_ENTRY(gtk_builder_get_object(smc_builder, "mcpEntryPlayback")), buffer);
+			char *program_text = NULL;
+			stack_property_get_string(property, STACK_PROPERTY_VERSION_DEFINED, &program_text);
+			gtk_entry_set_text(smc_widgets.entry_program, program_text != NULL ? program_text : "");
 		}
 	}
 }
@@ -161,64 +221,47 @@ static void stack_magicq_cue_ccb_level(StackProperty *property, StackPropertyVer
 		// Notify cue list that we've changed
 		stack_cue_list_changed(STACK_CUE(cue)->parent, STACK_CUE(cue), property);
 
-		// Update our error state
-		stack_magicq_cue_update_error_state(cue);
-
-		// Fire an updated-selected-cue signal to signal the UI to change (we might
-		// have changed state)
+		// Ask the UI to refresh (we might have changed state)
+		stack_magicq_cue_queue_ui_refresh(cue);
 		if (cue->magicq_tab)
 		{
-			StackAppWindow *window = (StackAppWindow*)gtk_widget_get_toplevel(GTK_WIDGET(cue->magicq_tab));
-			g_signal_emit_by_name((gpointer)window, "update-selected-cue");
-
 			int16_t level;
 			char buffer[32];
 			stack_property_get_int16(property, STACK_PROPERTY_VERSION_DEFINED, &level);
 			snprintf(buffer, 32, "%d", level);
-			gtk_entry_set_text(GTK_ENTRY(gtk_builder_get_object(smc_builder, "mcpEntryLevel")), buffer);
+			gtk_entry_set_text(smc_widgets.entry_start_level, buffer);
 		}
 	}
 }
 
-static void stack_magicq_cue_ccb_jump_cue_id(StackProperty *property, StackPropertyVersion version, void *user_data)
+/// Sets the program of a cue. Returns false (leaving the program unchanged) if
+/// the program is too long to be written out as text
+static bool stack_magicq_cue_set_program(StackMagicQCue *cue, const StackMagicQProgram *program)
 {
-	// If a defined-version property has changed, we should notify the cue list
-	// that we're now different
-	if (version == STACK_PROPERTY_VERSION_DEFINED)
+	char text[STACK_MAGICQ_PROGRAM_MAX_TEXT];
+	if (stack_magicq_program_format(program, text, sizeof(text)) == 0 && program->step_count > 0)
 	{
-		StackMagicQCue* cue = STACK_MAGICQ_CUE(user_data);
-
-		// Notify cue list that we've changed
-		stack_cue_list_changed(STACK_CUE(cue)->parent, STACK_CUE(cue), property);
-
-		// Update our error state
-		stack_magicq_cue_update_error_state(cue);
-
-		// Fire an updated-selected-cue signal to signal the UI to change (we might
-		// have changed state)
-		if (cue->magicq_tab)
-		{
-			StackAppWindow *window = (StackAppWindow*)gtk_widget_get_toplevel(GTK_WIDGET(cue->magicq_tab));
-			g_signal_emit_by_name((gpointer)window, "update-selected-cue");
-		}
+		stack_log("stack_magicq_cue_set_program(): Program of %u steps is too long, ignoring it\n", (unsigned int)program->step_count);
+		return false;
 	}
+	stack_property_set_string(cue->prop_program, STACK_PROPERTY_VERSION_DEFINED, text);
+
+	return true;
 }
 
-int16_t stack_magicq_cue_validate_playback(StackPropertyInt16 *property, StackPropertyVersion version, const int16_t value, void *user_data)
+/// Sets the program of a cue from its text form, such as
+/// "activate 1-4; level 1-4 50; go 5", which is stored in its tidiest form.
+/// Returns false (leaving the program unchanged) if the text is invalid or the
+/// program is too long
+static bool stack_magicq_cue_set_program_text(StackMagicQCue *cue, const char *text)
 {
-	if (version == STACK_PROPERTY_VERSION_DEFINED)
+	StackMagicQProgram program;
+	if (!stack_magicq_program_parse(text, &program))
 	{
-		if (value < 0)
-		{
-			return 0;
-		}
-		else if (value > 10)
-		{
-			return 10;
-		}
+		return false;
 	}
 
-	return value;
+	return stack_magicq_cue_set_program(cue, &program);
 }
 
 int16_t stack_magicq_cue_validate_level(StackPropertyInt16 *property, StackPropertyVersion version, const int16_t value, void *user_data)
@@ -237,20 +280,24 @@ int16_t stack_magicq_cue_validate_level(StackPropertyInt16 *property, StackPrope
 
 	return value;
 }
-// TODO: Validate cue ID format?
+
+int16_t stack_magicq_cue_validate_fade_curve(StackPropertyInt16 *property, StackPropertyVersion version, const int16_t value, void *user_data)
+{
+	if (value < STACK_MAGICQ_FADE_CURVE_LINEAR || value > STACK_MAGICQ_FADE_CURVE_EXPONENTIAL)
+	{
+		return STACK_MAGICQ_FADE_CURVE_LINEAR;
+	}
+
+	return value;
+}
 
 /// Pause or resumes change callbacks on variables
 static void stack_magicq_cue_pause_change_callbacks(StackCue *cue, bool pause)
 {
-	stack_property_pause_change_callback(stack_cue_get_property(cue, "playback"), pause);
-	stack_property_pause_change_callback(stack_cue_get_property(cue, "action_activate"), pause);
-	stack_property_pause_change_callback(stack_cue_get_property(cue, "action_level"), pause);
-	stack_property_pause_change_callback(stack_cue_get_property(cue, "level"), pause);
-	stack_property_pause_change_callback(stack_cue_get_property(cue, "action_go"), pause);
-	stack_property_pause_change_callback(stack_cue_get_property(cue, "action_stop"), pause);
-	stack_property_pause_change_callback(stack_cue_get_property(cue, "action_jump"), pause);
-	stack_property_pause_change_callback(stack_cue_get_property(cue, "jump_cue_id"), pause);
-	stack_property_pause_change_callback(stack_cue_get_property(cue, "action_release"), pause);
+	stack_property_pause_change_callback(STACK_MAGICQ_CUE(cue)->prop_program, pause);
+	stack_property_pause_change_callback(STACK_MAGICQ_CUE(cue)->prop_fade_start_level, pause);
+	stack_property_pause_change_callback(STACK_MAGICQ_CUE(cue)->prop_fade_curve, pause);
+	stack_property_pause_change_callback(STACK_MAGICQ_CUE(cue)->prop_force_send, pause);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -273,47 +320,63 @@ static StackCue* stack_magicq_cue_create(StackCueList *cue_list)
 
 	// Initialise our variables
 	cue->magicq_tab = NULL;
-	cue->sock = 0;
+	cue->transport = stack_magicq_transport_ref();
+	cue->metrics = stack_magicq_metrics_create();
+	cue->packet = NULL;
+	cue->packet_length = 0;
+	cue->packet_capacity = 0;
+	cue->commands = NULL;
+	cue->command_count = 0;
+	cue->command_capacity = 0;
+	cue->fades = NULL;
+	cue->fade_count = 0;
+	cue->fade_capacity = 0;
+	cue->fade_packet = NULL;
+	cue->fade_packet_capacity = 0;
+	cue->fade_commands = NULL;
+	cue->fade_command_capacity = 0;
+	cue->force_send = false;
+	cue->program.step_count = 0;
+	cue->errors = 0;
+	cue->dirty_fields = ~(uint32_t)0;
+	cue->fired = false;
+	cue->fire_scheduled = false;
+	cue->fire_due = 0;
+	cue->fire_sets = 0;
+	cue->cancel_pending = false;
+	cue->cancels_requested = 0;
+	cue->cancel_due = 0;
+	cue->cancel_sets = 0;
+	cue->fade_active = false;
 	stack_cue_set_action_time(STACK_CUE(cue), 1);
 
 	// Add our properties
-	StackProperty *playback = stack_property_create("playback", STACK_PROPERTY_TYPE_INT16);
-	stack_cue_add_property(STACK_CUE(cue), playback);
-	stack_property_set_changed_callback(playback, stack_magicq_cue_ccb_playback, (void*)cue);
-	stack_property_set_validator(playback, (stack_property_validator_t)stack_magicq_cue_validate_playback, (void*)cue);
-
-	StackProperty *action_activate = stack_property_create("action_activate", STACK_PROPERTY_TYPE_BOOL);
-	stack_cue_add_property(STACK_CUE(cue), action_activate);
-	stack_property_set_changed_callback(action_activate, stack_magicq_cue_ccb_action, (void*)cue);
+	cue->prop_program = stack_property_create("program", STACK_PROPERTY_TYPE_STRING);
+	stack_cue_add_property(STACK_CUE(cue), cue->prop_program);
+	stack_property_set_changed_callback(cue->prop_program, stack_magicq_cue_ccb_program, (void*)cue);
 
-	StackProperty *action_level = stack_property_create("action_level", STACK_PROPERTY_TYPE_BOOL);
-	stack_cue_add_property(STACK_CUE(cue), action_level);
-	stack_property_set_changed_callback(action_level, stack_magicq_cue_ccb_action, (void*)cue);
+	cue->prop_fade_start_level = stack_property_create("fade_start_level", STACK_PROPERTY_TYPE_INT16);
+	stack_cue_add_property(STACK_CUE(cue), cue->prop_fade_start_level);
+	stack_property_set_changed_callback(cue->prop_fade_start_level, stack_magicq_cue_ccb_level, (void*)cue);
+	stack_property_set_validator(cue->prop_fade_start_level, (stack_property_validator_t)stack_magicq_cue_validate_level, (void*)cue);
 
-	StackProperty *level = stack_property_create("level", STACK_PROPERTY_TYPE_INT16);
-	stack_cue_add_property(STACK_CUE(cue), level);
-	stack_property_set_changed_callback(level, stack_magicq_cue_ccb_level, (void*)cue);
-	stack_property_set_validator(level, (stack_property_validator_t)stack_magicq_cue_validate_level, (void*)cue);
+	cue->prop_fade_curve = stack_property_create("fade_curve", STACK_PROPERTY_TYPE_INT16);
+	stack_cue_add_property(STACK_CUE(cue), cue->prop_fade_curve);
+	stack_property_set_changed_callback(cue->prop_fade_curve, stack_magicq_cue_ccb_setting, (void*)cue);
+	stack_property_set_validator(cue->prop_fade_curve, (stack_property_validator_t)stack_magicq_cue_validate_fade_curve, (void*)cue);
 
-	StackProperty *action_go = stack_property_create("action_go", STACK_PROPERTY_TYPE_BOOL);
-	stack_cue_add_property(STACK_CUE(cue), action_go);
-	stack_property_set_changed_callback(action_go, stack_magicq_cue_ccb_action, (void*)cue);
+	cue->prop_force_send = stack_property_create("force_send", STACK_PROPERTY_TYPE_BOOL);
+	stack_cue_add_property(STACK_CUE(cue), cue->prop_force_send);
+	stack_property_set_changed_callback(cue->prop_force_send, stack_magicq_cue_ccb_setting, (void*)cue);
 
-	StackProperty *action_stop = stack_property_create("action_stop", STACK_PROPERTY_TYPE_BOOL);
-	stack_cue_add_property(STACK_CUE(cue), action_stop);
-	stack_property_set_changed_callback(action_stop, stack_magicq_cue_ccb_action, (void*)cue);
+	// The action time of the cue is the duration of the level fade
+	cue->prop_action_time = stack_cue_get_property(STACK_CUE(cue), "action_time");
 
-	StackProperty *action_jump = stack_property_create("action_jump", STACK_PROPERTY_TYPE_BOOL);
-	stack_cue_add_property(STACK_CUE(cue), action_jump);
-	stack_property_set_changed_callback(action_jump, stack_magicq_cue_ccb_action, (void*)cue);
+	// The pre-wait tells us exactly when to fire
+	cue->prop_pre_time = stack_cue_get_property(STACK_CUE(cue), "pre_time");
 
-	StackProperty *jump_cue_id = stack_property_create("jump_cue_id", STACK_PROPERTY_TYPE_STRING);
-	stack_cue_add_property(STACK_CUE(cue), jump_cue_id);
-	stack_property_set_changed_callback(jump_cue_id, stack_magicq_cue_ccb_jump_cue_id, (void*)cue);
-
-	StackProperty *action_release = stack_property_create("action_release", STACK_PROPERTY_TYPE_BOOL);
-	stack_cue_add_property(STACK_CUE(cue), action_release);
-	stack_property_set_changed_callback(action_release, stack_magicq_cue_ccb_action, (void*)cue);
+	// Work out what's missing from the default properties
+	stack_magicq_cue_validate_program(cue);
 
 	// Initialise superclass variables
 	stack_cue_set_name(STACK_CUE(cue), "MagicQ Action");
@@ -324,12 +387,24 @@ static StackCue* stack_magicq_cue_create(StackCueList *cue_list)
 /// Destroys a MagicQ cue
 static void stack_magicq_cue_destroy(StackCue *cue)
 {
-	// Tidy up the socket
-	if (STACK_MAGICQ_CUE(cue)->sock > 0)
+	// Don't let anything we've scheduled go out after we've gone
+	if (STACK_MAGICQ_CUE(cue)->fire_scheduled)
 	{
-		close(STACK_MAGICQ_CUE(cue)->sock);
+		stack_magicq_transport_cancel(STACK_MAGICQ_CUE(cue)->transport, cue->uid, NULL);
 	}
 
+	// Stop retransmitting anything we've sent
+	stack_magicq_reliable_forget(cue->uid, 0);
+
+	// Release our reference to the transport
+	stack_magicq_transport_unref(STACK_MAGICQ_CUE(cue)->transport);
+	stack_magicq_metrics_unref(STACK_MAGICQ_CUE(cue)->metrics);
+	free(STACK_MAGICQ_CUE(cue)->packet);
+	free(STACK_MAGICQ_CUE(cue)->commands);
+	free(STACK_MAGICQ_CUE(cue)->fades);
+	free(STACK_MAGICQ_CUE(cue)->fade_packet);
+	free(STACK_MAGICQ_CUE(cue)->fade_commands);
+
 	// Call parent destructor
 	stack_cue_destroy_base(cue);
 }
@@ -340,157 +415,483 @@ static void stack_magicq_cue_destroy(StackCue *cue)
 ////////////////////////////////////////////////////////////////////////////////
 // UI CALLBACKS
 
-extern "C" void mcp_action_toggled(GtkToggleButton *toggle_button, gpointer user_data)
+extern "C" gboolean mcp_program_changed(GtkWidget *widget, gpointer user_data)
 {
-	StackCue *cue = STACK_CUE(((StackAppWindow*)gtk_widget_get_toplevel(GTK_WIDGET(toggle_button)))->selected_cue);
-	const gchar *name = gtk_widget_get_name(GTK_WIDGET(toggle_button));
-	bool active = gtk_toggle_button_get_active(toggle_button);
-
-	// Figure out the property name
-	char property_name[64];
-	snprintf(property_name, 64, "action_%s", name);
+	StackCue *cue = STACK_CUE(((StackAppWindow*)gtk_widget_get_toplevel(widget))->selected_cue);
+	const gchar *value = gtk_entry_get_text(GTK_ENTRY(widget));
+	stack_magicq_cue_set_program_text(STACK_MAGICQ_CUE(cue), value);
 
-	// Set the property value
-	stack_property_set_bool(stack_cue_get_property(cue, property_name), STACK_PROPERTY_VERSION_DEFINED, active);
+	// Show the value in its tidied-up form (or the previous value if what was
+	// entered wasn't valid)
+	char *program_text = NULL;
+	stack_property_get_string(STACK_MAGICQ_CUE(cue)->prop_program, STACK_PROPERTY_VERSION_DEFINED, &program_text);
+	gtk_entry_set_text(GTK_ENTRY(widget), program_text != NULL ? program_text : "");
+	return false;
 }
 
-extern "C" gboolean mcp_playback_changed(GtkWidget *widget, gpointer user_data)
+extern "C" void mcp_force_send_toggled(GtkToggleButton *toggle_button, gpointer user_data)
 {
-	StackCue *cue = STACK_CUE(((StackAppWindow*)gtk_widget_get_toplevel(widget))->selected_cue);
-	const gchar *value = gtk_entry_get_text(GTK_ENTRY(widget));
-	int16_t playback = (int16_t)atoi(value);
-	stack_property_set_int16(stack_cue_get_property(cue, "playback"), STACK_PROPERTY_VERSION_DEFINED, playback);
-	return false;
+	StackCue *cue = STACK_CUE(((StackAppWindow*)gtk_widget_get_toplevel(GTK_WIDGET(toggle_button)))->selected_cue);
+	stack_property_set_bool(STACK_MAGICQ_CUE(cue)->prop_force_send, STACK_PROPERTY_VERSION_DEFINED, gtk_toggle_button_get_active(toggle_button));
 }
 
-extern "C" gboolean mcp_level_changed(GtkWidget *widget, gpointer user_data)
+extern "C" gboolean mcp_start_level_changed(GtkWidget *widget, gpointer user_data)
 {
 	StackCue *cue = STACK_CUE(((StackAppWindow*)gtk_widget_get_toplevel(widget))->selected_cue);
 	const gchar *value = gtk_entry_get_text(GTK_ENTRY(widget));
 	int16_t level = (int16_t)atoi(value);
-	stack_property_set_int16(stack_cue_get_property(cue, "level"), STACK_PROPERTY_VERSION_DEFINED, level);
+	stack_property_set_int16(STACK_MAGICQ_CUE(cue)->prop_fade_start_level, STACK_PROPERTY_VERSION_DEFINED, level);
 	return false;
 }
 
-extern "C" gboolean mcp_jump_cue_id_changed(GtkWidget *widget, gpointer user_data)
+extern "C" void mcp_fade_curve_changed(GtkComboBox *widget, gpointer user_data)
 {
-	StackCue *cue = STACK_CUE(((StackAppWindow*)gtk_widget_get_toplevel(widget))->selected_cue);
-	const gchar *value = gtk_entry_get_text(GTK_ENTRY(widget));
-	stack_property_set_string(stack_cue_get_property(cue, "jump_cue_id"), STACK_PROPERTY_VERSION_DEFINED, value);
-	return false;
+	StackCue *cue = STACK_CUE(((StackAppWindow*)gtk_widget_get_toplevel(GTK_WIDGET(widget)))->selected_cue);
+	const gchar *value = gtk_combo_box_get_active_id(widget);
+	if (value != NULL)
+	{
+		stack_property_set_int16(STACK_MAGICQ_CUE(cue)->prop_fade_curve, STACK_PROPERTY_VERSION_DEFINED, (int16_t)atoi(value));
+	}
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 // MAGICQ OPERATIONS
 
-static bool stack_magicq_cue_establish_socket(StackMagicQCue *cue)
+/// Appends the encoding of an operation to a buffer of elements, in whichever
+/// protocol the transport speaks
+static size_t stack_magicq_cue_append_operation(StackMagicQCue *cue, char *elements, size_t offset, size_t size, MagicQOperation operation, int16_t playback, int16_t level, const char *cue_id)
 {
-	// Don't do anything if we've already got a socket
-	if (cue->sock > 0)
+	if (cue->transport->protocol == STACK_MAGICQ_PROTOCOL_CREP)
 	{
-		return true;
+		return stack_magicq_crep_append_operation(elements, offset, size, operation, playback, level, cue_id);
 	}
 
-	stack_log("stack_magicq_cue_establish_socket(): Establishing new socket (%d)\n", cue->sock);
+	return stack_magicq_osc_append_operation(elements, offset, size, operation, playback, level, cue_id);
+}
 
-	// Create our UDP socket
-	cue->sock = socket(PF_INET, SOCK_DGRAM, 0);
-	if (cue->sock <= 0)
+/// Appends a command to the cue's compiled packet, recording where its message
+/// lives so that it can be individually suppressed when the cue fires. The
+/// packet and command list grow as needed, so this must not be called from the
+/// pulse thread
+static void stack_magicq_cue_compile_command(StackMagicQCue *cue, MagicQOperation operation, int16_t playback, int16_t level, const char *cue_id)
+{
+	// Make sure there's room for the command
+	if (cue->command_count == cue->command_capacity)
 	{
-		stack_log("stack_magicq_cue_establish_socket(): Failed to create socket (%d)\n", cue->sock);
-		cue->sock = 0;
-		return false;
+		size_t capacity = cue->command_capacity > 0 ? cue->command_capacity * 2 : 8;
+		StackMagicQCommand *commands = (StackMagicQCommand*)realloc(cue->commands, capacity * sizeof(StackMagicQCommand));
+		if (commands == NULL)
+		{
+			return;
+		}
+		cue->commands = commands;
+		cue->command_capacity = capacity;
+	}
+
+	// Make sure there's room for the largest message we might encode
+	if (cue->packet_length + STACK_MAGICQ_MAX_ELEMENTS > cue->packet_capacity)
+	{
+		size_t capacity = cue->packet_capacity > 0 ? cue->packet_capacity * 2 : STACK_MAGICQ_MAX_ELEMENTS * 2;
+		char *packet = (char*)realloc(cue->packet, capacity);
+		if (packet == NULL)
+		{
+			return;
+		}
+		cue->packet = packet;
+		cue->packet_capacity = capacity;
+	}
+
+	size_t offset = cue->packet_length;
+	cue->packet_length = stack_magicq_cue_append_operation(cue, cue->packet, offset, cue->packet_capacity, operation, playback, level, cue_id);
+	if (cue->packet_length == offset)
+	{
+		stack_log("stack_magicq_cue_compile_command(): Command could not be encoded\n");
+		return;
+	}
+
+	StackMagicQCommand *command = &cue->commands[cue->command_count++];
+	command->operation = operation;
+	command->playback = (uint16_t)playback;
+	command->level = level;
+	command->cue_id = cue_id != NULL ? (uint32_t)llround(atof(cue_id) * 1000.0) : 0;
+	command->offset = (uint32_t)offset;
+	command->length = (uint32_t)(cue->packet_length - offset);
+	command->suppressed = false;
+}
+
+/// Compiles an operation for every playback in a set
+static void stack_magicq_cue_compile_operation(StackMagicQCue *cue, const StackMagicQPlaybackSet *playbacks, MagicQOperation operation, int16_t level, const char *cue_id)
+{
+	for (int playback = stack_magicq_playback_set_next(playbacks, 0); playback > 0; playback = stack_magicq_playback_set_next(playbacks, playback))
+	{
+		stack_magicq_cue_compile_command(cue, operation, (int16_t)playback, level, cue_id);
+	}
+}
+
+/// Compiles the live properties of the cue in to the OSC messages that will be
+/// sent when the cue fires, so that there's no formatting to do on the pulse
+/// thread
+static void stack_magicq_cue_compile_packet(StackMagicQCue *cue)
+{
+	char *program_text = NULL;
+	StackMagicQProgram program;
+
+	// Get the program from the properties
+	stack_property_get_string(cue->prop_program, STACK_PROPERTY_VERSION_LIVE, &program_text);
+	stack_magicq_program_parse(program_text != NULL ? program_text : "", &program);
+
+	// If the cue has a real action time, the level of every level step is
+	// faded over that time from the start level, rather than being set
+	// immediately
+	size_t level_steps = 0, playback_count = 0;
+	for (size_t i = 0; i < program.step_count; i++)
+	{
+		if (program.steps[i].operation == MAGICQ_OPERATION_SET_LEVEL)
+		{
+			level_steps++;
+			playback_count += stack_magicq_playback_set_count(&program.steps[i].playbacks);
+		}
+	}
+
+	int16_t fade_start_level = 0, fade_curve = STACK_MAGICQ_FADE_CURVE_LINEAR;
+	stack_time_t action_time = 0;
+	stack_property_get_int16(cue->prop_fade_start_level, STACK_PROPERTY_VERSION_LIVE, &fade_start_level);
+	stack_property_get_int16(cue->prop_fade_curve, STACK_PROPERTY_VERSION_LIVE, &fade_curve);
+	stack_property_get_int64(cue->prop_action_time, STACK_PROPERTY_VERSION_LIVE, &action_time);
+	cue->fired = false;
+	cue->fade_active = level_steps > 0 && action_time > 1;
+	cue->fade_duration = action_time;
+	cue->fade_next_update = 0;
+	cue->fade_start_level = fade_start_level;
+	cue->fade_curve = (StackMagicQFadeCurve)fade_curve;
+	cue->fade_count = 0;
+	stack_property_get_bool(cue->prop_force_send, STACK_PROPERTY_VERSION_LIVE, &cue->force_send);
+
+	// Size the space for the fades and their steps now, so the pulse thread
+	// need not allocate. A level message for a single playback is always
+	// under 64 bytes
+	if (cue->fade_active && level_steps > cue->fade_capacity)
+	{
+		free(cue->fades);
+		cue->fades = (StackMagicQFade*)malloc(level_steps * sizeof(StackMagicQFade));
+		cue->fade_capacity = cue->fades != NULL ? level_steps : 0;
+	}
+
+	// Without the space, set the levels immediately instead
+	if (cue->fades == NULL)
+	{
+		cue->fade_active = false;
+	}
+	if (cue->fade_active)
+	{
+		for (size_t i = 0; i < program.step_count && cue->fade_count < cue->fade_capacity; i++)
+		{
+			if (program.steps[i].operation == MAGICQ_OPERATION_SET_LEVEL)
+			{
+				StackMagicQFade *fade = &cue->fades[cue->fade_count++];
+				fade->playbacks = program.steps[i].playbacks;
+				fade->end_level = program.steps[i].level;
+				fade->last_level = fade_start_level;
+			}
+		}
+
+		if (playback_count > cue->fade_command_capacity)
+		{
+			free(cue->fade_packet);
+			free(cue->fade_commands);
+			cue->fade_packet = (char*)malloc(playback_count * 64);
+			cue->fade_commands = (StackMagicQCommand*)malloc(playback_count * sizeof(StackMagicQCommand));
+			if (cue->fade_packet == NULL || cue->fade_commands == NULL)
+			{
+				free(cue->fade_packet);
+				free(cue->fade_commands);
+				cue->fade_packet = NULL;
+				cue->fade_commands = NULL;
+				playback_count = 0;
+			}
+			cue->fade_packet_capacity = playback_count * 64;
+			cue->fade_command_capacity = playback_count;
+		}
+	}
+
+	// Build the messages in the order that they're to be sent, each step being
+	// applied to every one of its playbacks before moving on to the next
+	cue->packet_length = 0;
+	cue->command_count = 0;
+	for (size_t i = 0; i < program.step_count; i++)
+	{
+		const StackMagicQStep *step = &program.steps[i];
+		int16_t level = (step->operation == MAGICQ_OPERATION_SET_LEVEL && cue->fade_active) ? fade_start_level : step->level;
+		const char *cue_id = step->operation == MAGICQ_OPERATION_JUMP_TO_CUE_ID ? step->cue_id : NULL;
+		stack_magicq_cue_compile_operation(cue, &step->playbacks, step->operation, level, cue_id);
+	}
+}
+
+/// Queues one datagram's worth of commands on the shared transport, and (if the
+/// ledger is enabled) records the ones that weren't suppressed. If asked to,
+/// and reliable delivery is on, the commands are tracked until MagicQ confirms
+/// them. Returns whether a message set was queued
+static bool stack_magicq_cue_send_chunk(StackMagicQCue *cue, const char *elements, size_t length, const StackMagicQCommand *commands, size_t first, size_t last, int64_t due, bool track)
+{
+	// If the rate is limited, anything other than a level change goes first.
+	// Level changes are keyed on the cue and the playbacks they are for, so
+	// that only the latest one waits to be sent
+	StackMagicQPriority priority = STACK_MAGICQ_PRIORITY_LEVEL;
+	uint64_t collapse_key = 14695981039346656037ull;
+	StackMagicQPlaybackSet playbacks;
+	stack_magicq_playback_set_clear(&playbacks);
+	for (size_t i = 0; i < 8; i++)
+	{
+		collapse_key = (collapse_key ^ ((STACK_CUE(cue)->uid >> (i * 8)) & 0xff)) * 1099511628211ull;
+	}
+	for (size_t i = first; i < last; i++)
+	{
+		if (commands[i].suppressed)
+		{
+			continue;
+		}
+
+		if (commands[i].operation != MAGICQ_OPERATION_SET_LEVEL)
+		{
+			priority = STACK_MAGICQ_PRIORITY_CONTROL;
+			collapse_key = 0;
+			break;
+		}
+		collapse_key = (collapse_key ^ (commands[i].playback & 0xff)) * 1099511628211ull;
+		collapse_key = (collapse_key ^ (commands[i].playback >> 8)) * 1099511628211ull;
+	}
+
+	// The playbacks that the ledger should forget if this doesn't reach the
+	// console
+	for (size_t i = first; i < last; i++)
+	{
+		if (!commands[i].suppressed)
+		{
+			stack_magicq_playback_set_add(&playbacks, commands[i].playback);
+		}
+	}
+
+	if (priority == STACK_MAGICQ_PRIORITY_LEVEL && collapse_key == 0)
+	{
+		// Zero means "don't collapse"
+		collapse_key = 1;
 	}
 
-	// Bind it somewhere locally
-	struct sockaddr_in source;
-	source.sin_family = AF_INET;
-	source.sin_port = htons(stack_magicq_cue_get_osc_port());
-	source.sin_addr.s_addr = htonl(INADDR_ANY);
-	int res = bind(cue->sock, (struct sockaddr *)&source, sizeof(source));
-	if (res == 0)
+	if (length == 0 || !stack_magicq_transport_enqueue(cue->transport, elements, length, STACK_CUE(cue)->uid, cue->metrics, due, priority, collapse_key, &playbacks))
 	{
-		stack_log("stack_magicq_cue_establish_socket(): Failed to bind socket (%d)\n", res);
-		close(cue->sock);
-		cue->sock = 0;
 		return false;
 	}
 
+	if (stack_magicq_ledger_enabled())
+	{
+		for (size_t i = first; i < last; i++)
+		{
+			if (!commands[i].suppressed)
+			{
+				stack_magicq_ledger_record(&commands[i]);
+			}
+		}
+	}
+
+	// The elements of the commands that weren't suppressed are back to back
+	if (track && stack_magicq_reliable_enabled())
+	{
+		size_t offset = 0;
+		for (size_t i = first; i < last; i++)
+		{
+			if (!commands[i].suppressed)
+			{
+				stack_magicq_reliable_track(&commands[i], &elements[offset], STACK_CUE(cue)->uid, cue->metrics, due);
+				offset += commands[i].length;
+			}
+		}
+	}
+
 	return true;
 }
 
-static bool stack_magicq_cue_send_osc_packet(StackMagicQCue *cue, MagicQOperation operation)
+/// Queues compiled commands on the shared transport, split in to as many
+/// message sets as are needed for each to fit in a single datagram. If the
+/// ledger is enabled, any commands that provably change nothing are left out,
+/// unless the cue is set to always send. The sender thread does the actual
+/// socket work, so this never blocks the pulse thread
+/// @param due When the commands should go out (transport clock), or zero for
+/// as soon as possible
+/// @param track Whether to retransmit the commands until MagicQ confirms them
+/// (if reliable delivery is on)
+/// @returns The number of message sets queued
+static size_t stack_magicq_cue_send_commands(StackMagicQCue *cue, const char *packet, StackMagicQCommand *commands, size_t command_count, int64_t due, bool track)
 {
-	// Note that this buffer must be at least eight bytes larger than our biggest
-	// command
-	char buffer[64];
-	memset(buffer, 0, 64);
+	if (command_count == 0)
+	{
+		return 0;
+	}
+	size_t sets = 0;
 
-	// Get the values from the properties
-	int16_t playback = 0, level = 0;
-	char *cue_id = NULL;
-	stack_property_get_int16(stack_cue_get_property(STACK_CUE(cue), "playback"), STACK_PROPERTY_VERSION_LIVE, &playback);
+	// Without the ledger, everything goes out exactly as compiled, straight
+	// from the packet
+	if (!stack_magicq_ledger_enabled())
+	{
+		size_t first = 0;
+		for (size_t i = 0; i < command_count; i++)
+		{
+			if (commands[i].offset + commands[i].length - commands[first].offset > STACK_MAGICQ_MAX_ELEMENTS)
+			{
+				sets += stack_magicq_cue_send_chunk(cue, &packet[commands[first].offset], commands[i].offset - commands[first].offset, commands, first, i, due, track) ? 1 : 0;
+				first = i;
+			}
+		}
+		sets += stack_magicq_cue_send_chunk(cue, &packet[commands[first].offset], commands[command_count - 1].offset + commands[command_count - 1].length - commands[first].offset, commands, first, command_count, due, track) ? 1 : 0;
+		return sets;
+	}
 
-	switch (operation)
+	// Copy out only the commands that will change something
+	char elements[STACK_MAGICQ_MAX_ELEMENTS];
+	size_t length = 0, first = 0;
+	for (size_t i = 0; i < command_count; i++)
 	{
-		case MAGICQ_OPERATION_ACTIVATE:
-			snprintf(buffer, 32, "/rpc/%dA", playback);
-			break;
-		case MAGICQ_OPERATION_RELEASE:
-			snprintf(buffer, 32, "/rpc/%dR", playback);
-			break;
-		case MAGICQ_OPERATION_GO:
-			snprintf(buffer, 32, "/rpc/%dG", playback);
-			break;
-		case MAGICQ_OPERATION_STOP:
-			snprintf(buffer, 32, "/rpc/%dS", playback);
+		commands[i].suppressed = !cue->force_send && stack_magicq_ledger_is_redundant(&commands[i]);
+		if (commands[i].suppressed)
+		{
+			continue;
+		}
+
+		if (length + commands[i].length > STACK_MAGICQ_MAX_ELEMENTS)
+		{
+			sets += stack_magicq_cue_send_chunk(cue, elements, length, commands, first, i, due, track) ? 1 : 0;
+			length = 0;
+			first = i;
+		}
+
+		memcpy(&elements[length], &packet[commands[i].offset], commands[i].length);
+		length += commands[i].length;
+	}
+	sets += stack_magicq_cue_send_chunk(cue, elements, length, commands, first, command_count, due, track) ? 1 : 0;
+
+	return sets;
+}
+
+/// Calculates the level of a fade at a given point through it
+/// @param cue The cue that is fading
+/// @param fade The fade (of one level step) to calculate the level of
+/// @param progress How far through the fade we are, from 0.0 to 1.0
+static int16_t stack_magicq_cue_get_fade_level(StackMagicQCue *cue, const StackMagicQFade *fade, double progress)
+{
+	double shaped = progress;
+	switch (cue->fade_curve)
+	{
+		case STACK_MAGICQ_FADE_CURVE_LINEAR:
 			break;
-		case MAGICQ_OPERATION_SET_LEVEL:
-			stack_property_get_int16(stack_cue_get_property(STACK_CUE(cue), "level"), STACK_PROPERTY_VERSION_LIVE, &level);
-			snprintf(buffer, 32, "/rpc/%d,%dL", playback, level);
+		case STACK_MAGICQ_FADE_CURVE_S_CURVE:
+			shaped = progress * progress * (3.0 - 2.0 * progress);
 			break;
-		case MAGICQ_OPERATION_JUMP_TO_CUE_ID:
-			stack_property_get_string(stack_cue_get_property(STACK_CUE(cue), "jump_cue_id"), STACK_PROPERTY_VERSION_LIVE, &cue_id);
-			snprintf(buffer, 32, "/rpc/%d,%sJ", playback, cue_id);
+		case STACK_MAGICQ_FADE_CURVE_EXPONENTIAL:
+			shaped = (pow(2.0, 10.0 * progress) - 1.0) / 1023.0;
 			break;
 	}
 
-	// Get the length of the commad (plus one for the NUL terminator)
-	size_t length = strlen(buffer) + 1;
+	return (int16_t)lround((double)cue->fade_start_level + (double)(fade->end_level - cue->fade_start_level) * shaped);
+}
 
-	// Pad to nearest four bytes as per the OSC protocol
-	length += length % 4;
+/// Queues a level message for every playback of the fades whose (quantised)
+/// level has changed since they last sent one. Either only the fades that have
+/// reached their end level are sent, or only those that haven't: only the end
+/// levels are worth retransmitting, as the fade will have moved on by the time
+/// any of the others could be
+static void stack_magicq_cue_send_fade_levels(StackMagicQCue *cue, double progress, bool end_levels)
+{
+	// Encode the new levels, in to the space that was set aside when the cue
+	// was played
+	size_t command_count = 0, length = 0;
+	for (size_t i = 0; i < cue->fade_count; i++)
+	{
+		StackMagicQFade *fade = &cue->fades[i];
+		int16_t level = stack_magicq_cue_get_fade_level(cue, fade, progress);
+		if (level == fade->last_level || (level == fade->end_level) != end_levels)
+		{
+			continue;
+		}
 
-	// Add on the comma (plus a implied three NULs padding) as per the OSC
-	// protocol to imply zero arguments
-	snprintf(&buffer[length], 32 - length, ",");
-	length += 4;
+		for (int playback = stack_magicq_playback_set_next(&fade->playbacks, 0); playback > 0 && command_count < cue->fade_command_capacity; playback = stack_magicq_playback_set_next(&fade->playbacks, playback))
+		{
+			size_t offset = length;
+			length = stack_magicq_cue_append_operation(cue, cue->fade_packet, offset, cue->fade_packet_capacity, MAGICQ_OPERATION_SET_LEVEL, (int16_t)playback, level, NULL);
+			if (length == offset)
+			{
+				break;
+			}
+
+			StackMagicQCommand *command = &cue->fade_commands[command_count++];
+			command->operation = MAGICQ_OPERATION_SET_LEVEL;
+			command->playback = (uint16_t)playback;
+			command->level = level;
+			command->cue_id = 0;
+			command->offset = (uint32_t)offset;
+			command->length = (uint32_t)(length - offset);
+			command->suppressed = false;
+		}
+		fade->last_level = level;
+	}
 
-	// Ensure the socket is ready
-	if (!stack_magicq_cue_establish_socket(cue))
+	if (command_count > 0)
 	{
-		return false;
+		stack_magicq_cue_send_commands(cue, cue->fade_packet, cue->fade_commands, command_count, 0, end_levels);
 	}
+}
 
-	// Set destination
-	struct sockaddr_in dest;
-	dest.sin_family = AF_INET;
-	dest.sin_port = htons(stack_magicq_cue_get_osc_port());
-	dest.sin_addr.s_addr = htonl(0x7f000001); // TODO Configurable
+/// Advances the level fades, queueing level messages at most once per fade
+/// interval, and only for the fades whose (quantised) level has changed since
+/// the last ones
+static void stack_magicq_cue_pulse_fade(StackMagicQCue *cue, StackCueState pre_pulse_state, stack_time_t clocktime)
+{
+	double progress = 1.0;
 
-	// Send datagram
-	int s = sendto(cue->sock, buffer, length, 0, (struct sockaddr *)&dest, sizeof(dest));
-	if (s <= 0)
+	switch (STACK_CUE(cue)->state)
 	{
-		stack_log("stack_magicq_cue_send_osc_packet(): Failed to send datagram (%d)\n", s);
+		case STACK_CUE_STATE_PLAYING_PRE:
+		case STACK_CUE_STATE_PAUSED:
+			// Nothing to do until we're running the action
+			return;
 
-		// Close the socket so we will re-establish on next attempt
-		close(cue->sock);
-		cue->sock = 0;
-		return false;
+		case STACK_CUE_STATE_PLAYING_ACTION:
+		{
+			stack_time_t run_pre = 0, run_action = 0, run_post = 0, paused = 0, real = 0, total = 0;
+			stack_cue_get_running_times(STACK_CUE(cue), clocktime, &run_pre, &run_action, &run_post, &paused, &real, &total);
+
+			// Limit the rate at which we send updates
+			if (run_action < cue->fade_next_update)
+			{
+				return;
+			}
+			cue->fade_next_update = run_action + smc_fade_interval;
+
+			progress = (double)run_action / (double)cue->fade_duration;
+			if (progress > 1.0)
+			{
+				progress = 1.0;
+			}
+			break;
+		}
+
+		default:
+			// If we weren't running at the start of this pulse then we've been
+			// stopped, so abandon the fade where it is. Otherwise the action has
+			// completed, so make sure we finish on the target level
+			if (pre_pulse_state != STACK_CUE_STATE_PLAYING_PRE && pre_pulse_state != STACK_CUE_STATE_PLAYING_ACTION)
+			{
+				cue->fade_active = false;
+				return;
+			}
+			break;
 	}
 
-	return true;
+	stack_magicq_cue_send_fade_levels(cue, progress, false);
+	stack_magicq_cue_send_fade_levels(cue, progress, true);
+
+	if (progress >= 1.0)
+	{
+		cue->fade_active = false;
+	}
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -499,12 +900,22 @@ static bool stack_magicq_cue_send_osc_packet(StackMagicQCue *cue, MagicQOperatio
 /// Start the cue playing
 static bool stack_magicq_cue_play(StackCue *cue)
 {
+	// Get the state before the superclass changes it
+	StackCueState pre_play_state = cue->state;
+
 	// Call the superclass
 	if (!stack_cue_play_base(cue))
 	{
 		return false;
 	}
 
+	// When resuming, carry on with what was compiled when the cue was played,
+	// and only fire if it hasn't already (or its scheduled fire was recalled)
+	if (pre_play_state == STACK_CUE_STATE_PAUSED)
+	{
+		return true;
+	}
+
 	// Double-check our error state and don't play if we're broken
 	if (stack_magicq_cue_update_error_state(STACK_MAGICQ_CUE(cue)))
 	{
@@ -512,74 +923,167 @@ static bool stack_magicq_cue_play(StackCue *cue)
 	}
 
 	// Copy the variables to live
-	stack_property_copy_defined_to_live(stack_cue_get_property(cue, "playback"));
-	stack_property_copy_defined_to_live(stack_cue_get_property(cue, "action_activate"));
-	stack_property_copy_defined_to_live(stack_cue_get_property(cue, "action_level"));
-	stack_property_copy_defined_to_live(stack_cue_get_property(cue, "level"));
-	stack_property_copy_defined_to_live(stack_cue_get_property(cue, "action_go"));
-	stack_property_copy_defined_to_live(stack_cue_get_property(cue, "action_stop"));
-	stack_property_copy_defined_to_live(stack_cue_get_property(cue, "action_jump"));
-	stack_property_copy_defined_to_live(stack_cue_get_property(cue, "jump_cue_id"));
-	stack_property_copy_defined_to_live(stack_cue_get_property(cue, "action_release"));
+	stack_property_copy_defined_to_live(STACK_MAGICQ_CUE(cue)->prop_program);
+	stack_property_copy_defined_to_live(STACK_MAGICQ_CUE(cue)->prop_fade_start_level);
+	stack_property_copy_defined_to_live(STACK_MAGICQ_CUE(cue)->prop_fade_curve);
+	stack_property_copy_defined_to_live(STACK_MAGICQ_CUE(cue)->prop_force_send);
+
+	// Build the messages we're going to send
+	stack_magicq_cue_compile_packet(STACK_MAGICQ_CUE(cue));
+
+	return true;
+}
+
+/// Asks the transport to cancel messages that were handed to it ahead of the
+/// end of the pre-wait, if they haven't gone out yet. Whether they had is only
+/// known once the sender thread has answered (see
+/// stack_magicq_cue_check_cancel())
+static void stack_magicq_cue_cancel_scheduled(StackMagicQCue *cue)
+{
+	if (!cue->fire_scheduled)
+	{
+		return;
+	}
+	cue->fire_scheduled = false;
+
+	// The ledger recorded the commands when they were queued. Whether or not
+	// they are recalled, it can't be sure of what MagicQ has any more, and
+	// forgetting is always safe
+	if (stack_magicq_ledger_enabled())
+	{
+		for (size_t i = 0; i < cue->command_count; i++)
+		{
+			if (!cue->commands[i].suppressed)
+			{
+				stack_magicq_ledger_forget(&cue->commands[i]);
+			}
+		}
+	}
+
+	// If the queue is full, the messages will go out as scheduled
+	if (!stack_magicq_transport_cancel(cue->transport, STACK_CUE(cue)->uid, cue->metrics))
+	{
+		return;
+	}
+	cue->cancel_pending = true;
+	cue->cancels_requested++;
+	cue->cancel_due = cue->fire_due;
+	cue->cancel_sets = cue->fire_sets;
+}
+
+/// Picks up the sender thread's answer to a request to cancel a scheduled fire.
+/// Only if every message set was recalled can the cue fire again: if any went
+/// out (because they were already due, or were sent early with a timetag, or
+/// there was no room to hold them back) then MagicQ has them. Returns false if
+/// the answer isn't in yet, in which case the cue mustn't fire
+static bool stack_magicq_cue_check_cancel(StackMagicQCue *cue)
+{
+	if (!cue->cancel_pending)
+	{
+		return true;
+	}
+
+	if (cue->metrics->cancels_answered.load(std::memory_order_acquire) != cue->cancels_requested)
+	{
+		return false;
+	}
+	cue->cancel_pending = false;
+
+	size_t recalled = (size_t)cue->metrics->last_cancel_recalled.load(std::memory_order_relaxed);
+	if (recalled == 0)
+	{
+		return true;
+	}
+	if (recalled < cue->cancel_sets)
+	{
+		// Some of it reached MagicQ, so don't send it all again. The commands
+		// stay tracked, so those that were recalled are retransmitted if
+		// reliable delivery is on
+		stack_log("stack_magicq_cue_check_cancel(): Only %lu of %lu message sets were recalled\n", recalled, cue->cancel_sets);
+		return true;
+	}
+
+	// None of it was sent, so there's nothing to confirm, and the cue can
+	// fire again (e.g. when it is resumed)
+	stack_magicq_reliable_forget(STACK_CUE(cue)->uid, cue->cancel_due);
+	cue->fired = false;
 
 	return true;
 }
 
+/// Pauses the cue, holding back anything scheduled for the end of the pre-wait
+static void stack_magicq_cue_pause(StackCue *cue)
+{
+	stack_magicq_cue_cancel_scheduled(STACK_MAGICQ_CUE(cue));
+
+	// Call the superclass
+	stack_cue_pause_base(cue);
+}
+
+/// Stops the cue, cancelling anything scheduled for the end of the pre-wait
+static void stack_magicq_cue_stop(StackCue *cue)
+{
+	stack_magicq_cue_cancel_scheduled(STACK_MAGICQ_CUE(cue));
+
+	// Call the superclass
+	stack_cue_stop_base(cue);
+}
+
 /// Update the cue based on time
 static void stack_magicq_cue_pulse(StackCue *cue, stack_time_t clocktime)
 {
-	bool this_action = false;
+	StackMagicQCue *mcue = STACK_MAGICQ_CUE(cue);
+
 	// Get the cue state before the base class potentially updates it
 	StackCueState pre_pulse_state = cue->state;
 
 	// Call superclass
 	stack_cue_pulse_base(cue, clocktime);
 
-	// We have zero action time so we need to detect the transition from pre->something or playing->something
-	if ((pre_pulse_state == STACK_CUE_STATE_PLAYING_PRE && cue->state != STACK_CUE_STATE_PLAYING_PRE) ||
-		(pre_pulse_state == STACK_CUE_STATE_PLAYING_ACTION && cue->state != STACK_CUE_STATE_PLAYING_ACTION))
+	// Don't fire while we're waiting to hear whether a cancelled fire went out
+	bool can_fire = stack_magicq_cue_check_cancel(mcue);
+
+	// Towards the end of the pre-wait, hand the messages to the transport along
+	// with the exact time the pre-wait ends, so that they go out on time rather
+	// than whenever the next pulse happens to notice
+	if (can_fire && !mcue->fired && smc_schedule_ahead > 0 && cue->state == STACK_CUE_STATE_PLAYING_PRE)
 	{
-		this_action = false;
-		stack_property_get_bool(stack_cue_get_property(STACK_CUE(cue), "action_activate"), STACK_PROPERTY_VERSION_LIVE, &this_action);
-		if (this_action)
-		{
-			stack_magicq_cue_send_osc_packet(STACK_MAGICQ_CUE(cue), MAGICQ_OPERATION_ACTIVATE);
-		}
+		stack_time_t run_pre = 0, run_action = 0, run_post = 0, paused = 0, real = 0, total = 0, pre_time = 0;
+		stack_cue_get_running_times(cue, clocktime, &run_pre, &run_action, &run_post, &paused, &real, &total);
+		stack_property_get_int64(mcue->prop_pre_time, STACK_PROPERTY_VERSION_LIVE, &pre_time);
 
-		this_action = false;
-		stack_property_get_bool(stack_cue_get_property(STACK_CUE(cue), "action_level"), STACK_PROPERTY_VERSION_LIVE, &this_action);
-		if (this_action)
+		stack_time_t remaining = pre_time - run_pre;
+		if (remaining <= smc_schedule_ahead)
 		{
-			stack_magicq_cue_send_osc_packet(STACK_MAGICQ_CUE(cue), MAGICQ_OPERATION_SET_LEVEL);
+			mcue->fired = true;
+			mcue->fire_scheduled = true;
+			mcue->fire_due = stack_magicq_transport_now() + (remaining > 0 ? remaining : 0);
+			mcue->fire_sets = stack_magicq_cue_send_commands(mcue, mcue->packet, mcue->commands, mcue->command_count, mcue->fire_due, true);
 		}
+	}
 
-		this_action = false;
-		stack_property_get_bool(stack_cue_get_property(STACK_CUE(cue), "action_go"), STACK_PROPERTY_VERSION_LIVE, &this_action);
-		if (this_action)
-		{
-			stack_magicq_cue_send_osc_packet(STACK_MAGICQ_CUE(cue), MAGICQ_OPERATION_GO);
-		}
+	// Otherwise, fire the first time we see the cue running beyond its
+	// pre-wait
+	if (can_fire && !mcue->fired && cue->state != STACK_CUE_STATE_PLAYING_PRE &&
+		(pre_pulse_state == STACK_CUE_STATE_PLAYING_PRE || pre_pulse_state == STACK_CUE_STATE_PLAYING_ACTION))
+	{
+		mcue->fired = true;
 
-		this_action = false;
-		stack_property_get_bool(stack_cue_get_property(STACK_CUE(cue), "action_jump"), STACK_PROPERTY_VERSION_LIVE, &this_action);
-		if (this_action)
-		{
-			stack_magicq_cue_send_osc_packet(STACK_MAGICQ_CUE(cue), MAGICQ_OPERATION_JUMP_TO_CUE_ID);
-		}
+		// Queue the messages compiled at play time (which are sent as a single
+		// bundle if bundles are enabled)
+		stack_magicq_cue_send_commands(mcue, mcue->packet, mcue->commands, mcue->command_count, 0, true);
+	}
 
-		this_action = false;
-		stack_property_get_bool(stack_cue_get_property(STACK_CUE(cue), "action_stop"), STACK_PROPERTY_VERSION_LIVE, &this_action);
-		if (this_action)
-		{
-			stack_magicq_cue_send_osc_packet(STACK_MAGICQ_CUE(cue), MAGICQ_OPERATION_ACTIVATE);
-		}
+	// Once the pre-wait is over, whatever was scheduled has gone
+	if (mcue->fire_scheduled && cue->state != STACK_CUE_STATE_PLAYING_PRE)
+	{
+		mcue->fire_scheduled = false;
+	}
 
-		this_action = false;
-		stack_property_get_bool(stack_cue_get_property(STACK_CUE(cue), "action_release"), STACK_PROPERTY_VERSION_LIVE, &this_action);
-		if (this_action)
-		{
-			stack_magicq_cue_send_osc_packet(STACK_MAGICQ_CUE(cue), MAGICQ_OPERATION_RELEASE);
-		}
+	// Advance any level fade that's in progress
+	if (mcue->fired && mcue->fade_active)
+	{
+		stack_magicq_cue_pulse_fade(mcue, pre_pulse_state, clocktime);
 	}
 }
 
@@ -596,20 +1100,25 @@ static void stack_magicq_cue_set_tabs(StackCue *cue, GtkNotebook *notebook)
 	{
 		smc_builder = gtk_builder_new_from_resource("/org/stack/ui/StackMagicQCue.ui");
 
-		stack_limit_gtk_entry_float(GTK_ENTRY(gtk_builder_get_object(smc_builder, "mcpEntryCueID")), false);
-		stack_limit_gtk_entry_int(GTK_ENTRY(gtk_builder_get_object(smc_builder, "mcpEntryPlayback")), false);
-		stack_limit_gtk_entry_int(GTK_ENTRY(gtk_builder_get_object(smc_builder, "mcpEntryLevel")), false);
+		// Find the widgets we need
+		smc_widgets.grid = GTK_WIDGET(gtk_builder_get_object(smc_builder, "mcpGrid"));
+		smc_widgets.entry_program = GTK_ENTRY(gtk_builder_get_object(smc_builder, "mcpEntryProgram"));
+		smc_widgets.entry_start_level = GTK_ENTRY(gtk_builder_get_object(smc_builder, "mcpEntryStartLevel"));
+		smc_widgets.check_force_send = GTK_TOGGLE_BUTTON(gtk_builder_get_object(smc_builder, "mcpCheckForceSend"));
+		smc_widgets.combo_fade_curve = GTK_COMBO_BOX(gtk_builder_get_object(smc_builder, "mcpComboFadeCurve"));
+
+		stack_limit_gtk_entry_int(smc_widgets.entry_start_level, false);
 
 		// Set up callbacks
-		gtk_builder_add_callback_symbol(smc_builder, "mcp_action_toggled", G_CALLBACK(mcp_action_toggled));
-		gtk_builder_add_callback_symbol(smc_builder, "mcp_playback_changed", G_CALLBACK(mcp_playback_changed));
-		gtk_builder_add_callback_symbol(smc_builder, "mcp_level_changed", G_CALLBACK(mcp_level_changed));
-		gtk_builder_add_callback_symbol(smc_builder, "mcp_jump_cue_id_changed", G_CALLBACK(mcp_jump_cue_id_changed));
+		gtk_builder_add_callback_symbol(smc_builder, "mcp_program_changed", G_CALLBACK(mcp_program_changed));
+		gtk_builder_add_callback_symbol(smc_builder, "mcp_start_level_changed", G_CALLBACK(mcp_start_level_changed));
+		gtk_builder_add_callback_symbol(smc_builder, "mcp_fade_curve_changed", G_CALLBACK(mcp_fade_curve_changed));
+		gtk_builder_add_callback_symbol(smc_builder, "mcp_force_send_toggled", G_CALLBACK(mcp_force_send_toggled));
 
 		// Connect the signals
 		gtk_builder_connect_signals(smc_builder, NULL);
 	}
-	acue->magicq_tab = GTK_WIDGET(gtk_builder_get_object(smc_builder, "mcpGrid"));
+	acue->magicq_tab = smc_widgets.grid;
 
 	// Pause change callbacks on the properties
 	stack_magicq_cue_pause_change_callbacks(cue, true);
@@ -625,35 +1134,24 @@ static void stack_magicq_cue_set_tabs(StackCue *cue, GtkNotebook *notebook)
 	gtk_notebook_append_page(notebook, acue->magicq_tab, label);
 	gtk_widget_show(acue->magicq_tab);
 
-	int16_t playback = 0, level = 0;
+	int16_t fade_start_level = 0, fade_curve = 0;
 	char buffer[64];
-	char *cue_id = NULL;
-	bool action_activate = false, action_level = false, action_go = false,
-		 action_stop = false, action_jump = false, action_release = false;
+	char *program_text = NULL;
+	bool force_send = false;
 
 	// Get the values from the properties
-	stack_property_get_int16(stack_cue_get_property(cue, "playback"), STACK_PROPERTY_VERSION_DEFINED, &playback);
-	stack_property_get_int16(stack_cue_get_property(cue, "level"), STACK_PROPERTY_VERSION_DEFINED, &level);
-	stack_property_get_string(stack_cue_get_property(cue, "jump_cue_id"), STACK_PROPERTY_VERSION_DEFINED, &cue_id);
-	stack_property_get_bool(stack_cue_get_property(cue, "action_activate"), STACK_PROPERTY_VERSION_DEFINED, &action_activate);
-	stack_property_get_bool(stack_cue_get_property(cue, "action_level"), STACK_PROPERTY_VERSION_DEFINED, &action_level);
-	stack_property_get_bool(stack_cue_get_property(cue, "action_go"), STACK_PROPERTY_VERSION_DEFINED, &action_go);
-	stack_property_get_bool(stack_cue_get_property(cue, "action_stop"), STACK_PROPERTY_VERSION_DEFINED, &action_stop);
-	stack_property_get_bool(stack_cue_get_property(cue, "action_jump"), STACK_PROPERTY_VERSION_DEFINED, &action_jump);
-	stack_property_get_bool(stack_cue_get_property(cue, "action_release"), STACK_PROPERTY_VERSION_DEFINED, &action_release);
+	stack_property_get_string(STACK_MAGICQ_CUE(cue)->prop_program, STACK_PROPERTY_VERSION_DEFINED, &program_text);
+	stack_property_get_int16(STACK_MAGICQ_CUE(cue)->prop_fade_start_level, STACK_PROPERTY_VERSION_DEFINED, &fade_start_level);
+	stack_property_get_int16(STACK_MAGICQ_CUE(cue)->prop_fade_curve, STACK_PROPERTY_VERSION_DEFINED, &fade_curve);
+	stack_property_get_bool(STACK_MAGICQ_CUE(cue)->prop_force_send, STACK_PROPERTY_VERSION_DEFINED, &force_send);
 
 	// Set all the values
-	snprintf(buffer, 64, "%d", playback);
-	gtk_entry_set_text(GTK_ENTRY(gtk_builder_get_object(smc_builder, "mcpEntryPlayback")), buffer);
-	snprintf(buffer, 64, "%d", level);
-	gtk_entry_set_text(GTK_ENTRY(gtk_builder_get_object(smc_builder, "mcpEntryLevel")), buffer);
-	gtk_entry_set_text(GTK_ENTRY(gtk_builder_get_object(smc_builder, "mcpEntryCueID")), cue_id);
-	gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(gtk_builder_get_object(smc_builder, "mcpCheckActivate")), action_activate);
-	gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(gtk_builder_get_object(smc_builder, "mcpCheckLevel")), action_level);
-	gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(gtk_builder_get_object(smc_builder, "mcpCheckGo")), action_go);
-	gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(gtk_builder_get_object(smc_builder, "mcpCheckStop")), action_stop);
-	gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(gtk_builder_get_object(smc_builder, "mcpCheckJump")), action_jump);
-	gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(gtk_builder_get_object(smc_builder, "mcpCheckRelease")), action_release);
+	gtk_entry_set_text(smc_widgets.entry_program, program_text != NULL ? program_text : "");
+	snprintf(buffer, 64, "%d", fade_start_level);
+	gtk_entry_set_text(smc_widgets.entry_start_level, buffer);
+	snprintf(buffer, 64, "%d", fade_curve);
+	gtk_combo_box_set_active_id(smc_widgets.combo_fade_curve, buffer);
+	gtk_toggle_button_set_active(smc_widgets.check_force_send, force_send);
 
 	// Resume change callbacks on the properties
 	stack_magicq_cue_pause_change_callbacks(cue, false);
@@ -678,35 +1176,318 @@ static void stack_magicq_cue_unset_tabs(StackCue *cue, GtkNotebook *notebook)
 	STACK_MAGICQ_CUE(cue)->magicq_tab = NULL;
 }
 
-/// Saves the details of this cue as JSON
-static char *stack_magicq_cue_to_json(StackCue *cue)
+// A growable buffer that cues are serialised in to. There is a shared one
+// that is reused for every cue, so saving a show does not allocate per cue
+struct StackMagicQJsonBuffer
 {
-	StackMagicQCue *acue = STACK_MAGICQ_CUE(cue);
+	char *data;
+	size_t length;
+	size_t capacity;
+};
+
+// Global: The shared serialisation buffer, whether it is being written to or
+// has been handed out by stack_magicq_cue_to_json and not yet given back, and
+// the data that was handed out
+static StackMagicQJsonBuffer smc_json_buffer = { NULL, 0, 0 };
+static std::atomic<bool> smc_json_buffer_in_use(false);
+static std::atomic<char*> smc_json_buffer_handed_out(NULL);
+
+/// Ensures there is space for some more characters in the JSON buffer
+static bool stack_magicq_cue_json_reserve(StackMagicQJsonBuffer *buffer, size_t extra)
+{
+	// Always leave room for a NUL terminator
+	if (buffer->length + extra + 1 <= buffer->capacity)
+	{
+		return true;
+	}
 
-	// Build JSON
-	Json::Value cue_root;
+	size_t capacity = buffer->capacity > 0 ? buffer->capacity : 512;
+	while (buffer->length + extra + 1 > capacity)
+	{
+		capacity *= 2;
+	}
+
+	char *data = (char*)realloc(buffer->data, capacity);
+	if (data == NULL)
+	{
+		return false;
+	}
+
+	buffer->data = data;
+	buffer->capacity = capacity;
+	return true;
+}
+
+/// Appends raw characters to the JSON buffer
+static void stack_magicq_cue_json_append(StackMagicQJsonBuffer *buffer, const char *text, size_t length)
+{
+	if (stack_magicq_cue_json_reserve(buffer, length))
+	{
+		memcpy(&buffer->data[buffer->length], text, length);
+		buffer->length += length;
+	}
+}
+
+/// Appends a JSON string (with quotes and escaping) to the JSON buffer
+static void stack_magicq_cue_json_append_string(StackMagicQJsonBuffer *buffer, const char *value)
+{
+	stack_magicq_cue_json_append(buffer, "\"", 1);
+	for (const char *c = value; *c != '\0'; c++)
+	{
+		switch (*c)
+		{
+			case '"':
+				stack_magicq_cue_json_append(buffer, "\\\"", 2);
+				break;
+			case '\\':
+				stack_magicq_cue_json_append(buffer, "\\\\", 2);
+				break;
+			case '\n':
+				stack_magicq_cue_json_append(buffer, "\\n", 2);
+				break;
+			case '\r':
+				stack_magicq_cue_json_append(buffer, "\\r", 2);
+				break;
+			case '\t':
+				stack_magicq_cue_json_append(buffer, "\\t", 2);
+				break;
+			default:
+				if ((unsigned char)*c < 0x20)
+				{
+					char escape[8];
+					snprintf(escape, sizeof(escape), "\\u%04x", (unsigned char)*c);
+					stack_magicq_cue_json_append(buffer, escape, 6);
+				}
+				else
+				{
+					stack_magicq_cue_json_append(buffer, c, 1);
+				}
+				break;
+		}
+	}
+	stack_magicq_cue_json_append(buffer, "\"", 1);
+}
+
+/// Appends the key of an object member (and a separator if needed)
+static void stack_magicq_cue_json_append_key(StackMagicQJsonBuffer *buffer, const char *key)
+{
+	if (buffer->length > 1)
+	{
+		stack_magicq_cue_json_append(buffer, ",", 1);
+	}
+	stack_magicq_cue_json_append_string(buffer, key);
+	stack_magicq_cue_json_append(buffer, ":", 1);
+}
+
+/// Appends an object member holding the defined value of an int16 property
+static void stack_magicq_cue_json_append_int16(StackMagicQJsonBuffer *buffer, const char *key, StackProperty *property)
+{
+	int16_t value = 0;
+	char text[8];
+	stack_property_get_int16(property, STACK_PROPERTY_VERSION_DEFINED, &value);
+	stack_magicq_cue_json_append_key(buffer, key);
+	stack_magicq_cue_json_append(buffer, text, (size_t)snprintf(text, sizeof(text), "%d", value));
+}
+
+/// Appends an object member holding the defined value of a bool property
+static void stack_magicq_cue_json_append_bool(StackMagicQJsonBuffer *buffer, const char *key, StackProperty *property)
+{
+	bool value = false;
+	stack_property_get_bool(property, STACK_PROPERTY_VERSION_DEFINED, &value);
+	stack_magicq_cue_json_append_key(buffer, key);
+	if (value)
+	{
+		stack_magicq_cue_json_append(buffer, "true", 4);
+	}
+	else
+	{
+		stack_magicq_cue_json_append(buffer, "false", 5);
+	}
+}
+
+/// Appends an object member holding a program, as an array of steps, each an
+/// array of the operation name, the playbacks and (for level and jump steps)
+/// the argument, e.g. [["activate","1-4"],["level","1-4",50]]
+static void stack_magicq_cue_json_append_program(StackMagicQJsonBuffer *buffer, const char *key, const StackMagicQProgram *program)
+{
+	char text[STACK_MAGICQ_PLAYBACK_SET_MAX_TEXT];
+	stack_magicq_cue_json_append_key(buffer, key);
+	stack_magicq_cue_json_append(buffer, "[", 1);
+	for (size_t i = 0; i < program->step_count; i++)
+	{
+		const StackMagicQStep *step = &program->steps[i];
+		if (i > 0)
+		{
+			stack_magicq_cue_json_append(buffer, ",", 1);
+		}
+		stack_magicq_cue_json_append(buffer, "[", 1);
+		stack_magicq_cue_json_append_string(buffer, stack_magicq_program_get_operation_name(step->operation));
+		stack_magicq_cue_json_append(buffer, ",", 1);
+		stack_magicq_playback_set_format(&step->playbacks, text, sizeof(text));
+		stack_magicq_cue_json_append_string(buffer, text);
+		if (step->operation == MAGICQ_OPERATION_SET_LEVEL)
+		{
+			stack_magicq_cue_json_append(buffer, text, (size_t)snprintf(text, sizeof(text), ",%d", step->level));
+		}
+		else if (step->operation == MAGICQ_OPERATION_JUMP_TO_CUE_ID && step->cue_id[0] != '\0')
+		{
+			stack_magicq_cue_json_append(buffer, ",", 1);
+			stack_magicq_cue_json_append_string(buffer, step->cue_id);
+		}
+		stack_magicq_cue_json_append(buffer, "]", 1);
+	}
+	stack_magicq_cue_json_append(buffer, "]", 1);
+}
+
+/// Saves the details of this cue as JSON. The result is written in to the
+/// shared buffer, which belongs to the caller until they give it back to
+/// stack_magicq_cue_free_json. If it's still held from an earlier call (or by
+/// another thread), a buffer of its own is allocated instead
+static char *stack_magicq_cue_to_json(StackCue *cue)
+{
+	StackMagicQCue *mcue = STACK_MAGICQ_CUE(cue);
+	StackMagicQJsonBuffer heap_buffer = { NULL, 0, 0 };
+	StackMagicQJsonBuffer *buffer = &heap_buffer;
+	bool expected = false;
+	if (smc_json_buffer_in_use.compare_exchange_strong(expected, true, std::memory_order_acquire))
+	{
+		buffer = &smc_json_buffer;
+	}
 
 	// Write out our properties
-	stack_property_write_json(stack_cue_get_property(cue, "playback"), &cue_root);
-	stack_property_write_json(stack_cue_get_property(cue, "action_activate"), &cue_root);
-	stack_property_write_json(stack_cue_get_property(cue, "action_level"), &cue_root);
-	stack_property_write_json(stack_cue_get_property(cue, "level"), &cue_root);
-	stack_property_write_json(stack_cue_get_property(cue, "action_go"), &cue_root);
-	stack_property_write_json(stack_cue_get_property(cue, "action_stop"), &cue_root);
-	stack_property_write_json(stack_cue_get_property(cue, "action_jump"), &cue_root);
-	stack_property_write_json(stack_cue_get_property(cue, "jump_cue_id"), &cue_root);
-	stack_property_write_json(stack_cue_get_property(cue, "action_release"), &cue_root);
-
-	// Write out JSON string and return (to be free'd by
-	// stack_magicq_cue_free_json)
-	Json::StreamWriterBuilder builder;
-	return strdup(Json::writeString(builder, cue_root).c_str());
-}
-
-/// Frees JSON strings as returned by stack_magicq_cue_to_json
+	buffer->length = 0;
+	stack_magicq_cue_json_append(buffer, "{", 1);
+	stack_magicq_cue_json_append_program(buffer, "program", &mcue->program);
+	stack_magicq_cue_json_append_int16(buffer, "fade_start_level", mcue->prop_fade_start_level);
+	stack_magicq_cue_json_append_int16(buffer, "fade_curve", mcue->prop_fade_curve);
+	stack_magicq_cue_json_append_bool(buffer, "force_send", mcue->prop_force_send);
+	stack_magicq_cue_json_append(buffer, "}", 1);
+
+	if (buffer->data == NULL)
+	{
+		if (buffer == &smc_json_buffer)
+		{
+			smc_json_buffer_in_use.store(false, std::memory_order_release);
+		}
+		return NULL;
+	}
+	buffer->data[buffer->length] = '\0';
+
+	if (buffer == &smc_json_buffer)
+	{
+		smc_json_buffer_handed_out.store(buffer->data, std::memory_order_relaxed);
+	}
+
+	return buffer->data;
+}
+
+/// Frees JSON strings as returned by stack_magicq_cue_to_json. The shared buffer
+/// is given back to be reused for the next cue, anything else is freed
 static void stack_magicq_cue_free_json(StackCue *cue, char *json_data)
 {
-	free(json_data);
+	if (json_data == NULL)
+	{
+		return;
+	}
+
+	char *handed_out = json_data;
+	if (smc_json_buffer_handed_out.compare_exchange_strong(handed_out, NULL, std::memory_order_relaxed))
+	{
+		smc_json_buffer_in_use.store(false, std::memory_order_release);
+	}
+	else
+	{
+		free(json_data);
+	}
+}
+
+/// Reads a program stored as an array of steps (see
+/// stack_magicq_cue_json_append_program). Invalid steps are skipped
+static void stack_magicq_cue_program_from_json(const Json::Value &steps, StackMagicQProgram *program)
+{
+	stack_magicq_program_clear(program);
+	for (Json::ArrayIndex i = 0; i < steps.size(); i++)
+	{
+		const Json::Value &step = steps[i];
+		MagicQOperation operation;
+		StackMagicQPlaybackSet playbacks;
+		if (!step.isArray() || step.size() < 2 || !step[0].isString() || !step[1].isString() ||
+			!stack_magicq_program_get_operation(step[0].asString().c_str(), &operation) ||
+			!stack_magicq_playback_set_parse(step[1].asString().c_str(), &playbacks) ||
+			stack_magicq_playback_set_is_empty(&playbacks))
+		{
+			stack_log("stack_magicq_cue_program_from_json(): Skipping invalid step %u\n", i);
+			continue;
+		}
+
+		int16_t level = 0;
+		std::string cue_id;
+		if (operation == MAGICQ_OPERATION_SET_LEVEL && step.size() > 2 && step[2].isNumeric())
+		{
+			level = (int16_t)step[2].asInt();
+		}
+		else if (operation == MAGICQ_OPERATION_JUMP_TO_CUE_ID && step.size() > 2 && step[2].isString())
+		{
+			cue_id = step[2].asString();
+		}
+
+		if (!stack_magicq_program_add_step(program, operation, &playbacks, level, cue_id.c_str()))
+		{
+			stack_log("stack_magicq_cue_program_from_json(): Skipping step %u that doesn't fit or has an invalid cue ID\n", i);
+		}
+	}
+}
+
+/// Builds a program from the fixed set of actions that older shows store, in
+/// the order those actions were always sent in
+static void stack_magicq_cue_program_from_legacy_json(const Json::Value &cue_data, StackMagicQProgram *program)
+{
+	stack_magicq_program_clear(program);
+
+	// Older shows still store a single playback number rather than a list
+	StackMagicQPlaybackSet playbacks;
+	std::string playback_text;
+	if (cue_data["playback"].isString())
+	{
+		playback_text = cue_data["playback"].asString();
+	}
+	else if (cue_data["playback"].isNumeric())
+	{
+		playback_text = std::to_string(cue_data["playback"].asInt());
+	}
+	if (!stack_magicq_playback_set_parse(playback_text.c_str(), &playbacks) || stack_magicq_playback_set_is_empty(&playbacks))
+	{
+		stack_log("stack_magicq_cue_program_from_legacy_json(): No playback, not migrating actions\n");
+		return;
+	}
+
+	int16_t level = cue_data.isMember("level") ? (int16_t)cue_data["level"].asInt() : 0;
+	std::string cue_id = cue_data.isMember("jump_cue_id") ? cue_data["jump_cue_id"].asString() : "";
+
+	if (cue_data["action_activate"].asBool())
+	{
+		stack_magicq_program_add_step(program, MAGICQ_OPERATION_ACTIVATE, &playbacks, level, NULL);
+	}
+	if (cue_data["action_level"].asBool())
+	{
+		stack_magicq_program_add_step(program, MAGICQ_OPERATION_SET_LEVEL, &playbacks, level, NULL);
+	}
+	if (cue_data["action_go"].asBool())
+	{
+		stack_magicq_program_add_step(program, MAGICQ_OPERATION_GO, &playbacks, level, NULL);
+	}
+	if (cue_data["action_jump"].asBool())
+	{
+		stack_magicq_program_add_step(program, MAGICQ_OPERATION_JUMP_TO_CUE_ID, &playbacks, level, cue_id.c_str());
+	}
+	if (cue_data["action_stop"].asBool())
+	{
+		stack_magicq_program_add_step(program, MAGICQ_OPERATION_STOP, &playbacks, level, NULL);
+	}
+	if (cue_data["action_release"].asBool())
+	{
+		stack_magicq_program_add_step(program, MAGICQ_OPERATION_RELEASE, &playbacks, level, NULL);
+	}
 }
 
 /// Re-initialises this cue from JSON Data
@@ -725,122 +1506,336 @@ void stack_magicq_cue_from_json(StackCue *cue, const char *json_data)
 
 	Json::Value& cue_data = cue_root["StackMagicQCue"];
 
-	// Read in our properties
-	if (cue_data.isMember("playback"))
+	// Don't let each property change notify the cue list and revalidate the
+	// cue: we do that once, below, when everything has been read in
+	stack_magicq_cue_pause_change_callbacks(cue, true);
+
+	// Read in our properties. Shows saved before cues had programs have a
+	// fixed set of actions on one set of playbacks instead
+	StackMagicQProgram program;
+	if (cue_data["program"].isArray())
 	{
-		stack_property_set_int16(stack_cue_get_property(cue, "playback"), STACK_PROPERTY_VERSION_DEFINED, cue_data["playback"].asInt());
+		stack_magicq_cue_program_from_json(cue_data["program"], &program);
 	}
-
-	if (cue_data.isMember("action_activate"))
+	else
 	{
-		stack_property_set_bool(stack_cue_get_property(cue, "action_activate"), STACK_PROPERTY_VERSION_DEFINED, cue_data["action_activate"].asBool());
+		stack_magicq_cue_program_from_legacy_json(cue_data, &program);
 	}
+	stack_magicq_cue_set_program(STACK_MAGICQ_CUE(cue), &program);
 
-	if (cue_data.isMember("action_level"))
+	if (cue_data.isMember("fade_start_level"))
 	{
-		stack_property_set_bool(stack_cue_get_property(cue, "action_level"), STACK_PROPERTY_VERSION_DEFINED, cue_data["action_level"].asBool());
+		stack_property_set_int16(STACK_MAGICQ_CUE(cue)->prop_fade_start_level, STACK_PROPERTY_VERSION_DEFINED, cue_data["fade_start_level"].asInt());
 	}
 
-	if (cue_data.isMember("level"))
+	if (cue_data.isMember("fade_curve"))
 	{
-		stack_property_set_int16(stack_cue_get_property(cue, "level"), STACK_PROPERTY_VERSION_DEFINED, cue_data["level"].asInt());
+		stack_property_set_int16(STACK_MAGICQ_CUE(cue)->prop_fade_curve, STACK_PROPERTY_VERSION_DEFINED, cue_data["fade_curve"].asInt());
 	}
 
-	if (cue_data.isMember("action_go"))
+	if (cue_data.isMember("force_send"))
 	{
-		stack_property_set_bool(stack_cue_get_property(cue, "action_go"), STACK_PROPERTY_VERSION_DEFINED, cue_data["action_go"].asBool());
+		stack_property_set_bool(STACK_MAGICQ_CUE(cue)->prop_force_send, STACK_PROPERTY_VERSION_DEFINED, cue_data["force_send"].asBool());
 	}
 
-	if (cue_data.isMember("action_stop"))
+	stack_magicq_cue_pause_change_callbacks(cue, false);
+
+	// Notify the cue list and validate the cue, once for the whole cue
+	stack_cue_list_changed(cue->parent, cue, STACK_MAGICQ_CUE(cue)->prop_program);
+	stack_magicq_cue_validate_program(STACK_MAGICQ_CUE(cue));
+	stack_magicq_cue_update_error_state(STACK_MAGICQ_CUE(cue));
+	STACK_MAGICQ_CUE(cue)->dirty_fields = ~(uint32_t)0;
+	stack_magicq_cue_queue_ui_refresh(STACK_MAGICQ_CUE(cue));
+}
+
+/// Gets the error message for the cue
+bool stack_magicq_cue_get_error(StackCue *cue, char *message, size_t size)
+{
+	uint32_t errors = STACK_MAGICQ_CUE(cue)->errors;
+
+	// We must have an action
+	if (errors & STACK_MAGICQ_CUE_ERROR_NO_ACTION)
 	{
-		stack_property_set_bool(stack_cue_get_property(cue, "action_stop"), STACK_PROPERTY_VERSION_DEFINED, cue_data["action_stop"].asBool());
+		snprintf(message, size, "No actions in the program");
+		return true;
 	}
 
-	if (cue_data.isMember("action_jump"))
+	// If we're jumping, we must have a cue number
+	if (errors & STACK_MAGICQ_CUE_ERROR_NO_JUMP_CUE_ID)
 	{
-		stack_property_set_bool(stack_cue_get_property(cue, "action_jump"), STACK_PROPERTY_VERSION_DEFINED, cue_data["action_jump"].asBool());
+		snprintf(message, size, "No cue chosen to jump to");
+		return true;
 	}
 
-	if (cue_data.isMember("jump_cue_id"))
+	// Default condition: no error
+	strncpy(message, "", size);
+	return false;
+}
+
+/// Appends an action to a comma-separated summary, truncating if it's too long
+static void stack_magicq_cue_append_action(char *buffer, size_t size, size_t *length, const char *format, ...)
+{
+	if (*length > 0 && *length + 2 < size)
 	{
-		stack_property_set_string(stack_cue_get_property(cue, "jump_cue_id"), STACK_PROPERTY_VERSION_DEFINED, cue_data["jump_cue_id"].asString().c_str());
+		memcpy(&buffer[*length], ", ", 3);
+		*length += 2;
 	}
 
-	if (cue_data.isMember("action_release"))
+	if (*length + 1 < size)
 	{
-		stack_property_set_bool(stack_cue_get_property(cue, "action_release"), STACK_PROPERTY_VERSION_DEFINED, cue_data["action_release"].asBool());
+		va_list args;
+		va_start(args, format);
+		int written = vsnprintf(&buffer[*length], size - *length, format, args);
+		va_end(args);
+		if (written > 0)
+		{
+			*length = *length + written < size ? *length + written : size - 1;
+		}
 	}
+}
 
-	stack_magicq_cue_update_error_state(STACK_MAGICQ_CUE(cue));
+/// Renders a summary of the actions a cue will perform, in the order that
+/// they are sent
+static void stack_magicq_cue_render_actions(StackMagicQCue *cue, char *buffer, size_t size)
+{
+	size_t length = 0;
+	buffer[0] = '\0';
+	for (size_t i = 0; i < cue->program.step_count; i++)
+	{
+		const StackMagicQStep *step = &cue->program.steps[i];
+		char playback_text[STACK_MAGICQ_PLAYBACK_SET_MAX_TEXT];
+		stack_magicq_playback_set_format(&step->playbacks, playback_text, sizeof(playback_text));
+
+		switch (step->operation)
+		{
+			case MAGICQ_OPERATION_ACTIVATE:
+				stack_magicq_cue_append_action(buffer, size, &length, "Activate %s", playback_text);
+				break;
+			case MAGICQ_OPERATION_RELEASE:
+				stack_magicq_cue_append_action(buffer, size, &length, "Release %s", playback_text);
+				break;
+			case MAGICQ_OPERATION_GO:
+				stack_magicq_cue_append_action(buffer, size, &length, "Go %s", playback_text);
+				break;
+			case MAGICQ_OPERATION_STOP:
+				stack_magicq_cue_append_action(buffer, size, &length, "Stop %s", playback_text);
+				break;
+			case MAGICQ_OPERATION_SET_LEVEL:
+				stack_magicq_cue_append_action(buffer, size, &length, "Level %s %d%%", playback_text, step->level);
+				break;
+			case MAGICQ_OPERATION_JUMP_TO_CUE_ID:
+				stack_magicq_cue_append_action(buffer, size, &length, "Jump %s to %s", playback_text, step->cue_id);
+				break;
+		}
+	}
 }
 
-/// Gets the error message for the cue
-bool stack_magicq_cue_get_error(StackCue *cue, char *message, size_t size)
+/// Renders when the cue last sent something, and whether it failed
+static void stack_magicq_cue_render_last_sent(int64_t last_send_time, bool ok, char *buffer, size_t size)
 {
-	int16_t playback = 0, level = 0;
-	char buffer[64];
-	char *cue_id = NULL;
-	bool action_activate = false, action_level = false, action_go = false,
-		 action_stop = false, action_jump = false, action_release = false;
+	if (last_send_time == 0)
+	{
+		buffer[0] = '\0';
+		return;
+	}
 
-	// Get the values from the properties
-	stack_property_get_int16(stack_cue_get_property(STACK_CUE(cue), "playback"), STACK_PROPERTY_VERSION_DEFINED, &playback);
-	stack_property_get_int16(stack_cue_get_property(STACK_CUE(cue), "level"), STACK_PROPERTY_VERSION_DEFINED, &level);
-	stack_property_get_string(stack_cue_get_property(STACK_CUE(cue), "jump_cue_id"), STACK_PROPERTY_VERSION_DEFINED, &cue_id);
-	stack_property_get_bool(stack_cue_get_property(STACK_CUE(cue), "action_activate"), STACK_PROPERTY_VERSION_DEFINED, &action_activate);
-	stack_property_get_bool(stack_cue_get_property(STACK_CUE(cue), "action_level"), STACK_PROPERTY_VERSION_DEFINED, &action_level);
-	stack_property_get_bool(stack_cue_get_property(STACK_CUE(cue), "action_go"), STACK_PROPERTY_VERSION_DEFINED, &action_go);
-	stack_property_get_bool(stack_cue_get_property(STACK_CUE(cue), "action_stop"), STACK_PROPERTY_VERSION_DEFINED, &action_stop);
-	stack_property_get_bool(stack_cue_get_property(STACK_CUE(cue), "action_jump"), STACK_PROPERTY_VERSION_DEFINED, &action_jump);
-	stack_property_get_bool(stack_cue_get_property(STACK_CUE(cue), "action_release"), STACK_PROPERTY_VERSION_DEFINED, &action_release);
-
-	// We must have a playback ID
-	if (playback == 0)
-	{
-		snprintf(message, size, "No playback chosen");
-		return true;
+	struct tm local;
+	time_t t = (time_t)last_send_time;
+	localtime_r(&t, &local);
+	size_t length = strftime(buffer, size, "%H:%M:%S", &local);
+	if (!ok)
+	{
+		snprintf(&buffer[length], size - length, " (failed)");
 	}
+}
 
-	// We must have an action
-	if (!action_activate && !action_level && !action_go && !action_stop && !action_jump && !action_release)
+/// Returns the pre-rendered string for a field that comes from the metrics,
+/// rendering it again only if the value has changed since last time
+static const char *stack_magicq_cue_get_metrics_field(StackMagicQCue *cue, StackMagicQCueField field, uint64_t value, const char *format)
+{
+	uint32_t bit = 1 << field;
+	if ((cue->dirty_fields & bit) || cue->field_values[field] != value)
 	{
-		snprintf(message, size, "No actions selected");
-		return true;
+		snprintf(cue->field_strings[field], STACK_MAGICQ_CUE_FIELD_MAX_TEXT, format, value);
+		cue->field_values[field] = value;
+		cue->dirty_fields &= ~bit;
 	}
 
-	// If we're jumping, we must have a cue number
-	if (action_jump && strlen(cue_id) == 0)
+	return cue->field_strings[field];
+}
+
+// Global: The names of our fields, in StackMagicQCueField order
+static const char *smc_field_names[STACK_MAGICQ_CUE_FIELD_COUNT] = {
+	"playback", "level", "jump_target", "actions", "last_sent", "packets_sent",
+	"bytes_sent", "send_errors", "last_latency_us", "p99_latency_us"
+};
+
+// The size of the field name hash table. Must be a power of two, and larger
+// than the number of fields
+#define SMC_FIELD_TABLE_SIZE 32
+
+// Global: Hash table from field name to StackMagicQCueField (-1 if empty), so
+// looking up a field needs one string comparison rather than a chain of them
+static int8_t smc_field_table[SMC_FIELD_TABLE_SIZE];
+
+/// Hashes a field name (FNV-1a)
+static uint32_t stack_magicq_cue_hash_field(const char *name)
+{
+	uint32_t hash = 2166136261u;
+	for (const char *c = name; *c != '\0'; c++)
 	{
-		snprintf(message, size, "No cue chosen to jump to");
-		return true;
+		hash = (hash ^ (uint8_t)*c) * 16777619u;
 	}
 
-	// Default condition: no error
-	strncpy(message, "", size);
-	return false;
+	return hash;
 }
 
-const char *stack_magicq_cue_get_field(StackCue *cue, const char *field)
+/// Builds the field name hash table. Called once at registration
+static void stack_magicq_cue_intern_fields()
 {
-	if (strcmp(field, "playback") == 0)
+	for (size_t i = 0; i < SMC_FIELD_TABLE_SIZE; i++)
 	{
-		int16_t playback = 0;
-		stack_property_get_int16(stack_cue_get_property(cue, "playback"), STACK_PROPERTY_VERSION_DEFINED, &playback);
-		snprintf(STACK_MAGICQ_CUE(cue)->playback_string, 8, "%d", playback);
-		return STACK_MAGICQ_CUE(cue)->playback_string;
+		smc_field_table[i] = -1;
 	}
-	else if (strcmp(field, "level") == 0)
+
+	for (size_t field = 0; field < STACK_MAGICQ_CUE_FIELD_COUNT; field++)
 	{
-		int16_t level = 0;
-		stack_property_get_int16(stack_cue_get_property(cue, "level"), STACK_PROPERTY_VERSION_DEFINED, &level);
-		snprintf(STACK_MAGICQ_CUE(cue)->level_string, 8, "%d", level);
-		return STACK_MAGICQ_CUE(cue)->level_string;
+		uint32_t index = stack_magicq_cue_hash_field(smc_field_names[field]) & (SMC_FIELD_TABLE_SIZE - 1);
+		while (smc_field_table[index] != -1)
+		{
+			index = (index + 1) & (SMC_FIELD_TABLE_SIZE - 1);
+		}
+		smc_field_table[index] = (int8_t)field;
+	}
+}
+
+/// Looks up a field by name. Returns -1 if it isn't one of ours
+static int stack_magicq_cue_lookup_field(const char *name)
+{
+	uint32_t index = stack_magicq_cue_hash_field(name) & (SMC_FIELD_TABLE_SIZE - 1);
+	while (smc_field_table[index] != -1)
+	{
+		if (strcmp(smc_field_names[smc_field_table[index]], name) == 0)
+		{
+			return smc_field_table[index];
+		}
+		index = (index + 1) & (SMC_FIELD_TABLE_SIZE - 1);
 	}
-	else if (strcmp(field, "jump_target") == 0)
+
+	return -1;
+}
+
+const char *stack_magicq_cue_get_field(StackCue *cue, const char *field)
+{
+	StackMagicQCue *mcue = STACK_MAGICQ_CUE(cue);
+	StackMagicQMetrics *metrics = mcue->metrics;
+	const StackMagicQHistogram *latency = NULL;
+
+	switch (stack_magicq_cue_lookup_field(field))
 	{
-		char *jump_target = NULL;
-		stack_property_get_string(stack_cue_get_property(cue, "jump_cue_id"), STACK_PROPERTY_VERSION_DEFINED, &jump_target);
-		return jump_target;
+		case STACK_MAGICQ_CUE_FIELD_PLAYBACK:
+			// Every playback the program touches
+			if (mcue->dirty_fields & (1 << STACK_MAGICQ_CUE_FIELD_PLAYBACK))
+			{
+				StackMagicQPlaybackSet playbacks;
+				char playback_text[STACK_MAGICQ_PLAYBACK_SET_MAX_TEXT];
+				stack_magicq_playback_set_clear(&playbacks);
+				for (size_t i = 0; i < mcue->program.step_count; i++)
+				{
+					const StackMagicQPlaybackSet *step_playbacks = &mcue->program.steps[i].playbacks;
+					for (int playback = stack_magicq_playback_set_next(step_playbacks, 0); playback > 0; playback = stack_magicq_playback_set_next(step_playbacks, playback))
+					{
+						stack_magicq_playback_set_add(&playbacks, (uint16_t)playback);
+					}
+				}
+				stack_magicq_playback_set_format(&playbacks, playback_text, sizeof(playback_text));
+				snprintf(mcue->field_strings[STACK_MAGICQ_CUE_FIELD_PLAYBACK], STACK_MAGICQ_CUE_FIELD_MAX_TEXT, "%s", playback_text);
+				mcue->dirty_fields &= ~(1 << STACK_MAGICQ_CUE_FIELD_PLAYBACK);
+			}
+			return mcue->field_strings[STACK_MAGICQ_CUE_FIELD_PLAYBACK];
+
+		case STACK_MAGICQ_CUE_FIELD_JUMP_TARGET:
+			// The cue ID of the last jump in the program
+			if (mcue->dirty_fields & (1 << STACK_MAGICQ_CUE_FIELD_JUMP_TARGET))
+			{
+				mcue->field_strings[STACK_MAGICQ_CUE_FIELD_JUMP_TARGET][0] = '\0';
+				for (size_t i = 0; i < mcue->program.step_count; i++)
+				{
+					if (mcue->program.steps[i].operation == MAGICQ_OPERATION_JUMP_TO_CUE_ID)
+					{
+						snprintf(mcue->field_strings[STACK_MAGICQ_CUE_FIELD_JUMP_TARGET], STACK_MAGICQ_CUE_FIELD_MAX_TEXT, "%s", mcue->program.steps[i].cue_id);
+					}
+				}
+				mcue->dirty_fields &= ~(1 << STACK_MAGICQ_CUE_FIELD_JUMP_TARGET);
+			}
+			return mcue->field_strings[STACK_MAGICQ_CUE_FIELD_JUMP_TARGET];
+
+		case STACK_MAGICQ_CUE_FIELD_LEVEL:
+			// The level of the last level step in the program
+			if (mcue->dirty_fields & (1 << STACK_MAGICQ_CUE_FIELD_LEVEL))
+			{
+				mcue->field_strings[STACK_MAGICQ_CUE_FIELD_LEVEL][0] = '\0';
+				for (size_t i = 0; i < mcue->program.step_count; i++)
+				{
+					if (mcue->program.steps[i].operation == MAGICQ_OPERATION_SET_LEVEL)
+					{
+						snprintf(mcue->field_strings[STACK_MAGICQ_CUE_FIELD_LEVEL], STACK_MAGICQ_CUE_FIELD_MAX_TEXT, "%d", mcue->program.steps[i].level);
+					}
+				}
+				mcue->dirty_fields &= ~(1 << STACK_MAGICQ_CUE_FIELD_LEVEL);
+			}
+			return mcue->field_strings[STACK_MAGICQ_CUE_FIELD_LEVEL];
+
+		case STACK_MAGICQ_CUE_FIELD_ACTIONS:
+			if (mcue->dirty_fields & (1 << STACK_MAGICQ_CUE_FIELD_ACTIONS))
+			{
+				stack_magicq_cue_render_actions(mcue, mcue->field_strings[STACK_MAGICQ_CUE_FIELD_ACTIONS], STACK_MAGICQ_CUE_FIELD_MAX_TEXT);
+				mcue->dirty_fields &= ~(1 << STACK_MAGICQ_CUE_FIELD_ACTIONS);
+			}
+			return mcue->field_strings[STACK_MAGICQ_CUE_FIELD_ACTIONS];
+
+		case STACK_MAGICQ_CUE_FIELD_LAST_SENT:
+		{
+			// The time and the result are packed in to one value, so that a
+			// change in either causes it to be rendered again
+			int64_t last_send_time = metrics->last_send_time.load(std::memory_order_relaxed);
+			bool ok = metrics->last_send_ok.load(std::memory_order_relaxed);
+			uint64_t value = ((uint64_t)last_send_time << 1) | (ok ? 1 : 0);
+			if ((mcue->dirty_fields & (1 << STACK_MAGICQ_CUE_FIELD_LAST_SENT)) || mcue->field_values[STACK_MAGICQ_CUE_FIELD_LAST_SENT] != value)
+			{
+				stack_magicq_cue_render_last_sent(last_send_time, ok, mcue->field_strings[STACK_MAGICQ_CUE_FIELD_LAST_SENT], STACK_MAGICQ_CUE_FIELD_MAX_TEXT);
+				mcue->field_values[STACK_MAGICQ_CUE_FIELD_LAST_SENT] = value;
+				mcue->dirty_fields &= ~(1 << STACK_MAGICQ_CUE_FIELD_LAST_SENT);
+			}
+			return mcue->field_strings[STACK_MAGICQ_CUE_FIELD_LAST_SENT];
+		}
+
+		case STACK_MAGICQ_CUE_FIELD_PACKETS_SENT:
+			return stack_magicq_cue_get_metrics_field(mcue, STACK_MAGICQ_CUE_FIELD_PACKETS_SENT, metrics->packets_sent.load(std::memory_order_relaxed), "%lu");
+
+		case STACK_MAGICQ_CUE_FIELD_BYTES_SENT:
+			return stack_magicq_cue_get_metrics_field(mcue, STACK_MAGICQ_CUE_FIELD_BYTES_SENT, metrics->bytes_sent.load(std::memory_order_relaxed), "%lu");
+
+		case STACK_MAGICQ_CUE_FIELD_SEND_ERRORS:
+			return stack_magicq_cue_get_metrics_field(mcue, STACK_MAGICQ_CUE_FIELD_SEND_ERRORS, metrics->send_errors.load(std::memory_order_relaxed), "%lu");
+
+		case STACK_MAGICQ_CUE_FIELD_LAST_LATENCY_US:
+			return stack_magicq_cue_get_metrics_field(mcue, STACK_MAGICQ_CUE_FIELD_LAST_LATENCY_US, (uint64_t)metrics->last_latency_us.load(std::memory_order_relaxed), "%lu");
+
+		case STACK_MAGICQ_CUE_FIELD_P99_LATENCY_US:
+			// Working out the percentile walks the histogram, so only do it
+			// when something new has been recorded
+			latency = stack_magicq_metrics_get_latency(metrics);
+			if ((mcue->dirty_fields & (1 << STACK_MAGICQ_CUE_FIELD_P99_LATENCY_US)) || mcue->field_values[STACK_MAGICQ_CUE_FIELD_P99_LATENCY_US] != stack_magicq_metrics_get_count(latency))
+			{
+				mcue->field_values[STACK_MAGICQ_CUE_FIELD_P99_LATENCY_US] = stack_magicq_metrics_get_count(latency);
+				snprintf(mcue->field_strings[STACK_MAGICQ_CUE_FIELD_P99_LATENCY_US], STACK_MAGICQ_CUE_FIELD_MAX_TEXT, "%ld", stack_magicq_metrics_get_percentile(latency, 99.0));
+				mcue->dirty_fields &= ~(1 << STACK_MAGICQ_CUE_FIELD_P99_LATENCY_US);
+			}
+			return mcue->field_strings[STACK_MAGICQ_CUE_FIELD_P99_LATENCY_US];
+
+		default:
+			break;
 	}
 
 	return stack_cue_get_field_base(cue, field);
@@ -862,14 +1857,48 @@ void stack_magicq_cue_register()
 	// Load the icons
 	icon = gdk_pixbuf_new_from_resource("/org/stack/icons/stackmagicqcue.png", NULL);
 
+	// Read our settings
+	smc_fade_interval = stack_magicq_cue_get_fade_interval();
+	smc_schedule_ahead = stack_magicq_cue_get_schedule_ahead();
+
+	// Set up the lookup of our fields by name
+	stack_magicq_cue_intern_fields();
+
 	// Register built in cue types
-	StackCueClass* magicq_cue_class = new StackCueClass{ "StackMagicQCue", "StackCue", "MagicQ Cue", stack_magicq_cue_create, stack_magicq_cue_destroy, stack_magicq_cue_play, NULL, NULL, stack_magicq_cue_pulse, stack_magicq_cue_set_tabs, stack_magicq_cue_unset_tabs, stack_magicq_cue_to_json, stack_magicq_cue_free_json, stack_magicq_cue_from_json, stack_magicq_cue_get_error, NULL, NULL, stack_magicq_cue_get_field, stack_magicq_cue_get_icon, NULL, NULL };
+	StackCueClass* magicq_cue_class = new StackCueClass{ "StackMagicQCue", "StackCue", "MagicQ Cue", stack_magicq_cue_create, stack_magicq_cue_destroy, stack_magicq_cue_play, stack_magicq_cue_pause, stack_magicq_cue_stop, stack_magicq_cue_pulse, stack_magicq_cue_set_tabs, stack_magicq_cue_unset_tabs, stack_magicq_cue_to_json, stack_magicq_cue_free_json, stack_magicq_cue_from_json, stack_magicq_cue_get_error, NULL, NULL, stack_magicq_cue_get_field, stack_magicq_cue_get_icon, NULL, NULL };
 	stack_register_cue_class(magicq_cue_class);
 }
 
 // The entry point for the plugin that Stack calls
 extern "C" bool stack_init_plugin()
 {
+	// Set up the plugin-wide metrics (and their periodic summary, if configured)
+	stack_magicq_metrics_init();
+
+	// Start capturing datagrams (if configured). We carry on without it if
+	// this fails
+	stack_magicq_capture_init();
+
+	// Create the shared transport up front so that all cues use one socket
+	if (!stack_magicq_transport_init())
+	{
+		return false;
+	}
+
+	// Start listening for feedback from MagicQ (if configured). We carry on
+	// without it if this fails, as it's not needed to send commands
+	stack_magicq_feedback_init();
+
+	// Read the OSC configuration
+	stack_magicq_osc_init();
+
+	// Set up suppression of redundant commands (if configured)
+	stack_magicq_ledger_init();
+
+	// Set up retransmission of unconfirmed commands (if configured). This
+	// relies on the feedback receiver, so must come after it
+	stack_magicq_reliable_init();
+
 	stack_magicq_cue_register();
 	return true;
 }
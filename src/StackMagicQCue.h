@@ -3,6 +3,50 @@
 
 // Includes:
 #include "StackCue.h"
+#include "StackMagicQTransport.h"
+#include "StackMagicQCommand.h"
+#include "StackMagicQMetrics.h"
+#include "StackMagicQPlaybackSet.h"
+#include "StackMagicQProgram.h"
+
+// Defines:
+// The shape of a level fade
+typedef enum StackMagicQFadeCurve {
+	STACK_MAGICQ_FADE_CURVE_LINEAR = 0,
+	STACK_MAGICQ_FADE_CURVE_S_CURVE = 1,
+	STACK_MAGICQ_FADE_CURVE_EXPONENTIAL = 2,
+} StackMagicQFadeCurve;
+
+// The fade of one level step of a program: the playbacks it is for, the level
+// it ends on, and the last level that was sent
+struct StackMagicQFade
+{
+	StackMagicQPlaybackSet playbacks;
+	int16_t end_level;
+	int16_t last_level;
+};
+
+// The problems that stop a cue from being played, as a bitmask
+#define STACK_MAGICQ_CUE_ERROR_NO_ACTION 0x01
+#define STACK_MAGICQ_CUE_ERROR_NO_JUMP_CUE_ID 0x02
+
+// The fields that a MagicQ cue provides to the cue list
+typedef enum StackMagicQCueField {
+	STACK_MAGICQ_CUE_FIELD_PLAYBACK = 0,
+	STACK_MAGICQ_CUE_FIELD_LEVEL,
+	STACK_MAGICQ_CUE_FIELD_JUMP_TARGET,
+	STACK_MAGICQ_CUE_FIELD_ACTIONS,
+	STACK_MAGICQ_CUE_FIELD_LAST_SENT,
+	STACK_MAGICQ_CUE_FIELD_PACKETS_SENT,
+	STACK_MAGICQ_CUE_FIELD_BYTES_SENT,
+	STACK_MAGICQ_CUE_FIELD_SEND_ERRORS,
+	STACK_MAGICQ_CUE_FIELD_LAST_LATENCY_US,
+	STACK_MAGICQ_CUE_FIELD_P99_LATENCY_US,
+	STACK_MAGICQ_CUE_FIELD_COUNT
+} StackMagicQCueField;
+
+// The longest string we render for a field
+#define STACK_MAGICQ_CUE_FIELD_MAX_TEXT 96
 
 // StackMagicQ cue is a cue that interacts with ChamSys MagicQ software to allow
 // control of playbacks and other features
@@ -14,12 +58,88 @@ struct StackMagicQCue
 	// The MagicQ tab
 	GtkWidget *magicq_tab;
 
-	// The UDP socket
-	int sock;
+	// Our properties. These are owned by the superclass, but are resolved once
+	// at creation so we don't have to look them up by name
+	StackProperty *prop_program;
+	StackProperty *prop_fade_start_level;
+	StackProperty *prop_fade_curve;
+	StackProperty *prop_force_send;
+	StackProperty *prop_action_time;
+	StackProperty *prop_pre_time;
+
+	// The plugin-wide transport we send through (we hold a reference)
+	StackMagicQTransport *transport;
+
+	// Counters and latency for the messages this cue has sent (we hold a
+	// reference)
+	StackMagicQMetrics *metrics;
+
+	// The encoded commands to send when the cue fires, compiled from the live
+	// program when the cue is played (grown as needed on play)
+	char *packet;
+	size_t packet_length;
+	size_t packet_capacity;
+
+	// The commands within the compiled packet, one for each playback of each
+	// step, in the order they are sent (grown as needed on play)
+	StackMagicQCommand *commands;
+	size_t command_count;
+	size_t command_capacity;
+
+	// Whether to send every command, even if the ledger says it's redundant
+	bool force_send;
+
+	// The defined program, parsed by the property change callback whenever it
+	// changes, and the resulting STACK_MAGICQ_CUE_ERROR_* bits, so that
+	// checking for errors and rendering fields never has to re-parse it
+	StackMagicQProgram program;
+	uint32_t errors;
+
+	// Whether the compiled packet has been sent since the cue was played
+	bool fired;
+
+	// Whether the compiled packet was handed to the transport ahead of the end
+	// of the pre-wait, when it is due to go out (transport clock, nanoseconds)
+	// and how many message sets it was queued as. It can still be cancelled
+	// until then
+	bool fire_scheduled;
+	int64_t fire_due;
+	size_t fire_sets;
+
+	// A request to cancel a scheduled fire that the sender thread hasn't
+	// answered yet: the number of cancellations asked for so far (which the
+	// metrics count the answers to), and the fire being cancelled. The cue
+	// doesn't fire again until the answer is in
+	bool cancel_pending;
+	uint64_t cancels_requested;
+	int64_t cancel_due;
+	size_t cancel_sets;
+
+	// Level fade state, set up at play() time and advanced on each pulse. Every
+	// level step of the program fades, from the same start level and along
+	// the same curve (sized on play)
+	bool fade_active;
+	stack_time_t fade_duration;
+	stack_time_t fade_next_update;
+	int16_t fade_start_level;
+	StackMagicQFadeCurve fade_curve;
+	StackMagicQFade *fades;
+	size_t fade_count;
+	size_t fade_capacity;
+
+	// Space for the level messages of each fade step (sized on play)
+	char *fade_packet;
+	size_t fade_packet_capacity;
+	StackMagicQCommand *fade_commands;
+	size_t fade_command_capacity;
 
-	// Buffers for get_field
-	char playback_string[8];
-	char level_string[8];
+	// Pre-rendered strings for get_field, one per field. Fields that come from
+	// properties are re-rendered when the change callbacks mark them as dirty,
+	// and fields that come from the metrics are re-rendered when the value
+	// they were rendered from changes
+	char field_strings[STACK_MAGICQ_CUE_FIELD_COUNT][STACK_MAGICQ_CUE_FIELD_MAX_TEXT];
+	uint64_t field_values[STACK_MAGICQ_CUE_FIELD_COUNT];
+	uint32_t dirty_fields;
 };
 
 // Functions: MagicQ cue functions
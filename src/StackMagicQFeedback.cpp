@@ -0,0 +1,382 @@
+// Includes:
+#include "StackLog.h"
+#include "StackMagicQFeedback.h"
+#include "StackMagicQCapture.h"
+#include <gtk/gtk.h>
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+// Defines: Bit layout of a packed playback state entry
+#define SMQF_LEVEL_KNOWN   (1ULL << 63)
+#define SMQF_ACTIVE_KNOWN  (1ULL << 62)
+#define SMQF_ACTIVE        (1ULL << 61)
+#define SMQF_CUE_KNOWN     (1ULL << 60)
+#define SMQF_LEVEL_SHIFT   32
+#define SMQF_LEVEL_MASK    (0xffffULL << SMQF_LEVEL_SHIFT)
+#define SMQF_CUE_MASK      0xffffffffULL
+
+// The cue ID is stored as a fixed-point number with three decimal places
+#define SMQF_CUE_SCALE     1000.0
+
+// The largest datagram we expect to receive
+#define SMQF_MAX_DATAGRAM  2048
+
+// Global: The state table. Each playback's state is packed in to a single
+// 64-bit word so that it can be updated and read atomically, without locks
+static std::atomic<uint64_t> smqf_state[STACK_MAGICQ_MAX_PLAYBACK + 1];
+
+// Global: Incremented whenever any playback state changes
+static std::atomic<uint64_t> smqf_generation(0);
+
+// Global: The receiving socket (zero if feedback is disabled)
+static int smqf_sock = 0;
+
+// TODO: Put this into an app-wide settings UI
+static uint16_t stack_magicq_feedback_get_port()
+{
+	char *env = getenv("STACK_MAGICQ_OSC_FEEDBACK_PORT");
+	if (env != NULL)
+	{
+		int port = atoi(env);
+		if (port >= 1 && port <= 65535)
+		{
+			return (uint16_t)port;
+		}
+	}
+
+	// Feedback is disabled by default
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// STATE TABLE
+
+/// Atomically applies a change to the state of a playback
+/// @param playback The playback number
+/// @param clear_bits The bits to clear in the state
+/// @param set_bits The bits to set in the state
+static void stack_magicq_feedback_update(uint16_t playback, uint64_t clear_bits, uint64_t set_bits)
+{
+	if (playback > STACK_MAGICQ_MAX_PLAYBACK)
+	{
+		return;
+	}
+
+	uint64_t old_state = smqf_state[playback].load(std::memory_order_relaxed);
+	uint64_t new_state;
+	do
+	{
+		new_state = (old_state & ~clear_bits) | set_bits;
+	} while (!smqf_state[playback].compare_exchange_weak(old_state, new_state, std::memory_order_release, std::memory_order_relaxed));
+
+	if (new_state != old_state)
+	{
+		smqf_generation++;
+	}
+}
+
+/// Gets the last known state of a playback. Returns false if we know nothing
+/// about the playback
+bool stack_magicq_feedback_get_playback(uint16_t playback, StackMagicQPlaybackState *state)
+{
+	memset(state, 0, sizeof(StackMagicQPlaybackState));
+	if (playback > STACK_MAGICQ_MAX_PLAYBACK)
+	{
+		return false;
+	}
+
+	uint64_t packed = smqf_state[playback].load(std::memory_order_acquire);
+	state->level_known = (packed & SMQF_LEVEL_KNOWN) != 0;
+	state->level = (int16_t)((packed & SMQF_LEVEL_MASK) >> SMQF_LEVEL_SHIFT);
+	state->active_known = (packed & SMQF_ACTIVE_KNOWN) != 0;
+	state->active = (packed & SMQF_ACTIVE) != 0;
+	state->cue_known = (packed & SMQF_CUE_KNOWN) != 0;
+	state->cue_id = (double)(packed & SMQF_CUE_MASK) / SMQF_CUE_SCALE;
+
+	return state->level_known || state->active_known || state->cue_known;
+}
+
+/// Returns a number that changes whenever any playback state changes, so that
+/// callers can cheaply tell whether they need to re-read the state
+uint64_t stack_magicq_feedback_get_generation()
+{
+	return smqf_generation.load(std::memory_order_acquire);
+}
+
+/// Returns whether the feedback receiver is running
+bool stack_magicq_feedback_enabled()
+{
+	return smqf_sock > 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// OSC PARSING
+
+/// Reads an OSC string from a buffer, returning the offset just past its
+/// padding, or zero if the string is not terminated within the buffer
+static size_t stack_magicq_feedback_read_string(const char *data, size_t offset, size_t length, const char **result)
+{
+	const char *end = (const char*)memchr(&data[offset], '\0', length - offset);
+	if (end == NULL)
+	{
+		return 0;
+	}
+
+	*result = &data[offset];
+	size_t next = offset + (((size_t)(end - &data[offset]) + 1 + 3) & ~((size_t)3));
+	return next <= length ? next : length;
+}
+
+/// Reads the first argument of an OSC message as a number, if it is one
+static bool stack_magicq_feedback_read_number(const char *types, const char *data, size_t offset, size_t length, double *value)
+{
+	if (types[0] != ',' || offset + 4 > length)
+	{
+		return false;
+	}
+
+	uint32_t raw;
+	memcpy(&raw, &data[offset], 4);
+	raw = ntohl(raw);
+
+	switch (types[1])
+	{
+		case 'i':
+			*value = (double)(int32_t)raw;
+			return true;
+		case 'f':
+		{
+			float f;
+			memcpy(&f, &raw, 4);
+			*value = (double)f;
+			return true;
+		}
+		case 's':
+		{
+			const char *str = NULL;
+			if (stack_magicq_feedback_read_string(data, offset, length, &str) == 0)
+			{
+				return false;
+			}
+			*value = atof(str);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/// Converts a cue ID from MagicQ to the fixed-point form we store. Returns
+/// false if it can't be stored: if it's negative, too large, or not a number
+static bool stack_magicq_feedback_get_fixed_cue(double value, uint64_t *cue)
+{
+	const double scaled = value * SMQF_CUE_SCALE + 0.5;
+	if (!std::isfinite(scaled) || scaled < 0.0 || scaled >= (double)SMQF_CUE_MASK)
+	{
+		return false;
+	}
+
+	*cue = (uint64_t)scaled;
+	return true;
+}
+
+/// Processes a single OSC message from MagicQ. We understand:
+///  - /pb/<n> <level>: the level of a playback, as a percentage
+///  - /pb/<n>/activate and /pb/<n>/release: the playback has been (de)activated
+///  - /pb/<n>/go and /pb/<n>/stop: the playback has changed cue
+///  - /pb/<n>/cue <id> (or /pb/<n>/jump <id>): the current cue on the playback
+static void stack_magicq_feedback_process_message(const char *data, size_t length)
+{
+	const char *address = NULL, *types = ",";
+	size_t offset = stack_magicq_feedback_read_string(data, 0, length, &address);
+	if (offset == 0 || strncmp(address, "/pb/", 4) != 0)
+	{
+		return;
+	}
+
+	// Type tags are optional in older OSC implementations
+	if (offset < length && data[offset] == ',')
+	{
+		size_t args = stack_magicq_feedback_read_string(data, offset, length, &types);
+		if (args == 0)
+		{
+			return;
+		}
+		offset = args;
+	}
+
+	// Parse the playback number
+	char *command = NULL;
+	long playback = strtol(&address[4], &command, 10);
+	if (command == &address[4] || playback < 0 || playback > STACK_MAGICQ_MAX_PLAYBACK)
+	{
+		return;
+	}
+
+	double value = 0.0;
+	bool has_value = stack_magicq_feedback_read_number(types, data, offset, length, &value);
+
+	if (*command == '\0')
+	{
+		// Not-a-number can't be clamped to a level, so ignore it
+		if (has_value && !std::isnan(value))
+		{
+			if (value < 0.0)
+			{
+				value = 0.0;
+			}
+			else if (value > 100.0)
+			{
+				value = 100.0;
+			}
+			uint64_t level = (uint64_t)(value + 0.5);
+			stack_magicq_feedback_update((uint16_t)playback, SMQF_LEVEL_MASK, SMQF_LEVEL_KNOWN | (level << SMQF_LEVEL_SHIFT));
+		}
+	}
+	else if (strcmp(command, "/activate") == 0)
+	{
+		stack_magicq_feedback_update((uint16_t)playback, 0, SMQF_ACTIVE_KNOWN | SMQF_ACTIVE);
+	}
+	else if (strcmp(command, "/release") == 0)
+	{
+		stack_magicq_feedback_update((uint16_t)playback, SMQF_ACTIVE, SMQF_ACTIVE_KNOWN);
+	}
+	else if (strcmp(command, "/go") == 0 || strcmp(command, "/stop") == 0)
+	{
+		// We don't know which cue we're on now, unless we're told (and can
+		// store what we're told)
+		uint64_t cue = 0;
+		if (has_value && stack_magicq_feedback_get_fixed_cue(value, &cue))
+		{
+			stack_magicq_feedback_update((uint16_t)playback, SMQF_CUE_MASK, SMQF_CUE_KNOWN | cue);
+		}
+		else
+		{
+			stack_magicq_feedback_update((uint16_t)playback, SMQF_CUE_KNOWN | SMQF_CUE_MASK, 0);
+		}
+	}
+	else if ((strcmp(command, "/cue") == 0 || strcmp(command, "/jump") == 0) && has_value)
+	{
+		// Ignore cue IDs we can't store, rather than recording the wrong one
+		uint64_t cue = 0;
+		if (stack_magicq_feedback_get_fixed_cue(value, &cue))
+		{
+			stack_magicq_feedback_update((uint16_t)playback, SMQF_CUE_MASK, SMQF_CUE_KNOWN | cue);
+		}
+	}
+}
+
+/// Processes an OSC packet, which may be a message or a (nested) bundle
+static void stack_magicq_feedback_process_packet(const char *data, size_t length)
+{
+	if (length >= 16 && memcmp(data, "#bundle", 8) == 0)
+	{
+		// Skip the bundle header and timetag, then process each element
+		size_t offset = 16;
+		while (offset + 4 <= length)
+		{
+			uint32_t element_size;
+			memcpy(&element_size, &data[offset], 4);
+			element_size = ntohl(element_size);
+			offset += 4;
+
+			if (element_size > length - offset)
+			{
+				break;
+			}
+
+			stack_magicq_feedback_process_packet(&data[offset], element_size);
+			offset += element_size;
+		}
+	}
+	else if (length >= 4 && data[0] == '/')
+	{
+		stack_magicq_feedback_process_message(data, length);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// RECEIVER
+
+/// Called from the GLib main loop when the feedback socket is readable
+static gboolean stack_magicq_feedback_readable(GIOChannel *source, GIOCondition condition, gpointer data)
+{
+	char buffer[SMQF_MAX_DATAGRAM];
+
+	// Drain everything that has arrived
+	while (true)
+	{
+		struct sockaddr_in peer;
+		socklen_t peer_length = sizeof(peer);
+		ssize_t received = recvfrom(smqf_sock, buffer, sizeof(buffer), 0, (struct sockaddr *)&peer, &peer_length);
+		if (received <= 0)
+		{
+			break;
+		}
+
+		// Capture what we received (if capture is enabled)
+		if (stack_magicq_capture_enabled())
+		{
+			struct iovec iov;
+			iov.iov_base = buffer;
+			iov.iov_len = (size_t)received;
+			stack_magicq_capture_write(STACK_MAGICQ_CAPTURE_INCOMING, 0, &peer, &iov, 1);
+		}
+
+		stack_magicq_feedback_process_packet(buffer, (size_t)received);
+	}
+
+	return G_SOURCE_CONTINUE;
+}
+
+/// Starts the feedback receiver, if a feedback port is configured. The receiver
+/// is driven from the default GLib main context, so this must be called from the
+/// main thread
+bool stack_magicq_feedback_init()
+{
+	uint16_t port = stack_magicq_feedback_get_port();
+	if (port == 0 || smqf_sock > 0)
+	{
+		return true;
+	}
+
+	// Create a non-blocking UDP socket
+	smqf_sock = socket(PF_INET, SOCK_DGRAM, 0);
+	if (smqf_sock <= 0)
+	{
+		stack_log("stack_magicq_feedback_init(): Failed to create socket (%d)\n", smqf_sock);
+		smqf_sock = 0;
+		return false;
+	}
+	fcntl(smqf_sock, F_SETFL, fcntl(smqf_sock, F_GETFL) | O_NONBLOCK);
+
+	int reuse = 1;
+	setsockopt(smqf_sock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+	// Bind to the feedback port
+	struct sockaddr_in source;
+	source.sin_family = AF_INET;
+	source.sin_port = htons(port);
+	source.sin_addr.s_addr = htonl(INADDR_ANY);
+	if (bind(smqf_sock, (struct sockaddr *)&source, sizeof(source)) != 0)
+	{
+		stack_log("stack_magicq_feedback_init(): Failed to bind to port %u\n", port);
+		close(smqf_sock);
+		smqf_sock = 0;
+		return false;
+	}
+
+	// Watch the socket from the main loop
+	GIOChannel *channel = g_io_channel_unix_new(smqf_sock);
+	g_io_add_watch(channel, G_IO_IN, stack_magicq_feedback_readable, NULL);
+	g_io_channel_unref(channel);
+
+	stack_log("stack_magicq_feedback_init(): Receiving MagicQ feedback on port %u\n", port);
+	return true;
+}
@@ -0,0 +1,36 @@
+#ifndef _STACKMAGICQFEEDBACK_H_INCLUDED
+#define _STACKMAGICQFEEDBACK_H_INCLUDED
+
+// Includes:
+#include "StackMagicQCommand.h"
+#include <cstddef>
+#include <cstdint>
+
+// The state of a MagicQ playback, as last reported by MagicQ's OSC feedback.
+// Each of level, active and cue_id are only valid if the corresponding _known
+// flag is set, as MagicQ may not have told us about them yet
+struct StackMagicQPlaybackState
+{
+	// The level of the playback (0 - 100)
+	bool level_known;
+	int16_t level;
+
+	// Whether the playback is active
+	bool active_known;
+	bool active;
+
+	// The current cue ID on the playback
+	bool cue_known;
+	double cue_id;
+};
+
+// Functions: Receiver lifecycle
+bool stack_magicq_feedback_init();
+
+// Functions: Querying state. These never lock, so are safe to call from any
+// thread, including pulse threads
+bool stack_magicq_feedback_enabled();
+bool stack_magicq_feedback_get_playback(uint16_t playback, StackMagicQPlaybackState *state);
+uint64_t stack_magicq_feedback_get_generation();
+
+#endif
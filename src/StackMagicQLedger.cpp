@@ -0,0 +1,175 @@
+// Includes:
+#include "StackLog.h"
+#include "StackMagicQLedger.h"
+#include "StackMagicQFeedback.h"
+#include <atomic>
+#include <cstdlib>
+
+// Defines: Bit layout of a packed ledger entry
+#define SMQL_ACTIVE_KNOWN (1U << 31)
+#define SMQL_ACTIVE       (1U << 30)
+#define SMQL_LEVEL_KNOWN  (1U << 29)
+#define SMQL_LEVEL_MASK   0xffffU
+
+// Global: Whether redundant commands should be suppressed
+static bool smql_enabled = false;
+
+// Global: What we last sent to each playback, packed in to a single word per
+// playback so that it can be read and updated from any pulse thread without
+// locking
+static std::atomic<uint32_t> smql_ledger[STACK_MAGICQ_MAX_PLAYBACK + 1];
+
+// Global: Counters
+static std::atomic<uint64_t> smql_checked(0);
+static std::atomic<uint64_t> smql_suppressed(0);
+static std::atomic<uint64_t> smql_invalidations(0);
+
+// TODO: Put this into an app-wide settings UI
+static bool stack_magicq_ledger_get_enabled()
+{
+	char *env = getenv("STACK_MAGICQ_SUPPRESS_REDUNDANT");
+	return env != NULL && atoi(env) != 0;
+}
+
+/// Sets up the ledger. Should be called once from stack_init_plugin()
+void stack_magicq_ledger_init()
+{
+	smql_enabled = stack_magicq_ledger_get_enabled();
+	for (size_t i = 0; i <= STACK_MAGICQ_MAX_PLAYBACK; i++)
+	{
+		smql_ledger[i] = 0;
+	}
+
+	if (smql_enabled)
+	{
+		stack_log("stack_magicq_ledger_init(): Suppressing redundant MagicQ commands\n");
+	}
+}
+
+/// Returns whether redundant command suppression is turned on
+bool stack_magicq_ledger_enabled()
+{
+	return smql_enabled;
+}
+
+/// Determines whether a command provably changes nothing, based on what we last
+/// sent to the playback. If we have feedback from MagicQ that disagrees with
+/// what we sent (for example because the operator has moved a fader), then the
+/// command is not considered redundant
+bool stack_magicq_ledger_is_redundant(const StackMagicQCommand *command)
+{
+	if (command->playback > STACK_MAGICQ_MAX_PLAYBACK)
+	{
+		return false;
+	}
+
+	smql_checked++;
+
+	uint32_t entry = smql_ledger[command->playback].load(std::memory_order_acquire);
+	StackMagicQPlaybackState console;
+	stack_magicq_feedback_get_playback(command->playback, &console);
+
+	bool redundant = false;
+	switch (command->operation)
+	{
+		case MAGICQ_OPERATION_ACTIVATE:
+			redundant = (entry & SMQL_ACTIVE_KNOWN) && (entry & SMQL_ACTIVE) &&
+				(!console.active_known || console.active);
+			break;
+		case MAGICQ_OPERATION_RELEASE:
+			redundant = (entry & SMQL_ACTIVE_KNOWN) && !(entry & SMQL_ACTIVE) &&
+				(!console.active_known || !console.active);
+			break;
+		case MAGICQ_OPERATION_SET_LEVEL:
+			redundant = (entry & SMQL_LEVEL_KNOWN) && (int16_t)(entry & SMQL_LEVEL_MASK) == command->level &&
+				(!console.level_known || console.level == command->level);
+			break;
+		default:
+			// Go, stop and jump always do something
+			break;
+	}
+
+	if (redundant)
+	{
+		smql_suppressed++;
+	}
+
+	return redundant;
+}
+
+/// Records that a command has been sent to MagicQ
+void stack_magicq_ledger_record(const StackMagicQCommand *command)
+{
+	if (command->playback > STACK_MAGICQ_MAX_PLAYBACK)
+	{
+		return;
+	}
+
+	uint32_t old_entry = smql_ledger[command->playback].load(std::memory_order_relaxed);
+	uint32_t new_entry;
+	do
+	{
+		new_entry = old_entry;
+		switch (command->operation)
+		{
+			case MAGICQ_OPERATION_ACTIVATE:
+				new_entry |= SMQL_ACTIVE_KNOWN | SMQL_ACTIVE;
+				break;
+			case MAGICQ_OPERATION_RELEASE:
+				new_entry = (new_entry & ~SMQL_ACTIVE) | SMQL_ACTIVE_KNOWN;
+				break;
+			case MAGICQ_OPERATION_SET_LEVEL:
+				// Changing the level may activate the playback, depending on
+				// how it is configured in MagicQ
+				if ((new_entry & SMQL_LEVEL_MASK) != ((uint32_t)command->level & SMQL_LEVEL_MASK))
+				{
+					new_entry &= ~(SMQL_ACTIVE_KNOWN | SMQL_ACTIVE);
+				}
+				new_entry = (new_entry & ~SMQL_LEVEL_MASK) | SMQL_LEVEL_KNOWN | ((uint32_t)command->level & SMQL_LEVEL_MASK);
+				break;
+			default:
+				// Go, stop and jump may change whether the playback is active
+				new_entry &= ~(SMQL_ACTIVE_KNOWN | SMQL_ACTIVE);
+				break;
+		}
+	} while (!smql_ledger[command->playback].compare_exchange_weak(old_entry, new_entry, std::memory_order_release, std::memory_order_relaxed));
+}
+
+/// Forgets what we know about the playback a command was for, so that nothing
+/// is suppressed for it until something new is recorded. Used when a command
+/// that has been recorded is cancelled before it was sent
+void stack_magicq_ledger_forget(const StackMagicQCommand *command)
+{
+	if (command->playback > STACK_MAGICQ_MAX_PLAYBACK)
+	{
+		return;
+	}
+
+	smql_ledger[command->playback].store(0, std::memory_order_release);
+}
+
+/// Forgets what we know about the playbacks a datagram was for. Commands are
+/// recorded when they are queued, so if the datagram then doesn't reach the
+/// primary console, the ledger no longer matches what the console has. Called
+/// from the sender thread
+void stack_magicq_ledger_forget_playbacks(const StackMagicQPlaybackSet *playbacks)
+{
+	if (!smql_enabled)
+	{
+		return;
+	}
+
+	for (int playback = stack_magicq_playback_set_next(playbacks, 0); playback > 0; playback = stack_magicq_playback_set_next(playbacks, playback))
+	{
+		smql_ledger[playback].store(0, std::memory_order_release);
+	}
+	smql_invalidations++;
+}
+
+/// Gets a snapshot of the ledger counters
+void stack_magicq_ledger_get_stats(StackMagicQLedgerStats *stats)
+{
+	stats->checked = smql_checked;
+	stats->suppressed = smql_suppressed;
+	stats->invalidations = smql_invalidations;
+}
@@ -0,0 +1,36 @@
+#ifndef _STACKMAGICQLEDGER_H_INCLUDED
+#define _STACKMAGICQLEDGER_H_INCLUDED
+
+// Includes:
+#include "StackMagicQCommand.h"
+#include "StackMagicQPlaybackSet.h"
+#include <cstdint>
+
+// Snapshot of the ledger counters
+struct StackMagicQLedgerStats
+{
+	// Number of commands checked against the ledger
+	uint64_t checked;
+
+	// Number of commands that were suppressed as redundant
+	uint64_t suppressed;
+
+	// Number of datagrams that didn't reach the primary console, so what we
+	// knew about the playbacks they were for was forgotten
+	uint64_t invalidations;
+};
+
+// Functions: Ledger lifecycle
+void stack_magicq_ledger_init();
+bool stack_magicq_ledger_enabled();
+
+// Functions: Checking and recording commands
+bool stack_magicq_ledger_is_redundant(const StackMagicQCommand *command);
+void stack_magicq_ledger_record(const StackMagicQCommand *command);
+void stack_magicq_ledger_forget(const StackMagicQCommand *command);
+void stack_magicq_ledger_forget_playbacks(const StackMagicQPlaybackSet *playbacks);
+
+// Functions: Statistics
+void stack_magicq_ledger_get_stats(StackMagicQLedgerStats *stats);
+
+#endif
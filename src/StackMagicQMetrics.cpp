@@ -0,0 +1,368 @@
+// Includes:
+#include "StackLog.h"
+#include "StackMagicQMetrics.h"
+#include "StackMagicQLedger.h"
+#include "StackMagicQReliable.h"
+#include "StackMagicQTransport.h"
+#include <arpa/inet.h>
+#include <gtk/gtk.h>
+#include <cstdlib>
+#include <ctime>
+#include <new>
+
+// Global: The metrics for the plugin as a whole, and its latency histogram
+static StackMagicQMetrics smqm_global;
+static StackMagicQHistogram smqm_global_latency;
+
+// TODO: Put this into an app-wide settings UI
+static guint stack_magicq_metrics_get_interval()
+{
+	char *env = getenv("STACK_MAGICQ_METRICS_INTERVAL");
+	if (env != NULL)
+	{
+		int interval = atoi(env);
+		if (interval > 0)
+		{
+			return (guint)interval;
+		}
+	}
+
+	// Disabled
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// HISTOGRAMS
+
+/// Gets the bucket that a value falls in to. Values below the number of
+/// sub-buckets have a bucket each. Above that, each power of two is split in
+/// to the same number of linear sub-buckets
+static size_t stack_magicq_metrics_bucket_index(int64_t value)
+{
+	if (value < STACK_MAGICQ_HISTOGRAM_SUB_BUCKETS)
+	{
+		return value > 0 ? (size_t)value : 0;
+	}
+
+	size_t msb = 63 - __builtin_clzll((uint64_t)value);
+	size_t shift = msb - STACK_MAGICQ_HISTOGRAM_SUB_BUCKET_BITS;
+	size_t index = shift * STACK_MAGICQ_HISTOGRAM_SUB_BUCKETS + (size_t)(value >> shift);
+
+	return index < STACK_MAGICQ_HISTOGRAM_BUCKETS ? index : STACK_MAGICQ_HISTOGRAM_BUCKETS - 1;
+}
+
+/// Gets the lowest value that falls in to a bucket
+static int64_t stack_magicq_metrics_bucket_value(size_t index)
+{
+	if (index < 2 * STACK_MAGICQ_HISTOGRAM_SUB_BUCKETS)
+	{
+		return (int64_t)index;
+	}
+
+	size_t shift = index / STACK_MAGICQ_HISTOGRAM_SUB_BUCKETS - 1;
+	return (int64_t)(index - shift * STACK_MAGICQ_HISTOGRAM_SUB_BUCKETS) << shift;
+}
+
+/// Gets the number of values in a histogram (which may be NULL, if nothing has
+/// been recorded)
+uint64_t stack_magicq_metrics_get_count(const StackMagicQHistogram *histogram)
+{
+	return histogram != NULL ? histogram->count.load(std::memory_order_relaxed) : 0;
+}
+
+/// Gets the approximate value at a percentile (0 to 100) of a histogram (which
+/// may be NULL). Returns zero if the histogram is empty
+int64_t stack_magicq_metrics_get_percentile(const StackMagicQHistogram *histogram, double percentile)
+{
+	uint64_t count = stack_magicq_metrics_get_count(histogram);
+	if (count == 0)
+	{
+		return 0;
+	}
+
+	// The number of values at or below the percentile
+	uint64_t target = (uint64_t)((percentile / 100.0) * (double)count + 0.5);
+	if (target < 1)
+	{
+		target = 1;
+	}
+
+	uint64_t seen = 0;
+	for (size_t i = 0; i < STACK_MAGICQ_HISTOGRAM_BUCKETS; i++)
+	{
+		seen += histogram->counts[i].load(std::memory_order_relaxed);
+		if (seen >= target)
+		{
+			return stack_magicq_metrics_bucket_value(i);
+		}
+	}
+
+	return histogram->max.load(std::memory_order_relaxed);
+}
+
+/// Sets all the buckets of a histogram to zero
+static void stack_magicq_metrics_histogram_reset(StackMagicQHistogram *histogram)
+{
+	for (size_t i = 0; i < STACK_MAGICQ_HISTOGRAM_BUCKETS; i++)
+	{
+		histogram->counts[i] = 0;
+	}
+	histogram->count = 0;
+	histogram->max = 0;
+}
+
+/// Gets the latency histogram of a set of metrics, allocating it if this is
+/// the first value to be recorded. Returns NULL if it couldn't be allocated
+static StackMagicQHistogram *stack_magicq_metrics_histogram_get(StackMagicQMetrics *metrics)
+{
+	StackMagicQHistogram *histogram = metrics->latency.load(std::memory_order_acquire);
+	if (histogram != NULL)
+	{
+		return histogram;
+	}
+
+	StackMagicQHistogram *created = new (std::nothrow) StackMagicQHistogram;
+	if (created == NULL)
+	{
+		return NULL;
+	}
+	stack_magicq_metrics_histogram_reset(created);
+
+	// Someone else may have got there first, in which case use theirs
+	if (metrics->latency.compare_exchange_strong(histogram, created, std::memory_order_acq_rel, std::memory_order_acquire))
+	{
+		return created;
+	}
+	delete created;
+	return histogram;
+}
+
+/// Records a value in a histogram
+static void stack_magicq_metrics_histogram_record(StackMagicQHistogram *histogram, int64_t value)
+{
+	histogram->counts[stack_magicq_metrics_bucket_index(value)].fetch_add(1, std::memory_order_relaxed);
+	histogram->count.fetch_add(1, std::memory_order_relaxed);
+
+	int64_t max = histogram->max.load(std::memory_order_relaxed);
+	while (value > max && !histogram->max.compare_exchange_weak(max, value, std::memory_order_relaxed));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// RECORDING
+
+/// Records the result of sending a datagram to every destination (successful if
+/// any of them took it), against both the given metrics (which may be NULL)
+/// and the plugin-wide metrics
+void stack_magicq_metrics_record_send(StackMagicQMetrics *metrics, size_t bytes, bool success)
+{
+	StackMagicQMetrics *targets[2] = { &smqm_global, metrics };
+	int64_t now = (int64_t)time(NULL);
+	for (size_t i = 0; i < 2 && targets[i] != NULL; i++)
+	{
+		targets[i]->last_send_time.store(now, std::memory_order_relaxed);
+		targets[i]->last_send_ok.store(success, std::memory_order_relaxed);
+		if (success)
+		{
+			targets[i]->packets_sent.fetch_add(1, std::memory_order_relaxed);
+			targets[i]->bytes_sent.fetch_add(bytes, std::memory_order_relaxed);
+		}
+		else
+		{
+			targets[i]->send_errors.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+}
+
+/// Records the pulse-to-send latency of a message set, against both the given
+/// metrics (which may be NULL) and the plugin-wide metrics
+void stack_magicq_metrics_record_latency(StackMagicQMetrics *metrics, int64_t latency_us)
+{
+	StackMagicQMetrics *targets[2] = { &smqm_global, metrics };
+	for (size_t i = 0; i < 2 && targets[i] != NULL; i++)
+	{
+		targets[i]->last_latency_us.store(latency_us, std::memory_order_relaxed);
+		StackMagicQHistogram *histogram = stack_magicq_metrics_histogram_get(targets[i]);
+		if (histogram != NULL)
+		{
+			stack_magicq_metrics_histogram_record(histogram, latency_us);
+		}
+	}
+}
+
+/// Records that the socket has been (re-)established
+void stack_magicq_metrics_record_reestablishment()
+{
+	smqm_global.socket_reestablishments.fetch_add(1, std::memory_order_relaxed);
+}
+
+/// Records whether a command was confirmed by MagicQ's feedback or given up on,
+/// against both the given metrics (which may be NULL) and the plugin-wide
+/// metrics
+void stack_magicq_metrics_record_delivery(StackMagicQMetrics *metrics, bool confirmed)
+{
+	StackMagicQMetrics *targets[2] = { &smqm_global, metrics };
+	for (size_t i = 0; i < 2 && targets[i] != NULL; i++)
+	{
+		if (confirmed)
+		{
+			targets[i]->commands_confirmed.fetch_add(1, std::memory_order_relaxed);
+		}
+		else
+		{
+			targets[i]->commands_failed.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+}
+
+/// Records that a command was retransmitted, against both the given metrics
+/// (which may be NULL) and the plugin-wide metrics
+void stack_magicq_metrics_record_retransmit(StackMagicQMetrics *metrics)
+{
+	StackMagicQMetrics *targets[2] = { &smqm_global, metrics };
+	for (size_t i = 0; i < 2 && targets[i] != NULL; i++)
+	{
+		targets[i]->retransmits.fetch_add(1, std::memory_order_relaxed);
+	}
+}
+
+/// Records that the sender thread has acted on a request to cancel a cue's
+/// held-back message sets, and how many of them it recalled. The count is
+/// written before the answer is published, so once a cue sees the answer it
+/// can read the count
+void stack_magicq_metrics_record_cancel(StackMagicQMetrics *metrics, size_t recalled)
+{
+	if (metrics == NULL)
+	{
+		return;
+	}
+
+	metrics->last_cancel_recalled.store(recalled, std::memory_order_relaxed);
+	metrics->cancels_answered.fetch_add(1, std::memory_order_release);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// LIFECYCLE
+
+/// Sets all the counters of a set of metrics to zero
+static void stack_magicq_metrics_reset(StackMagicQMetrics *metrics)
+{
+	metrics->packets_sent = 0;
+	metrics->bytes_sent = 0;
+	metrics->send_errors = 0;
+	metrics->socket_reestablishments = 0;
+	metrics->last_send_time = 0;
+	metrics->last_send_ok = false;
+	metrics->commands_confirmed = 0;
+	metrics->commands_failed = 0;
+	metrics->retransmits = 0;
+	metrics->cancels_answered = 0;
+	metrics->last_cancel_recalled = 0;
+	metrics->last_latency_us = 0;
+
+	StackMagicQHistogram *histogram = metrics->latency.load(std::memory_order_relaxed);
+	if (histogram != NULL)
+	{
+		stack_magicq_metrics_histogram_reset(histogram);
+	}
+}
+
+/// Creates a new set of metrics (for a cue), with a single reference
+StackMagicQMetrics *stack_magicq_metrics_create()
+{
+	StackMagicQMetrics *metrics = new StackMagicQMetrics();
+	metrics->ref_count = 1;
+	metrics->latency = NULL;
+	stack_magicq_metrics_reset(metrics);
+	return metrics;
+}
+
+/// Takes a new reference to a set of metrics
+void stack_magicq_metrics_ref(StackMagicQMetrics *metrics)
+{
+	metrics->ref_count.fetch_add(1, std::memory_order_relaxed);
+}
+
+/// Releases a reference to a set of metrics, destroying it if it was the last
+void stack_magicq_metrics_unref(StackMagicQMetrics *metrics)
+{
+	if (metrics != NULL && metrics != &smqm_global && metrics->ref_count.fetch_sub(1, std::memory_order_acq_rel) == 1)
+	{
+		delete metrics->latency.load(std::memory_order_relaxed);
+		delete metrics;
+	}
+}
+
+/// Gets the latency histogram of a set of metrics. Returns NULL if nothing has
+/// been recorded in it yet
+const StackMagicQHistogram *stack_magicq_metrics_get_latency(const StackMagicQMetrics *metrics)
+{
+	return metrics->latency.load(std::memory_order_acquire);
+}
+
+/// Gets the metrics for the plugin as a whole
+StackMagicQMetrics *stack_magicq_metrics_get_global()
+{
+	return &smqm_global;
+}
+
+/// Logs a summary of the plugin-wide metrics
+static gboolean stack_magicq_metrics_dump(gpointer user_data)
+{
+	stack_log("stack_magicq_metrics_dump(): %lu packets (%lu bytes) sent, %lu errors, %lu socket re-establishments; latency p50 %ldus, p99 %ldus, p99.9 %ldus, max %ldus\n",
+		smqm_global.packets_sent.load(), smqm_global.bytes_sent.load(), smqm_global.send_errors.load(), smqm_global.socket_reestablishments.load(),
+		stack_magicq_metrics_get_percentile(&smqm_global_latency, 50.0),
+		stack_magicq_metrics_get_percentile(&smqm_global_latency, 99.0),
+		stack_magicq_metrics_get_percentile(&smqm_global_latency, 99.9),
+		smqm_global_latency.max.load());
+	if (stack_magicq_reliable_enabled())
+	{
+		StackMagicQReliableStats reliable_stats;
+		stack_magicq_reliable_get_stats(&reliable_stats);
+		stack_log("stack_magicq_metrics_dump(): %lu commands tracked, %lu confirmed, %lu not confirmed, %lu superseded, %lu not tracked, %lu waiting; %lu retransmissions\n",
+			reliable_stats.tracked, reliable_stats.confirmed, reliable_stats.failed, reliable_stats.superseded, reliable_stats.dropped, reliable_stats.pending, reliable_stats.retransmits);
+	}
+	if (stack_magicq_ledger_enabled())
+	{
+		StackMagicQLedgerStats ledger_stats;
+		stack_magicq_ledger_get_stats(&ledger_stats);
+		stack_log("stack_magicq_metrics_dump(): %lu commands checked against the ledger, %lu suppressed, %lu datagrams that didn't reach the primary console\n", ledger_stats.checked, ledger_stats.suppressed, ledger_stats.invalidations);
+	}
+
+	// Each console (or visualiser) we send to
+	StackMagicQTransport *transport = stack_magicq_transport_ref();
+	size_t destination_count = stack_magicq_transport_get_destination_count(transport);
+	for (size_t i = 0; i < destination_count; i++)
+	{
+		StackMagicQDestinationStats destination_stats;
+		if (!stack_magicq_transport_get_destination_stats(transport, i, &destination_stats))
+		{
+			continue;
+		}
+
+		char address[INET_ADDRSTRLEN];
+		inet_ntop(AF_INET, &destination_stats.address.sin_addr, address, sizeof(address));
+		stack_log("stack_magicq_metrics_dump(): Destination %s:%u %s, %lu packets sent, %lu errors (%u in a row)\n", address, ntohs(destination_stats.address.sin_port),
+			destination_stats.healthy ? "healthy" : "UNHEALTHY", destination_stats.sent, destination_stats.send_errors, destination_stats.consecutive_errors);
+	}
+	stack_magicq_transport_unref(transport);
+
+	return G_SOURCE_CONTINUE;
+}
+
+/// Sets up the plugin-wide metrics, and the periodic summary (if configured).
+/// The summary is driven from the default GLib main context, so this must be
+/// called from the main thread
+void stack_magicq_metrics_init()
+{
+	// The plugin-wide histogram is always needed, so it isn't allocated
+	smqm_global.latency = &smqm_global_latency;
+	stack_magicq_metrics_reset(&smqm_global);
+	smqm_global.ref_count = 1;
+
+	guint interval = stack_magicq_metrics_get_interval();
+	if (interval > 0)
+	{
+		g_timeout_add_seconds(interval, stack_magicq_metrics_dump, NULL);
+		stack_log("stack_magicq_metrics_init(): Logging metrics every %u seconds\n", interval);
+	}
+}
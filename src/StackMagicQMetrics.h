@@ -0,0 +1,95 @@
+#ifndef _STACKMAGICQMETRICS_H_INCLUDED
+#define _STACKMAGICQMETRICS_H_INCLUDED
+
+// Includes:
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Defines:
+// Each power of two of latency is split in to this many linear sub-buckets
+// (as a power of two), giving a precision of around 6%
+#define STACK_MAGICQ_HISTOGRAM_SUB_BUCKET_BITS 4
+#define STACK_MAGICQ_HISTOGRAM_SUB_BUCKETS (1 << STACK_MAGICQ_HISTOGRAM_SUB_BUCKET_BITS)
+
+// The number of buckets in a histogram, covering latencies up to about a minute
+// (2^26 microseconds). Anything larger lands in the last bucket
+#define STACK_MAGICQ_HISTOGRAM_BUCKETS ((26 - STACK_MAGICQ_HISTOGRAM_SUB_BUCKET_BITS + 1) * STACK_MAGICQ_HISTOGRAM_SUB_BUCKETS + STACK_MAGICQ_HISTOGRAM_SUB_BUCKETS)
+
+// A log-linear (HDR-style) histogram of latencies in microseconds. Values are
+// recorded with relaxed atomics, so it can be updated from any thread
+struct StackMagicQHistogram
+{
+	// The number of values in each bucket
+	std::atomic<uint64_t> counts[STACK_MAGICQ_HISTOGRAM_BUCKETS];
+
+	// The total number of values, and the largest
+	std::atomic<uint64_t> count;
+	std::atomic<int64_t> max;
+};
+
+// StackMagicQMetrics is a set of counters and a latency histogram. There is one
+// for each cue, and one for the plugin as a whole. The per-cue ones are
+// reference counted, as the sender thread holds a reference for each message
+// set that is waiting in the queue, which may outlive the cue
+struct StackMagicQMetrics
+{
+	// Reference count
+	std::atomic<int32_t> ref_count;
+
+	// Datagrams and bytes that were sent to at least one destination (each
+	// counted once, however many destinations there are)
+	std::atomic<uint64_t> packets_sent;
+	std::atomic<uint64_t> bytes_sent;
+
+	// Datagrams that failed to send to any destination
+	std::atomic<uint64_t> send_errors;
+
+	// Number of times the socket has been (re-)established
+	std::atomic<uint64_t> socket_reestablishments;
+
+	// When a datagram was last sent (wall clock, seconds, zero if never), and
+	// whether it reached at least one destination
+	std::atomic<int64_t> last_send_time;
+	std::atomic<bool> last_send_ok;
+
+	// Commands that MagicQ's feedback confirmed, that were never confirmed, and
+	// the number of retransmissions (only counted with reliable delivery on)
+	std::atomic<uint64_t> commands_confirmed;
+	std::atomic<uint64_t> commands_failed;
+	std::atomic<uint64_t> retransmits;
+
+	// The number of requests to cancel held-back message sets that the sender
+	// thread has acted on, and how many message sets the most recent of them
+	// recalled before they were sent (only counted for cues)
+	std::atomic<uint64_t> cancels_answered;
+	std::atomic<uint64_t> last_cancel_recalled;
+
+	// Latency from a cue pulse to its messages being handed to the kernel, in
+	// microseconds. The histogram is a few kilobytes, so a cue's is only
+	// allocated when it first sends something (it is NULL until then)
+	std::atomic<int64_t> last_latency_us;
+	std::atomic<StackMagicQHistogram*> latency;
+};
+
+// Functions: Lifecycle
+void stack_magicq_metrics_init();
+StackMagicQMetrics *stack_magicq_metrics_create();
+void stack_magicq_metrics_ref(StackMagicQMetrics *metrics);
+void stack_magicq_metrics_unref(StackMagicQMetrics *metrics);
+StackMagicQMetrics *stack_magicq_metrics_get_global();
+
+// Functions: Recording
+void stack_magicq_metrics_record_send(StackMagicQMetrics *metrics, size_t bytes, bool success);
+void stack_magicq_metrics_record_latency(StackMagicQMetrics *metrics, int64_t latency_us);
+void stack_magicq_metrics_record_reestablishment();
+void stack_magicq_metrics_record_delivery(StackMagicQMetrics *metrics, bool confirmed);
+void stack_magicq_metrics_record_retransmit(StackMagicQMetrics *metrics);
+void stack_magicq_metrics_record_cancel(StackMagicQMetrics *metrics, size_t recalled);
+
+// Functions: Reading
+const StackMagicQHistogram *stack_magicq_metrics_get_latency(const StackMagicQMetrics *metrics);
+uint64_t stack_magicq_metrics_get_count(const StackMagicQHistogram *histogram);
+int64_t stack_magicq_metrics_get_percentile(const StackMagicQHistogram *histogram, double percentile);
+
+#endif
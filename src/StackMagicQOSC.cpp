@@ -0,0 +1,183 @@
+// Includes:
+#include "StackLog.h"
+#include "StackMagicQOSC.h"
+#include <cstdlib>
+
+// Global: The style of address we send to MagicQ
+static StackMagicQOSCAddressing smqo_addressing = STACK_MAGICQ_OSC_ADDRESSING_RPC;
+
+// TODO: Put this into an app-wide settings UI
+/// Reads the OSC configuration. Should be called once from stack_init_plugin()
+void stack_magicq_osc_init()
+{
+	char *env = getenv("STACK_MAGICQ_OSC_ADDRESSING");
+	if (env != NULL && strcmp(env, "structured") == 0)
+	{
+		smqo_addressing = STACK_MAGICQ_OSC_ADDRESSING_STRUCTURED;
+		stack_log("stack_magicq_osc_init(): Using structured OSC addresses\n");
+	}
+	else
+	{
+		smqo_addressing = STACK_MAGICQ_OSC_ADDRESSING_RPC;
+	}
+}
+
+/// Gets the style of address we send to MagicQ
+StackMagicQOSCAddressing stack_magicq_osc_get_addressing()
+{
+	return smqo_addressing;
+}
+
+/// Appends a string to an address being built, returning the new length. The
+/// string is truncated if it doesn't fit
+static size_t stack_magicq_osc_address_append_string(char *address, size_t length, const char *value)
+{
+	if (length >= STACK_MAGICQ_OSC_MAX_ADDRESS)
+	{
+		return length;
+	}
+
+	// Never read past the end of the value, nor write past the space left
+	// (leaving room for the NUL terminator)
+	const size_t remaining = STACK_MAGICQ_OSC_MAX_ADDRESS - 1 - length;
+	const size_t value_length = strnlen(value, remaining);
+	memcpy(&address[length], value, value_length);
+	length += value_length;
+	address[length] = '\0';
+	return length;
+}
+
+/// Appends a decimal integer to an address being built, returning the new
+/// length. This is used rather than snprintf() as it's on the send path
+static size_t stack_magicq_osc_address_append_int(char *address, size_t length, int value)
+{
+	char digits[8];
+	size_t digit_count = 0;
+	bool negative = value < 0;
+	unsigned int magnitude = negative ? -(unsigned int)value : (unsigned int)value;
+
+	do
+	{
+		digits[digit_count++] = '0' + (magnitude % 10);
+		magnitude /= 10;
+	} while (magnitude > 0 && digit_count < sizeof(digits));
+
+	if (negative && length + 1 < STACK_MAGICQ_OSC_MAX_ADDRESS)
+	{
+		address[length++] = '-';
+	}
+	while (digit_count > 0 && length + 1 < STACK_MAGICQ_OSC_MAX_ADDRESS)
+	{
+		address[length++] = digits[--digit_count];
+	}
+	address[length] = '\0';
+
+	return length;
+}
+
+/// Appends an argument-less OSC message to a buffer of OSC bundle elements (a
+/// big-endian size followed by the message). Returns the new length of the data
+/// in the buffer, which is unchanged if the message would not fit
+/// @param elements The buffer to append to
+/// @param offset The current length of the data in the buffer
+/// @param size The total size of the buffer
+/// @param address The OSC address of the message
+size_t stack_magicq_osc_append_message(char *elements, size_t offset, size_t size, const char *address)
+{
+	StackMagicQOSCMessage<4> message(address);
+	return message.append_to(elements, offset, size);
+}
+
+/// Appends the text of a MagicQ remote playback command for an operation (e.g.
+/// "1,50L") to an address being built, returning the new length. This is the
+/// same text whether it is sent in an /rpc address or over the ChamSys Remote
+/// Ethernet Protocol
+size_t stack_magicq_osc_append_rpc_command(char *address, size_t length, MagicQOperation operation, int16_t playback, int16_t level, const char *cue_id)
+{
+	length = stack_magicq_osc_address_append_int(address, length, playback);
+
+	switch (operation)
+	{
+		case MAGICQ_OPERATION_ACTIVATE:
+			length = stack_magicq_osc_address_append_string(address, length, "A");
+			break;
+		case MAGICQ_OPERATION_RELEASE:
+			length = stack_magicq_osc_address_append_string(address, length, "R");
+			break;
+		case MAGICQ_OPERATION_GO:
+			length = stack_magicq_osc_address_append_string(address, length, "G");
+			break;
+		case MAGICQ_OPERATION_STOP:
+			length = stack_magicq_osc_address_append_string(address, length, "S");
+			break;
+		case MAGICQ_OPERATION_SET_LEVEL:
+			length = stack_magicq_osc_address_append_string(address, length, ",");
+			length = stack_magicq_osc_address_append_int(address, length, level);
+			length = stack_magicq_osc_address_append_string(address, length, "L");
+			break;
+		case MAGICQ_OPERATION_JUMP_TO_CUE_ID:
+			length = stack_magicq_osc_address_append_string(address, length, ",");
+			length = stack_magicq_osc_address_append_string(address, length, cue_id != NULL ? cue_id : "");
+			length = stack_magicq_osc_address_append_string(address, length, "J");
+			break;
+	}
+
+	return length;
+}
+
+/// Appends the MagicQ remote playback command (/rpc) message for an operation
+static size_t stack_magicq_osc_append_rpc(char *elements, size_t offset, size_t size, MagicQOperation operation, int16_t playback, int16_t level, const char *cue_id)
+{
+	char address[STACK_MAGICQ_OSC_MAX_ADDRESS];
+	size_t length = stack_magicq_osc_address_append_string(address, 0, "/rpc/");
+	stack_magicq_osc_append_rpc_command(address, length, operation, playback, level, cue_id);
+
+	return stack_magicq_osc_append_message(elements, offset, size, address);
+}
+
+/// Appends the MagicQ structured playback (/pb) message for an operation. Not
+/// every operation has a structured equivalent, so those fall back to /rpc
+static size_t stack_magicq_osc_append_structured(char *elements, size_t offset, size_t size, MagicQOperation operation, int16_t playback, int16_t level, const char *cue_id)
+{
+	char address[STACK_MAGICQ_OSC_MAX_ADDRESS];
+	size_t length = stack_magicq_osc_address_append_string(address, 0, "/pb/");
+	length = stack_magicq_osc_address_append_int(address, length, playback);
+
+	switch (operation)
+	{
+		case MAGICQ_OPERATION_SET_LEVEL:
+		{
+			// The level is sent as a float percentage
+			StackMagicQOSCMessage<4> message(address);
+			message.add_float((float)level);
+			return message.append_to(elements, offset, size);
+		}
+		case MAGICQ_OPERATION_RELEASE:
+			stack_magicq_osc_address_append_string(address, length, "/release");
+			break;
+		case MAGICQ_OPERATION_GO:
+			stack_magicq_osc_address_append_string(address, length, "/go");
+			break;
+		case MAGICQ_OPERATION_STOP:
+			stack_magicq_osc_address_append_string(address, length, "/stop");
+			break;
+		case MAGICQ_OPERATION_ACTIVATE:
+		case MAGICQ_OPERATION_JUMP_TO_CUE_ID:
+			return stack_magicq_osc_append_rpc(elements, offset, size, operation, playback, level, cue_id);
+	}
+
+	return stack_magicq_osc_append_message(elements, offset, size, address);
+}
+
+/// Appends the MagicQ message for an operation to a buffer of OSC bundle
+/// elements, using the configured style of address. Returns the new length of
+/// the data in the buffer, which is unchanged if the message would not fit
+size_t stack_magicq_osc_append_operation(char *elements, size_t offset, size_t size, MagicQOperation operation, int16_t playback, int16_t level, const char *cue_id)
+{
+	if (smqo_addressing == STACK_MAGICQ_OSC_ADDRESSING_STRUCTURED)
+	{
+		return stack_magicq_osc_append_structured(elements, offset, size, operation, playback, level, cue_id);
+	}
+
+	return stack_magicq_osc_append_rpc(elements, offset, size, operation, playback, level, cue_id);
+}
@@ -0,0 +1,171 @@
+#ifndef _STACKMAGICQOSC_H_INCLUDED
+#define _STACKMAGICQOSC_H_INCLUDED
+
+// Includes:
+#include "StackMagicQCommand.h"
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <arpa/inet.h>
+
+// Defines:
+// Rounds a length up to the four-byte boundary required by OSC
+#define STACK_MAGICQ_OSC_PAD(_l) (((_l) + 3) & ~((size_t)3))
+
+// The longest OSC address we will encode (including its NUL terminator)
+#define STACK_MAGICQ_OSC_MAX_ADDRESS 64
+
+// The most arguments a single OSC message can carry
+#define STACK_MAGICQ_OSC_MAX_ARGUMENTS 4
+
+// The styles of OSC address that we can send to MagicQ
+typedef enum StackMagicQOSCAddressing
+{
+	// Remote playback commands, e.g. /rpc/1,50L, with no arguments
+	STACK_MAGICQ_OSC_ADDRESSING_RPC = 0,
+
+	// Structured addresses with binary arguments, e.g. /pb/1 with a float
+	STACK_MAGICQ_OSC_ADDRESSING_STRUCTURED = 1,
+} StackMagicQOSCAddressing;
+
+// StackMagicQOSCMessage builds a single OSC message with typed arguments in a
+// fixed-size buffer, so that encoding never touches the heap. N is the space
+// available for the encoded arguments. If anything doesn't fit, the message is
+// marked as overflowed and append_to() refuses to write it
+template <size_t N> class StackMagicQOSCMessage
+{
+	public:
+		/// Creates a message with the given address and no arguments
+		StackMagicQOSCMessage(const char *address)
+		{
+			address_length = strlen(address);
+			overflow = address_length >= STACK_MAGICQ_OSC_MAX_ADDRESS;
+			if (!overflow)
+			{
+				memcpy(this->address, address, address_length);
+			}
+			argument_count = 0;
+			arguments_length = 0;
+		}
+
+		/// Adds a 32-bit integer argument (type tag 'i')
+		bool add_int32(int32_t value)
+		{
+			uint32_t be = htonl((uint32_t)value);
+			return add_argument('i', &be, 4);
+		}
+
+		/// Adds a 32-bit float argument (type tag 'f')
+		bool add_float(float value)
+		{
+			uint32_t bits;
+			memcpy(&bits, &value, 4);
+			bits = htonl(bits);
+			return add_argument('f', &bits, 4);
+		}
+
+		/// Adds a string argument (type tag 's')
+		bool add_string(const char *value)
+		{
+			size_t length = strlen(value);
+			size_t padded_length = STACK_MAGICQ_OSC_PAD(length + 1);
+			if (!add_argument('s', value, length))
+			{
+				return false;
+			}
+
+			// NUL terminate and pad the string
+			if (arguments_length + padded_length - length > N)
+			{
+				overflow = true;
+				return false;
+			}
+			memset(&arguments[arguments_length], 0, padded_length - length);
+			arguments_length += padded_length - length;
+			return true;
+		}
+
+		/// Gets the size of the encoded message (excluding the bundle element size)
+		size_t length() const
+		{
+			return STACK_MAGICQ_OSC_PAD(address_length + 1) + STACK_MAGICQ_OSC_PAD(argument_count + 2) + arguments_length;
+		}
+
+		/// Appends the message as an OSC bundle element (a big-endian size
+		/// followed by the message) to a buffer. Returns the new length of the
+		/// data in the buffer, which is unchanged if the message would not fit
+		size_t append_to(char *elements, size_t offset, size_t size) const
+		{
+			size_t message_length = length();
+			if (overflow || offset + 4 + message_length > size)
+			{
+				return offset;
+			}
+
+			// Element size
+			uint32_t element_size = htonl((uint32_t)message_length);
+			memcpy(&elements[offset], &element_size, 4);
+			offset += 4;
+
+			// Address, plus NUL padding
+			size_t padded_address_length = STACK_MAGICQ_OSC_PAD(address_length + 1);
+			memcpy(&elements[offset], address, address_length);
+			memset(&elements[offset + address_length], 0, padded_address_length - address_length);
+			offset += padded_address_length;
+
+			// Type tags: a comma followed by one tag per argument, plus padding
+			size_t padded_tags_length = STACK_MAGICQ_OSC_PAD(argument_count + 2);
+			elements[offset] = ',';
+			memcpy(&elements[offset + 1], type_tags, argument_count);
+			memset(&elements[offset + 1 + argument_count], 0, padded_tags_length - argument_count - 1);
+			offset += padded_tags_length;
+
+			// Arguments
+			memcpy(&elements[offset], arguments, arguments_length);
+			offset += arguments_length;
+
+			return offset;
+		}
+
+	private:
+		/// Adds the tag and raw bytes of an argument
+		bool add_argument(char tag, const void *data, size_t data_length)
+		{
+			if (overflow || argument_count == STACK_MAGICQ_OSC_MAX_ARGUMENTS || arguments_length + data_length > N)
+			{
+				overflow = true;
+				return false;
+			}
+
+			type_tags[argument_count++] = tag;
+			memcpy(&arguments[arguments_length], data, data_length);
+			arguments_length += data_length;
+			return true;
+		}
+
+		// The address
+		char address[STACK_MAGICQ_OSC_MAX_ADDRESS];
+		size_t address_length;
+
+		// The type tags of the arguments (without the leading comma)
+		char type_tags[STACK_MAGICQ_OSC_MAX_ARGUMENTS];
+		size_t argument_count;
+
+		// The encoded arguments
+		char arguments[N];
+		size_t arguments_length;
+
+		// Whether something didn't fit
+		bool overflow;
+};
+
+// Functions: Configuration
+void stack_magicq_osc_init();
+StackMagicQOSCAddressing stack_magicq_osc_get_addressing();
+
+// Functions: Encoding
+size_t stack_magicq_osc_append_message(char *elements, size_t offset, size_t size, const char *address);
+size_t stack_magicq_osc_append_operation(char *elements, size_t offset, size_t size, MagicQOperation operation, int16_t playback, int16_t level, const char *cue_id);
+size_t stack_magicq_osc_append_rpc_command(char *address, size_t length, MagicQOperation operation, int16_t playback, int16_t level, const char *cue_id);
+
+#endif
@@ -0,0 +1,207 @@
+// Includes:
+#include "StackMagicQPlaybackSet.h"
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+/// Removes every playback from a set
+void stack_magicq_playback_set_clear(StackMagicQPlaybackSet *set)
+{
+	memset(set->bits, 0, sizeof(set->bits));
+}
+
+/// Adds a playback to a set. Playbacks out of range are ignored
+void stack_magicq_playback_set_add(StackMagicQPlaybackSet *set, uint16_t playback)
+{
+	if (playback >= 1 && playback <= STACK_MAGICQ_MAX_PLAYBACK)
+	{
+		set->bits[playback / 64] |= (uint64_t)1 << (playback % 64);
+	}
+}
+
+/// Determines whether a playback is in a set
+bool stack_magicq_playback_set_contains(const StackMagicQPlaybackSet *set, uint16_t playback)
+{
+	if (playback > STACK_MAGICQ_MAX_PLAYBACK)
+	{
+		return false;
+	}
+
+	return (set->bits[playback / 64] & ((uint64_t)1 << (playback % 64))) != 0;
+}
+
+/// Determines whether a set has no playbacks in it
+bool stack_magicq_playback_set_is_empty(const StackMagicQPlaybackSet *set)
+{
+	for (size_t i = 0; i < STACK_MAGICQ_PLAYBACK_SET_WORDS; i++)
+	{
+		if (set->bits[i] != 0)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/// Counts the playbacks in a set
+size_t stack_magicq_playback_set_count(const StackMagicQPlaybackSet *set)
+{
+	size_t count = 0;
+	for (size_t i = 0; i < STACK_MAGICQ_PLAYBACK_SET_WORDS; i++)
+	{
+		count += (size_t)__builtin_popcountll(set->bits[i]);
+	}
+
+	return count;
+}
+
+/// Gets the lowest playback in a set that is greater than the given one. Pass
+/// zero to get the first playback. Returns -1 if there are no more
+int stack_magicq_playback_set_next(const StackMagicQPlaybackSet *set, int after)
+{
+	int start = after + 1;
+	if (start < 1)
+	{
+		start = 1;
+	}
+
+	for (size_t word = (size_t)start / 64; word < STACK_MAGICQ_PLAYBACK_SET_WORDS; word++)
+	{
+		uint64_t bits = set->bits[word];
+
+		// Mask off the playbacks we've already been past in the first word
+		if (word == (size_t)start / 64)
+		{
+			bits &= ~(uint64_t)0 << (start % 64);
+		}
+
+		if (bits != 0)
+		{
+			int playback = (int)(word * 64) + __builtin_ctzll(bits);
+			return playback <= STACK_MAGICQ_MAX_PLAYBACK ? playback : -1;
+		}
+	}
+
+	return -1;
+}
+
+/// Parses a list of playbacks and ranges of playbacks, such as "1-8,12,15", in
+/// to a set. Returns false (leaving the set empty) if the text is invalid
+bool stack_magicq_playback_set_parse(const char *text, StackMagicQPlaybackSet *set)
+{
+	stack_magicq_playback_set_clear(set);
+
+	const char *c = text;
+	while (true)
+	{
+		while (isspace((unsigned char)*c))
+		{
+			c++;
+		}
+
+		// An empty list is valid (and empty)
+		if (*c == '\0' && c == text)
+		{
+			return true;
+		}
+
+		// The first (or only) playback of the item
+		char *end = NULL;
+		long first = strtol(c, &end, 10);
+		if (end == c || first < 1 || first > STACK_MAGICQ_MAX_PLAYBACK)
+		{
+			stack_magicq_playback_set_clear(set);
+			return false;
+		}
+		c = end;
+		while (isspace((unsigned char)*c))
+		{
+			c++;
+		}
+
+		// The end of a range, if there is one
+		long last = first;
+		if (*c == '-')
+		{
+			c++;
+			last = strtol(c, &end, 10);
+			if (end == c || last < first || last > STACK_MAGICQ_MAX_PLAYBACK)
+			{
+				stack_magicq_playback_set_clear(set);
+				return false;
+			}
+			c = end;
+			while (isspace((unsigned char)*c))
+			{
+				c++;
+			}
+		}
+
+		for (long playback = first; playback <= last; playback++)
+		{
+			stack_magicq_playback_set_add(set, (uint16_t)playback);
+		}
+
+		// Either the end of the list or the next item
+		if (*c == '\0')
+		{
+			return true;
+		}
+		else if (*c != ',')
+		{
+			stack_magicq_playback_set_clear(set);
+			return false;
+		}
+		c++;
+	}
+}
+
+/// Formats a set in its shortest text form, with consecutive playbacks written
+/// as ranges, e.g. "1-8,12,15". Returns the length of the text
+size_t stack_magicq_playback_set_format(const StackMagicQPlaybackSet *set, char *text, size_t size)
+{
+	size_t length = 0;
+	if (size == 0)
+	{
+		return 0;
+	}
+	text[0] = '\0';
+
+	int playback = stack_magicq_playback_set_next(set, 0);
+	while (playback > 0)
+	{
+		// Find the end of this run of playbacks
+		int last = playback;
+		int next = stack_magicq_playback_set_next(set, last);
+		while (next == last + 1)
+		{
+			last = next;
+			next = stack_magicq_playback_set_next(set, last);
+		}
+
+		int written;
+		if (last == playback)
+		{
+			written = snprintf(&text[length], size - length, "%s%d", length > 0 ? "," : "", playback);
+		}
+		else
+		{
+			written = snprintf(&text[length], size - length, "%s%d-%d", length > 0 ? "," : "", playback, last);
+		}
+
+		if (written < 0 || (size_t)written >= size - length)
+		{
+			// Out of space: this should never happen with a buffer of
+			// STACK_MAGICQ_PLAYBACK_SET_MAX_TEXT
+			text[length] = '\0';
+			return length;
+		}
+		length += (size_t)written;
+
+		playback = next;
+	}
+
+	return length;
+}
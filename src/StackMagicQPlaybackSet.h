@@ -0,0 +1,36 @@
+#ifndef _STACKMAGICQPLAYBACKSET_H_INCLUDED
+#define _STACKMAGICQPLAYBACKSET_H_INCLUDED
+
+// Includes:
+#include "StackMagicQCommand.h"
+#include <cstddef>
+#include <cstdint>
+
+// Defines:
+// The number of 64-bit words needed to hold a bit for every playback
+#define STACK_MAGICQ_PLAYBACK_SET_WORDS ((STACK_MAGICQ_MAX_PLAYBACK + 64) / 64)
+
+// The longest text form of a playback set that we will produce (including the
+// NUL terminator). The worst case is every other playback, e.g. "1,3,5,..."
+#define STACK_MAGICQ_PLAYBACK_SET_MAX_TEXT 512
+
+// A set of playbacks, stored as one bit per playback number. Playback zero is
+// never a member
+struct StackMagicQPlaybackSet
+{
+	uint64_t bits[STACK_MAGICQ_PLAYBACK_SET_WORDS];
+};
+
+// Functions: Building sets
+void stack_magicq_playback_set_clear(StackMagicQPlaybackSet *set);
+void stack_magicq_playback_set_add(StackMagicQPlaybackSet *set, uint16_t playback);
+bool stack_magicq_playback_set_parse(const char *text, StackMagicQPlaybackSet *set);
+
+// Functions: Querying sets
+bool stack_magicq_playback_set_contains(const StackMagicQPlaybackSet *set, uint16_t playback);
+bool stack_magicq_playback_set_is_empty(const StackMagicQPlaybackSet *set);
+size_t stack_magicq_playback_set_count(const StackMagicQPlaybackSet *set);
+int stack_magicq_playback_set_next(const StackMagicQPlaybackSet *set, int after);
+size_t stack_magicq_playback_set_format(const StackMagicQPlaybackSet *set, char *text, size_t size);
+
+#endif
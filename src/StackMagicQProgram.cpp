@@ -0,0 +1,300 @@
+// Includes:
+#include "StackMagicQProgram.h"
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <strings.h>
+
+// Global: The names of the operations in the text form of a program, in
+// MagicQOperation order
+static const char *smqp_operation_names[] = {
+	"activate", "release", "go", "stop", "level", "jump"
+};
+
+/// Removes every step from a program
+void stack_magicq_program_clear(StackMagicQProgram *program)
+{
+	program->step_count = 0;
+}
+
+/// Determines whether text is a valid cue ID: digits, optionally followed by a
+/// decimal point and more digits (e.g. "12" or "2.5")
+static bool stack_magicq_program_is_cue_id(const char *text)
+{
+	const char *c = text;
+	while (isdigit((unsigned char)*c))
+	{
+		c++;
+	}
+	if (c == text)
+	{
+		return false;
+	}
+
+	if (*c == '.')
+	{
+		const char *fraction = ++c;
+		while (isdigit((unsigned char)*c))
+		{
+			c++;
+		}
+		if (c == fraction)
+		{
+			return false;
+		}
+	}
+
+	return *c == '\0';
+}
+
+/// Appends a step to a program. Returns false (leaving the program unchanged)
+/// if the program is full or the cue ID is too long or isn't a cue ID
+/// @param cue_id The cue ID to jump to (may be NULL, and ignored unless the
+/// operation is a jump)
+bool stack_magicq_program_add_step(StackMagicQProgram *program, MagicQOperation operation, const StackMagicQPlaybackSet *playbacks, int16_t level, const char *cue_id)
+{
+	if (program->step_count == STACK_MAGICQ_PROGRAM_MAX_STEPS)
+	{
+		return false;
+	}
+
+	if (operation != MAGICQ_OPERATION_JUMP_TO_CUE_ID || cue_id == NULL)
+	{
+		cue_id = "";
+	}
+	if (strlen(cue_id) >= STACK_MAGICQ_PROGRAM_MAX_CUE_ID || (cue_id[0] != '\0' && !stack_magicq_program_is_cue_id(cue_id)))
+	{
+		return false;
+	}
+
+	StackMagicQStep *step = &program->steps[program->step_count++];
+	step->operation = operation;
+	step->playbacks = *playbacks;
+	step->level = operation == MAGICQ_OPERATION_SET_LEVEL ? (level < 0 ? 0 : (level > 100 ? 100 : level)) : 0;
+	strcpy(step->cue_id, cue_id);
+
+	return true;
+}
+
+/// Gets the name of an operation in the text form of a program
+const char *stack_magicq_program_get_operation_name(MagicQOperation operation)
+{
+	if ((size_t)operation >= sizeof(smqp_operation_names) / sizeof(smqp_operation_names[0]))
+	{
+		return "";
+	}
+
+	return smqp_operation_names[operation];
+}
+
+/// Looks up an operation by its name in the text form of a program (ignoring
+/// case). Returns false if there is no such operation
+bool stack_magicq_program_get_operation(const char *name, MagicQOperation *operation)
+{
+	for (size_t i = 0; i < sizeof(smqp_operation_names) / sizeof(smqp_operation_names[0]); i++)
+	{
+		if (strcasecmp(name, smqp_operation_names[i]) == 0)
+		{
+			*operation = (MagicQOperation)i;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/// Splits the argument (the last word) off the end of the playbacks of a step,
+/// e.g. "1, 2 50" in to "1, 2" and "50". A last word that continues a list or a
+/// range of playbacks (e.g. "1, 2" or "1 - 4") is not an argument, in which case
+/// the argument is NULL. The text is modified
+static char *stack_magicq_program_split_argument(char *text)
+{
+	char *end = &text[strlen(text)];
+	char *word = end;
+	while (word > text && !isspace((unsigned char)word[-1]))
+	{
+		word--;
+	}
+	if (word == text || *word == ',' || *word == '-')
+	{
+		return NULL;
+	}
+
+	char *gap = word;
+	while (gap > text && isspace((unsigned char)gap[-1]))
+	{
+		gap--;
+	}
+	if (gap == text || gap[-1] == ',' || gap[-1] == '-')
+	{
+		return NULL;
+	}
+
+	*gap = '\0';
+	return word;
+}
+
+/// Parses a single step, e.g. "level 1-4 50", appending it to a program. The
+/// step is an operation name, then a playback set (which may contain spaces,
+/// e.g. "1, 2"), then the argument for level and jump steps. An empty step is
+/// ignored. The step text is modified
+static bool stack_magicq_program_parse_step(char *text, StackMagicQProgram *program)
+{
+	// Trim the step
+	while (isspace((unsigned char)*text))
+	{
+		text++;
+	}
+	size_t length = strlen(text);
+	while (length > 0 && isspace((unsigned char)text[length - 1]))
+	{
+		text[--length] = '\0';
+	}
+
+	if (length == 0)
+	{
+		return true;
+	}
+
+	// The operation is the first word, and everything after it is for the
+	// playbacks and the argument
+	char *rest = text;
+	while (*rest != '\0' && !isspace((unsigned char)*rest))
+	{
+		rest++;
+	}
+	if (*rest != '\0')
+	{
+		*rest++ = '\0';
+		while (isspace((unsigned char)*rest))
+		{
+			rest++;
+		}
+	}
+
+	MagicQOperation operation;
+	if (!stack_magicq_program_get_operation(text, &operation) || *rest == '\0')
+	{
+		return false;
+	}
+
+	char *argument = NULL;
+	if (operation == MAGICQ_OPERATION_SET_LEVEL || operation == MAGICQ_OPERATION_JUMP_TO_CUE_ID)
+	{
+		argument = stack_magicq_program_split_argument(rest);
+	}
+
+	// Every step has some playbacks
+	StackMagicQPlaybackSet playbacks;
+	if (!stack_magicq_playback_set_parse(rest, &playbacks))
+	{
+		return false;
+	}
+
+	char *end = NULL;
+	switch (operation)
+	{
+		case MAGICQ_OPERATION_SET_LEVEL:
+		{
+			// A level, as a percentage
+			if (argument == NULL)
+			{
+				return false;
+			}
+			long level = strtol(argument, &end, 10);
+			if (end == argument || *end != '\0')
+			{
+				return false;
+			}
+			return stack_magicq_program_add_step(program, operation, &playbacks, (int16_t)(level < 0 ? 0 : (level > 100 ? 100 : level)), NULL);
+		}
+
+		case MAGICQ_OPERATION_JUMP_TO_CUE_ID:
+			// A cue ID, which may be left out until it's known (the cue can't
+			// be played until it is)
+			return stack_magicq_program_add_step(program, operation, &playbacks, 0, argument);
+
+		default:
+			return stack_magicq_program_add_step(program, operation, &playbacks, 0, NULL);
+	}
+}
+
+/// Parses the text form of a program, e.g. "activate 1-4; level 1-4 50; go 5".
+/// Returns false (leaving the program empty) if the text is invalid. Empty
+/// text is a valid (empty) program
+bool stack_magicq_program_parse(const char *text, StackMagicQProgram *program)
+{
+	stack_magicq_program_clear(program);
+
+	const char *c = text;
+	while (*c != '\0')
+	{
+		// Copy out the step so that it can be split up
+		size_t length = strcspn(c, ";\n");
+		char step[STACK_MAGICQ_PLAYBACK_SET_MAX_TEXT + 64];
+		if (length >= sizeof(step))
+		{
+			stack_magicq_program_clear(program);
+			return false;
+		}
+		memcpy(step, c, length);
+		step[length] = '\0';
+
+		if (!stack_magicq_program_parse_step(step, program))
+		{
+			stack_magicq_program_clear(program);
+			return false;
+		}
+
+		c += length;
+		if (*c != '\0')
+		{
+			c++;
+		}
+	}
+
+	return true;
+}
+
+/// Formats a program in its text form, with playbacks in their shortest form.
+/// Returns the length of the text, or zero if it didn't fit
+size_t stack_magicq_program_format(const StackMagicQProgram *program, char *text, size_t size)
+{
+	size_t length = 0;
+	if (size == 0)
+	{
+		return 0;
+	}
+	text[0] = '\0';
+
+	for (size_t i = 0; i < program->step_count; i++)
+	{
+		const StackMagicQStep *step = &program->steps[i];
+		char playback_text[STACK_MAGICQ_PLAYBACK_SET_MAX_TEXT];
+		stack_magicq_playback_set_format(&step->playbacks, playback_text, sizeof(playback_text));
+
+		int written;
+		if (step->operation == MAGICQ_OPERATION_SET_LEVEL)
+		{
+			written = snprintf(&text[length], size - length, "%s%s %s %d", length > 0 ? "; " : "", stack_magicq_program_get_operation_name(step->operation), playback_text, step->level);
+		}
+		else if (step->operation == MAGICQ_OPERATION_JUMP_TO_CUE_ID && step->cue_id[0] != '\0')
+		{
+			written = snprintf(&text[length], size - length, "%s%s %s %s", length > 0 ? "; " : "", stack_magicq_program_get_operation_name(step->operation), playback_text, step->cue_id);
+		}
+		else
+		{
+			written = snprintf(&text[length], size - length, "%s%s %s", length > 0 ? "; " : "", stack_magicq_program_get_operation_name(step->operation), playback_text);
+		}
+
+		if (written < 0 || (size_t)written >= size - length)
+		{
+			text[0] = '\0';
+			return 0;
+		}
+		length += (size_t)written;
+	}
+
+	return length;
+}
@@ -0,0 +1,54 @@
+#ifndef _STACKMAGICQPROGRAM_H_INCLUDED
+#define _STACKMAGICQPROGRAM_H_INCLUDED
+
+// Includes:
+#include "StackMagicQCommand.h"
+#include "StackMagicQPlaybackSet.h"
+#include <cstddef>
+#include <cstdint>
+
+// Defines:
+// The most steps a single cue's program can have
+#define STACK_MAGICQ_PROGRAM_MAX_STEPS 32
+
+// The longest cue ID a jump step can have (including the NUL terminator)
+#define STACK_MAGICQ_PROGRAM_MAX_CUE_ID 16
+
+// The longest text form of a program that we will produce or accept (including
+// the NUL terminator)
+#define STACK_MAGICQ_PROGRAM_MAX_TEXT 4096
+
+// A single step of a program: an operation, the playbacks it applies to, and
+// its argument (the level for a level step, the cue ID for a jump step)
+struct StackMagicQStep
+{
+	MagicQOperation operation;
+	StackMagicQPlaybackSet playbacks;
+	int16_t level;
+	char cue_id[STACK_MAGICQ_PROGRAM_MAX_CUE_ID];
+};
+
+// The ordered list of operations a cue performs when it fires. Its text form is
+// a list of steps separated by semicolons (or new lines), each an operation
+// name, a playback set and (for level and jump) an argument, e.g.
+// "activate 1-4; level 1-4 50; go 5; jump 6 2.5; stop 7; release 1-4"
+// If the cue has an action time, every level step fades to its level over that
+// time, from the cue's start level and along its curve, rather than setting
+// it immediately
+struct StackMagicQProgram
+{
+	StackMagicQStep steps[STACK_MAGICQ_PROGRAM_MAX_STEPS];
+	size_t step_count;
+};
+
+// Functions: Building programs
+void stack_magicq_program_clear(StackMagicQProgram *program);
+bool stack_magicq_program_add_step(StackMagicQProgram *program, MagicQOperation operation, const StackMagicQPlaybackSet *playbacks, int16_t level, const char *cue_id);
+bool stack_magicq_program_parse(const char *text, StackMagicQProgram *program);
+
+// Functions: Describing programs
+size_t stack_magicq_program_format(const StackMagicQProgram *program, char *text, size_t size);
+const char *stack_magicq_program_get_operation_name(MagicQOperation operation);
+bool stack_magicq_program_get_operation(const char *name, MagicQOperation *operation);
+
+#endif
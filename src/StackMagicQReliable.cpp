@@ -0,0 +1,433 @@
+// Includes:
+#include "StackLog.h"
+#include "StackMagicQReliable.h"
+#include "StackMagicQFeedback.h"
+#include "StackMagicQTransport.h"
+#include <gtk/gtk.h>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+// Global: Whether reliable delivery is turned on
+static bool smqr_enabled = false;
+
+// Global: How long to wait for confirmation before the first retransmission,
+// and how many times to retransmit before giving up
+static int64_t smqr_timeout = 100000000LL;
+static uint32_t smqr_retries = 3;
+
+// Global: The longest wait between retransmissions, in nanoseconds
+static const int64_t smqr_max_backoff = 2000000000LL;
+
+// Global: Requests from the pulse threads, waiting for the main loop. The
+// number of them that are to track a command is counted so that some room is
+// always left for requests to forget
+static StackMagicQReliableRequest smqr_queue[STACK_MAGICQ_RELIABLE_QUEUE_SIZE];
+static std::atomic<size_t> smqr_enqueue_pos(0);
+static size_t smqr_dequeue_pos = 0;
+static std::atomic<size_t> smqr_queued_tracks(0);
+
+// Global: The commands being tracked. Only the main loop touches these
+static StackMagicQTrackedCommand smqr_commands[STACK_MAGICQ_RELIABLE_MAX_COMMANDS];
+static bool smqr_in_use[STACK_MAGICQ_RELIABLE_MAX_COMMANDS];
+
+// Global: The transport that retransmissions go through (we hold a reference
+// for the lifetime of the plugin)
+static StackMagicQTransport *smqr_transport = NULL;
+
+// Global: Counters. Apart from the number of commands dropped (which the
+// pulse threads count), these are only updated by the main loop
+static StackMagicQReliableStats smqr_stats;
+static std::atomic<uint64_t> smqr_dropped(0);
+static uint64_t smqr_dropped_logged = 0;
+
+// TODO: Put this into an app-wide settings UI
+static void stack_magicq_reliable_get_settings()
+{
+	char *env = getenv("STACK_MAGICQ_RELIABLE");
+	smqr_enabled = env != NULL && atoi(env) != 0;
+
+	env = getenv("STACK_MAGICQ_RELIABLE_TIMEOUT");
+	if (env != NULL && atoi(env) >= 1 && atoi(env) <= 10000)
+	{
+		smqr_timeout = (int64_t)atoi(env) * 1000000LL;
+	}
+
+	env = getenv("STACK_MAGICQ_RELIABLE_RETRIES");
+	if (env != NULL && atoi(env) >= 0 && atoi(env) <= 100)
+	{
+		smqr_retries = (uint32_t)atoi(env);
+	}
+}
+
+/// Returns whether reliable delivery is turned on
+bool stack_magicq_reliable_enabled()
+{
+	return smqr_enabled;
+}
+
+/// Determines whether we can tell from MagicQ's feedback that a command has
+/// taken effect, and whether it's safe to send again if we can't. Go and stop
+/// move the playback on each time they are received, so are never retransmitted
+bool stack_magicq_reliable_can_track(const StackMagicQCommand *command)
+{
+	switch (command->operation)
+	{
+		case MAGICQ_OPERATION_ACTIVATE:
+		case MAGICQ_OPERATION_RELEASE:
+		case MAGICQ_OPERATION_SET_LEVEL:
+		case MAGICQ_OPERATION_JUMP_TO_CUE_ID:
+			return command->playback <= STACK_MAGICQ_MAX_PLAYBACK;
+		default:
+			return false;
+	}
+}
+
+/// Determines whether two commands affect the same state of the same playback,
+/// so that the later one makes the earlier one irrelevant
+static bool stack_magicq_reliable_supersedes(const StackMagicQCommand *newer, const StackMagicQCommand *older)
+{
+	if (newer->playback != older->playback)
+	{
+		return false;
+	}
+
+	switch (older->operation)
+	{
+		case MAGICQ_OPERATION_ACTIVATE:
+		case MAGICQ_OPERATION_RELEASE:
+			return newer->operation == MAGICQ_OPERATION_ACTIVATE || newer->operation == MAGICQ_OPERATION_RELEASE;
+		default:
+			return newer->operation == older->operation;
+	}
+}
+
+/// Determines whether MagicQ's feedback shows that a command has taken effect
+static bool stack_magicq_reliable_is_confirmed(const StackMagicQCommand *command)
+{
+	StackMagicQPlaybackState state;
+	if (!stack_magicq_feedback_get_playback(command->playback, &state))
+	{
+		return false;
+	}
+
+	switch (command->operation)
+	{
+		case MAGICQ_OPERATION_ACTIVATE:
+			return state.active_known && state.active;
+		case MAGICQ_OPERATION_RELEASE:
+			return state.active_known && !state.active;
+		case MAGICQ_OPERATION_SET_LEVEL:
+			return state.level_known && state.level == command->level;
+		case MAGICQ_OPERATION_JUMP_TO_CUE_ID:
+			return state.cue_known && (uint32_t)llround(state.cue_id * 1000.0) == command->cue_id;
+		default:
+			return false;
+	}
+}
+
+/// Stops tracking a command, releasing its slot. Must only be called from the
+/// main loop
+static void stack_magicq_reliable_release(size_t index)
+{
+	StackMagicQTrackedCommand *tracked = &smqr_commands[index];
+	stack_magicq_metrics_unref(tracked->metrics);
+	tracked->metrics = NULL;
+	smqr_in_use[index] = false;
+	smqr_stats.pending--;
+}
+
+/// Starts tracking a command that a pulse thread asked us to, in place of any
+/// older command for the same state of the same playback. Must only be called
+/// from the main loop
+static void stack_magicq_reliable_add(StackMagicQReliableRequest *request)
+{
+	size_t free_index = STACK_MAGICQ_RELIABLE_MAX_COMMANDS;
+	for (size_t i = 0; i < STACK_MAGICQ_RELIABLE_MAX_COMMANDS; i++)
+	{
+		if (!smqr_in_use[i])
+		{
+			free_index = free_index < i ? free_index : i;
+		}
+		else if (stack_magicq_reliable_supersedes(&request->command, &smqr_commands[i].command))
+		{
+			smqr_stats.superseded++;
+			stack_magicq_reliable_release(i);
+			free_index = free_index < i ? free_index : i;
+		}
+	}
+
+	if (free_index == STACK_MAGICQ_RELIABLE_MAX_COMMANDS)
+	{
+		smqr_dropped++;
+		stack_magicq_metrics_unref(request->metrics);
+		return;
+	}
+
+	int64_t now = stack_magicq_transport_now();
+	StackMagicQTrackedCommand *tracked = &smqr_commands[free_index];
+	tracked->command = request->command;
+	tracked->source = request->source;
+	tracked->due = request->due;
+	tracked->metrics = request->metrics;
+	memcpy(tracked->element, request->element, request->element_length);
+	tracked->element_length = request->element_length;
+	tracked->attempts = 1;
+	tracked->backoff = smqr_timeout;
+	tracked->deadline = (request->due > now ? request->due : now) + smqr_timeout;
+
+	smqr_in_use[free_index] = true;
+	smqr_stats.tracked++;
+	smqr_stats.pending++;
+}
+
+/// Claims a free slot on the request queue. Returns NULL if the queue is full
+static StackMagicQReliableRequest *stack_magicq_reliable_claim(size_t *claimed_pos)
+{
+	size_t pos = smqr_enqueue_pos.load(std::memory_order_relaxed);
+	while (true)
+	{
+		StackMagicQReliableRequest *request = &smqr_queue[pos & (STACK_MAGICQ_RELIABLE_QUEUE_SIZE - 1)];
+		intptr_t diff = (intptr_t)request->sequence.load(std::memory_order_acquire) - (intptr_t)pos;
+		if (diff == 0)
+		{
+			// The slot is free: try and claim it
+			if (smqr_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+			{
+				*claimed_pos = pos;
+				return request;
+			}
+		}
+		else if (diff < 0)
+		{
+			// The main loop hasn't freed this slot yet: we're full
+			return NULL;
+		}
+		else
+		{
+			// Another producer beat us to it, try again
+			pos = smqr_enqueue_pos.load(std::memory_order_relaxed);
+		}
+	}
+}
+
+/// Starts tracking a command that has just been queued for sending, so that it
+/// is retransmitted if MagicQ's feedback doesn't confirm it in time. Any older
+/// command for the same state of the same playback is no longer tracked. This
+/// never blocks: the command is handed to the main loop through a lock-free
+/// queue, and is dropped (and counted) if that is full
+/// @param command The command (which must be trackable)
+/// @param element The encoded bundle element of the command
+/// @param source The unique ID of the cue that sent the command
+/// @param metrics The metrics of the cue (may be NULL)
+/// @param due When the command is due to be sent (transport clock), or zero if
+/// it is being sent straight away
+void stack_magicq_reliable_track(const StackMagicQCommand *command, const char *element, uint64_t source, StackMagicQMetrics *metrics, int64_t due)
+{
+	if (!smqr_enabled || !stack_magicq_reliable_can_track(command) || command->length > STACK_MAGICQ_RELIABLE_MAX_ELEMENT)
+	{
+		return;
+	}
+
+	// Leave room in the queue for requests to forget
+	size_t pos = 0;
+	StackMagicQReliableRequest *request = NULL;
+	if (smqr_queued_tracks.fetch_add(1, std::memory_order_relaxed) >= STACK_MAGICQ_RELIABLE_QUEUE_SIZE - STACK_MAGICQ_RELIABLE_QUEUE_RESERVE
+		|| (request = stack_magicq_reliable_claim(&pos)) == NULL)
+	{
+		smqr_queued_tracks.fetch_sub(1, std::memory_order_relaxed);
+		smqr_dropped++;
+		return;
+	}
+
+	// Fill the slot and publish it to the main loop
+	request->forget = false;
+	request->command = *command;
+	request->source = source;
+	request->metrics = metrics;
+	if (metrics != NULL)
+	{
+		stack_magicq_metrics_ref(metrics);
+	}
+	memcpy(request->element, element, command->length);
+	request->element_length = command->length;
+	request->due = due;
+	request->sequence.store(pos + 1, std::memory_order_release);
+}
+
+/// Stops tracking the commands sent by a cue (e.g. because they were cancelled
+/// before they were sent, or the cue has been deleted). Like tracking, this goes
+/// through the queue to the main loop, so that it is always seen after the
+/// commands it forgets
+/// @param source The unique ID of the cue
+/// @param due Only forget the commands that were due at this time (transport
+/// clock), so that anything the cue has sent since is still tracked, or zero
+/// to forget everything the cue has sent
+void stack_magicq_reliable_forget(uint64_t source, int64_t due)
+{
+	if (!smqr_enabled)
+	{
+		return;
+	}
+
+	size_t pos = 0;
+	StackMagicQReliableRequest *request = stack_magicq_reliable_claim(&pos);
+	if (request == NULL)
+	{
+		stack_log("stack_magicq_reliable_forget(): Request queue full, commands may be retransmitted after being cancelled\n");
+		return;
+	}
+
+	request->forget = true;
+	request->source = source;
+	request->due = due;
+	request->metrics = NULL;
+	request->sequence.store(pos + 1, std::memory_order_release);
+}
+
+/// Acts on every request the pulse threads have queued. Must only be called
+/// from the main loop
+static void stack_magicq_reliable_process_requests()
+{
+	while (true)
+	{
+		size_t pos = smqr_dequeue_pos;
+		StackMagicQReliableRequest *request = &smqr_queue[pos & (STACK_MAGICQ_RELIABLE_QUEUE_SIZE - 1)];
+
+		// If the producer hasn't finished with this slot yet, we're empty
+		if (request->sequence.load(std::memory_order_acquire) != pos + 1)
+		{
+			break;
+		}
+
+		if (request->forget)
+		{
+			for (size_t i = 0; i < STACK_MAGICQ_RELIABLE_MAX_COMMANDS; i++)
+			{
+				if (smqr_in_use[i] && smqr_commands[i].source == request->source && (request->due == 0 || smqr_commands[i].due == request->due))
+				{
+					stack_magicq_reliable_release(i);
+				}
+			}
+		}
+		else
+		{
+			// The tracked command takes over the request's metrics reference
+			stack_magicq_reliable_add(request);
+			request->metrics = NULL;
+			smqr_queued_tracks.fetch_sub(1, std::memory_order_relaxed);
+		}
+
+		// Hand the slot back to the producers for the next lap of the ring
+		request->sequence.store(pos + STACK_MAGICQ_RELIABLE_QUEUE_SIZE, std::memory_order_release);
+		smqr_dequeue_pos = pos + 1;
+	}
+
+	uint64_t dropped = smqr_dropped.load(std::memory_order_relaxed);
+	if (dropped != smqr_dropped_logged)
+	{
+		stack_log("stack_magicq_reliable_check(): Too many unconfirmed commands, %lu not tracked\n", dropped - smqr_dropped_logged);
+		smqr_dropped_logged = dropped;
+	}
+}
+
+/// Called periodically from the main loop to pick up newly sent commands,
+/// confirm commands from MagicQ's feedback, and retransmit (backing off each
+/// time) any that are overdue
+static gboolean stack_magicq_reliable_check(gpointer user_data)
+{
+	stack_magicq_reliable_process_requests();
+	if (smqr_stats.pending == 0)
+	{
+		return G_SOURCE_CONTINUE;
+	}
+
+	int64_t now = stack_magicq_transport_now();
+	for (size_t i = 0; i < STACK_MAGICQ_RELIABLE_MAX_COMMANDS; i++)
+	{
+		if (!smqr_in_use[i])
+		{
+			continue;
+		}
+
+		StackMagicQTrackedCommand *tracked = &smqr_commands[i];
+		if (stack_magicq_reliable_is_confirmed(&tracked->command))
+		{
+			smqr_stats.confirmed++;
+			stack_magicq_metrics_record_delivery(tracked->metrics, true);
+			stack_magicq_reliable_release(i);
+		}
+		else if (now >= tracked->deadline)
+		{
+			if (tracked->attempts > smqr_retries)
+			{
+				smqr_stats.failed++;
+				stack_magicq_metrics_record_delivery(tracked->metrics, false);
+				stack_log("stack_magicq_reliable_check(): Operation %d on playback %u was not confirmed after %u attempts\n", tracked->command.operation, tracked->command.playback, tracked->attempts);
+				stack_magicq_reliable_release(i);
+				continue;
+			}
+
+			// Send it again, and wait longer next time
+			StackMagicQPlaybackSet playbacks;
+			stack_magicq_playback_set_clear(&playbacks);
+			stack_magicq_playback_set_add(&playbacks, tracked->command.playback);
+			stack_magicq_transport_enqueue(smqr_transport, tracked->element, tracked->element_length, tracked->source, tracked->metrics, 0, STACK_MAGICQ_PRIORITY_CONTROL, 0, &playbacks);
+			stack_magicq_metrics_record_retransmit(tracked->metrics);
+			smqr_stats.retransmits++;
+			tracked->attempts++;
+			tracked->backoff = tracked->backoff * 2 < smqr_max_backoff ? tracked->backoff * 2 : smqr_max_backoff;
+			tracked->deadline = now + tracked->backoff;
+		}
+	}
+
+	return G_SOURCE_CONTINUE;
+}
+
+/// Gets a snapshot of the reliable delivery counters. Must only be called from
+/// the main loop
+void stack_magicq_reliable_get_stats(StackMagicQReliableStats *stats)
+{
+	*stats = smqr_stats;
+	stats->dropped = smqr_dropped.load(std::memory_order_relaxed);
+}
+
+/// Sets up reliable delivery, if it is configured. Confirmation comes from
+/// MagicQ's feedback, so this must be called after stack_magicq_feedback_init()
+/// and, like it, from the main thread
+void stack_magicq_reliable_init()
+{
+	stack_magicq_reliable_get_settings();
+	memset(&smqr_stats, 0, sizeof(smqr_stats));
+	for (size_t i = 0; i < STACK_MAGICQ_RELIABLE_MAX_COMMANDS; i++)
+	{
+		smqr_in_use[i] = false;
+		smqr_commands[i].metrics = NULL;
+	}
+	for (size_t i = 0; i < STACK_MAGICQ_RELIABLE_QUEUE_SIZE; i++)
+	{
+		smqr_queue[i].sequence.store(i, std::memory_order_relaxed);
+		smqr_queue[i].metrics = NULL;
+	}
+	smqr_enqueue_pos = 0;
+	smqr_dequeue_pos = 0;
+	smqr_queued_tracks = 0;
+	smqr_dropped = 0;
+	smqr_dropped_logged = 0;
+
+	if (!smqr_enabled)
+	{
+		return;
+	}
+
+	if (!stack_magicq_feedback_enabled())
+	{
+		stack_log("stack_magicq_reliable_init(): Reliable delivery needs MagicQ feedback (STACK_MAGICQ_OSC_FEEDBACK_PORT), disabling\n");
+		smqr_enabled = false;
+		return;
+	}
+
+	smqr_transport = stack_magicq_transport_ref();
+	g_timeout_add(10, stack_magicq_reliable_check, NULL);
+	stack_log("stack_magicq_reliable_init(): Confirming commands within %ldms, retransmitting up to %u times\n", smqr_timeout / 1000000, smqr_retries);
+}
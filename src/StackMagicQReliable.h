@@ -0,0 +1,114 @@
+#ifndef _STACKMAGICQRELIABLE_H_INCLUDED
+#define _STACKMAGICQRELIABLE_H_INCLUDED
+
+// Includes:
+#include "StackMagicQCommand.h"
+#include "StackMagicQMetrics.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Defines:
+// The most commands that can be waiting for confirmation at once
+#define STACK_MAGICQ_RELIABLE_MAX_COMMANDS 256
+
+// The largest encoded command (bundle element) we keep for retransmission
+#define STACK_MAGICQ_RELIABLE_MAX_ELEMENT 128
+
+// The number of requests that can be waiting for the main loop to pick them up
+// (must be a power of two)
+#define STACK_MAGICQ_RELIABLE_QUEUE_SIZE 512
+
+// How many of those can only be used to forget commands, so that a burst of
+// new commands can't stop a cancelled one from being forgotten
+#define STACK_MAGICQ_RELIABLE_QUEUE_RESERVE 64
+
+// A request to start tracking a command, or to forget the commands of a cue,
+// waiting for the main loop. The pulse threads hand these over through a
+// lock-free ring (in the same way as the transport's send queue) so that they
+// never wait for the main loop
+struct StackMagicQReliableRequest
+{
+	// Sequence number used to hand the slot between producers and the consumer
+	std::atomic<size_t> sequence;
+
+	// If set, the request is to forget every command from the source that
+	// was due at the given time (or every command from the source, if the
+	// due time is zero), and the rest of the request is unused
+	bool forget;
+
+	// The command, and the cue that sent it
+	StackMagicQCommand command;
+	uint64_t source;
+
+	// The metrics of the cue that sent it (the request holds a reference)
+	StackMagicQMetrics *metrics;
+
+	// The encoded bundle element, to retransmit
+	char element[STACK_MAGICQ_RELIABLE_MAX_ELEMENT];
+	size_t element_length;
+
+	// When the command is due to be sent (transport clock), or zero
+	int64_t due;
+};
+
+// A command that has been sent and is waiting for MagicQ's feedback to confirm
+// that it has taken effect. These are only ever touched by the main loop
+struct StackMagicQTrackedCommand
+{
+	// The command, the cue that sent it, and when it was due to be sent
+	// (transport clock, or zero if it was sent straight away)
+	StackMagicQCommand command;
+	uint64_t source;
+	int64_t due;
+
+	// The metrics of the cue that sent it (we hold a reference)
+	StackMagicQMetrics *metrics;
+
+	// The encoded bundle element, to retransmit
+	char element[STACK_MAGICQ_RELIABLE_MAX_ELEMENT];
+	size_t element_length;
+
+	// How many times the command has been sent, and when (transport clock,
+	// nanoseconds) it will next be retransmitted if it hasn't been confirmed
+	uint32_t attempts;
+	int64_t backoff;
+	int64_t deadline;
+};
+
+// Counters for reliable delivery
+struct StackMagicQReliableStats
+{
+	// Number of commands tracked, confirmed, and given up on
+	uint64_t tracked;
+	uint64_t confirmed;
+	uint64_t failed;
+
+	// Number of retransmissions
+	uint64_t retransmits;
+
+	// Number of tracked commands replaced by a newer command for the same
+	// playback before being confirmed
+	uint64_t superseded;
+
+	// Number of commands that weren't tracked because too many were already
+	// waiting (either for the main loop, or for confirmation)
+	uint64_t dropped;
+
+	// Number of commands currently waiting for confirmation
+	size_t pending;
+};
+
+// Functions: Reliable delivery lifecycle
+void stack_magicq_reliable_init();
+bool stack_magicq_reliable_enabled();
+
+// Functions: Tracking commands
+bool stack_magicq_reliable_can_track(const StackMagicQCommand *command);
+void stack_magicq_reliable_track(const StackMagicQCommand *command, const char *element, uint64_t source, StackMagicQMetrics *metrics, int64_t due);
+void stack_magicq_reliable_forget(uint64_t source, int64_t due);
+
+// Functions: Statistics
+void stack_magicq_reliable_get_stats(StackMagicQReliableStats *stats);
+
+#endif
@@ -0,0 +1,1188 @@
+// Includes:
+#include "StackLog.h"
+#include "StackMagicQTransport.h"
+#include "StackMagicQCapture.h"
+#include "StackMagicQCREP.h"
+#include "StackMagicQLedger.h"
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <ctime>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+
+// Global: The one and only transport instance
+static StackMagicQTransport *smq_transport = NULL;
+
+// Global: Protects creation and destruction of smq_transport
+static std::mutex smq_transport_mutex;
+
+// TODO: Put this into an app-wide settings UI
+static StackMagicQProtocol stack_magicq_transport_get_protocol()
+{
+	char *env = getenv("STACK_MAGICQ_PROTOCOL");
+	if (env != NULL && strcmp(env, "crep") == 0)
+	{
+		return STACK_MAGICQ_PROTOCOL_CREP;
+	}
+
+	return STACK_MAGICQ_PROTOCOL_OSC;
+}
+
+// TODO: Put this into an app-wide settings UI
+static uint16_t stack_magicq_transport_get_port(StackMagicQProtocol protocol)
+{
+	char *env = getenv(protocol == STACK_MAGICQ_PROTOCOL_CREP ? "STACK_MAGICQ_CREP_PORT" : "STACK_MAGICQ_OSC_PORT");
+	if (env != NULL)
+	{
+		int port = atoi(env);
+		if (port >= 1 && port <= 65535)
+		{
+			return (uint16_t)port;
+		}
+	}
+
+	return protocol == STACK_MAGICQ_PROTOCOL_CREP ? STACK_MAGICQ_CREP_PORT : 8000;
+}
+
+// TODO: Put this into an app-wide settings UI
+static bool stack_magicq_transport_get_bundle_mode()
+{
+	char *env = getenv("STACK_MAGICQ_OSC_BUNDLE");
+	return env != NULL && atoi(env) != 0;
+}
+
+// TODO: Put this into an app-wide settings UI
+static bool stack_magicq_transport_get_timetag_mode()
+{
+	char *env = getenv("STACK_MAGICQ_OSC_TIMETAGS");
+	return env != NULL && atoi(env) != 0;
+}
+
+// TODO: Put this into an app-wide settings UI
+static void stack_magicq_transport_get_rate_limit(StackMagicQTransport *transport)
+{
+	// The most datagrams per second to send (zero, the default, for no limit)
+	transport->rate_limit = 0.0;
+	char *env = getenv("STACK_MAGICQ_RATE_LIMIT");
+	if (env != NULL && atoi(env) > 0)
+	{
+		transport->rate_limit = (double)atoi(env);
+	}
+
+	// How many datagrams can be sent at once after a quiet spell. Defaults to
+	// a tenth of a second's worth
+	transport->rate_burst = transport->rate_limit / 10.0;
+	env = getenv("STACK_MAGICQ_RATE_BURST");
+	if (env != NULL && atoi(env) > 0)
+	{
+		transport->rate_burst = (double)atoi(env);
+	}
+	if (transport->rate_burst < 1.0)
+	{
+		transport->rate_burst = 1.0;
+	}
+
+	transport->tokens = transport->rate_burst;
+	transport->last_refill = 0;
+}
+
+/// Parses a single destination of the form "host[:port]", where host is either
+/// an IPv4 address (unicast or multicast) or a hostname
+static bool stack_magicq_transport_parse_destination(const char *text, uint16_t default_port, struct sockaddr_in *address)
+{
+	char host[256];
+	strncpy(host, text, sizeof(host) - 1);
+	host[sizeof(host) - 1] = '\0';
+
+	// Split off the port, if there is one
+	uint16_t port = default_port;
+	char *colon = strrchr(host, ':');
+	if (colon != NULL)
+	{
+		*colon = '\0';
+		int parsed_port = atoi(colon + 1);
+		if (parsed_port < 1 || parsed_port > 65535)
+		{
+			return false;
+		}
+		port = (uint16_t)parsed_port;
+	}
+
+	// Resolve the host (once, here, rather than on every send)
+	struct addrinfo hints, *result = NULL;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_DGRAM;
+	if (getaddrinfo(host, NULL, &hints, &result) != 0 || result == NULL)
+	{
+		return false;
+	}
+
+	memcpy(address, result->ai_addr, sizeof(struct sockaddr_in));
+	address->sin_port = htons(port);
+	freeaddrinfo(result);
+
+	return true;
+}
+
+// TODO: Put this into an app-wide settings UI
+static void stack_magicq_transport_get_destinations(StackMagicQTransport *transport)
+{
+	transport->destination_count = 0;
+
+	// A comma-separated list of host[:port] destinations
+	char *env = getenv("STACK_MAGICQ_DESTINATIONS");
+	if (env != NULL)
+	{
+		char *list = strdup(env);
+		char *saveptr = NULL;
+		for (char *item = strtok_r(list, ", ", &saveptr); item != NULL; item = strtok_r(NULL, ", ", &saveptr))
+		{
+			if (transport->destination_count == STACK_MAGICQ_MAX_DESTINATIONS)
+			{
+				stack_log("stack_magicq_transport_get_destinations(): Too many destinations, ignoring '%s'\n", item);
+				continue;
+			}
+
+			StackMagicQDestination *destination = &transport->destinations[transport->destination_count];
+			if (stack_magicq_transport_parse_destination(item, transport->port, &destination->address))
+			{
+				transport->destination_count++;
+			}
+			else
+			{
+				stack_log("stack_magicq_transport_get_destinations(): Invalid destination '%s'\n", item);
+			}
+		}
+		free(list);
+	}
+
+	// Default to MagicQ on the local host
+	if (transport->destination_count == 0)
+	{
+		StackMagicQDestination *destination = &transport->destinations[0];
+		memset(&destination->address, 0, sizeof(destination->address));
+		destination->address.sin_family = AF_INET;
+		destination->address.sin_port = htons(transport->port);
+		destination->address.sin_addr.s_addr = htonl(0x7f000001);
+		transport->destination_count = 1;
+	}
+
+	for (size_t i = 0; i < transport->destination_count; i++)
+	{
+		transport->destinations[i].healthy = true;
+		transport->destinations[i].consecutive_errors = 0;
+		transport->destinations[i].consecutive_successes = 0;
+		transport->destinations[i].errors_when_unhealthy = 0;
+		transport->destinations[i].sent = 0;
+		transport->destinations[i].send_errors = 0;
+		transport->destinations[i].sock = 0;
+		transport->destinations[i].backoff = 0;
+		transport->destinations[i].next_attempt = 0;
+	}
+}
+
+/// Gets the current time from the steady (monotonic) clock, in nanoseconds.
+/// This is the clock that due times are given in
+int64_t stack_magicq_transport_now()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (int64_t)now.tv_sec * 1000000000LL + (int64_t)now.tv_nsec;
+}
+
+/// Converts a steady clock time to an OSC (NTP format) timetag, written in
+/// network byte order
+static void stack_magicq_transport_get_timetag(int64_t due, char *timetag)
+{
+	// Work out the wall-clock time that the steady clock time corresponds to
+	struct timespec realtime;
+	clock_gettime(CLOCK_REALTIME, &realtime);
+	int64_t wall = (int64_t)realtime.tv_sec * 1000000000LL + (int64_t)realtime.tv_nsec + (due - stack_magicq_transport_now());
+
+	// NTP time counts seconds from 1900 rather than 1970, with a 32-bit
+	// binary fraction
+	uint32_t seconds = htonl((uint32_t)(wall / 1000000000LL + 2208988800LL));
+	uint32_t fraction = htonl((uint32_t)(((uint64_t)(wall % 1000000000LL) << 32) / 1000000000ULL));
+	memcpy(&timetag[0], &seconds, 4);
+	memcpy(&timetag[4], &fraction, 4);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// SOCKET HANDLING (SENDER THREAD ONLY, ONCE STARTED)
+
+/// Creates a UDP socket connected to a destination, so that the route lookup
+/// happens once, here, rather than on every send. Returns false (and schedules
+/// another attempt, backing off each time) if this fails
+static bool stack_magicq_transport_connect_destination(StackMagicQDestination *destination, int64_t now)
+{
+	// Don't do anything if we've already got a socket
+	if (destination->sock > 0)
+	{
+		return true;
+	}
+
+	// Don't retry until the backoff has expired
+	if (now < destination->next_attempt)
+	{
+		return false;
+	}
+
+	char address[INET_ADDRSTRLEN];
+	inet_ntop(AF_INET, &destination->address.sin_addr, address, sizeof(address));
+	stack_log("stack_magicq_transport_connect_destination(): Connecting to %s:%u\n", address, ntohs(destination->address.sin_port));
+
+	// Create our UDP socket. We don't bind it: connect() picks an ephemeral
+	// local port, and binding to the OSC port would clash with MagicQ if it is
+	// on the same machine
+	int sock = socket(PF_INET, SOCK_DGRAM, 0);
+	if (sock <= 0)
+	{
+		stack_log("stack_magicq_transport_connect_destination(): Failed to create socket (%d)\n", errno);
+	}
+	else
+	{
+		// Keep multicast on the local network
+		int ttl = 1;
+		setsockopt(sock, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+
+		if (connect(sock, (struct sockaddr *)&destination->address, sizeof(destination->address)) == 0)
+		{
+			destination->sock = sock;
+			destination->backoff = 0;
+			stack_magicq_metrics_record_reestablishment();
+			return true;
+		}
+
+		stack_log("stack_magicq_transport_connect_destination(): Failed to connect to %s:%u (%d)\n", address, ntohs(destination->address.sin_port), errno);
+		close(sock);
+	}
+
+	// Back off before trying again
+	destination->backoff = destination->backoff == 0 ? STACK_MAGICQ_RECONNECT_MIN_BACKOFF : destination->backoff * 2;
+	if (destination->backoff > STACK_MAGICQ_RECONNECT_MAX_BACKOFF)
+	{
+		destination->backoff = STACK_MAGICQ_RECONNECT_MAX_BACKOFF;
+	}
+	destination->next_attempt = now + destination->backoff;
+
+	return false;
+}
+
+/// Closes the socket of a destination so that it will be reconnected
+static void stack_magicq_transport_disconnect_destination(StackMagicQDestination *destination)
+{
+	if (destination->sock > 0)
+	{
+		close(destination->sock);
+		destination->sock = 0;
+	}
+}
+
+/// Connects any destinations that aren't connected and whose backoff has
+/// expired. Returns true if every destination is connected
+static bool stack_magicq_transport_connect_destinations(StackMagicQTransport *transport)
+{
+	int64_t now = stack_magicq_transport_now();
+	bool all_connected = true;
+	for (size_t i = 0; i < transport->destination_count; i++)
+	{
+		if (!stack_magicq_transport_connect_destination(&transport->destinations[i], now))
+		{
+			all_connected = false;
+		}
+	}
+
+	return all_connected;
+}
+
+/// Updates the counters for a destination after an attempt to send to it, and
+/// logs when the destination becomes unhealthy (with the error that made it so,
+/// zero if it isn't connected) or recovers. Failures in between are only
+/// counted, so that a console that is switched off doesn't flood the log
+static void stack_magicq_transport_destination_result(StackMagicQTransport *transport, StackMagicQDestination *destination, bool success, int error)
+{
+	char address[INET_ADDRSTRLEN];
+	if (success)
+	{
+		destination->sent++;
+		destination->consecutive_errors = 0;
+		destination->consecutive_successes++;
+		transport->sent++;
+
+		if (!destination->healthy && destination->consecutive_successes >= STACK_MAGICQ_DESTINATION_RECOVERY_SENDS)
+		{
+			destination->healthy = true;
+			inet_ntop(AF_INET, &destination->address.sin_addr, address, sizeof(address));
+			stack_log("stack_magicq_transport_destination_result(): %s:%u is healthy again after %lu failed sends\n", address, ntohs(destination->address.sin_port), destination->send_errors.load() - destination->errors_when_unhealthy);
+		}
+	}
+	else
+	{
+		destination->send_errors++;
+		destination->consecutive_errors++;
+		destination->consecutive_successes = 0;
+		transport->send_errors++;
+
+		if (destination->healthy)
+		{
+			destination->healthy = false;
+			destination->errors_when_unhealthy = destination->send_errors - 1;
+			inet_ntop(AF_INET, &destination->address.sin_addr, address, sizeof(address));
+			stack_log("stack_magicq_transport_destination_result(): %s:%u is unhealthy (%d)\n", address, ntohs(destination->address.sin_port), error);
+		}
+	}
+}
+
+/// Sends a single datagram, made up of one or more pieces, to every destination.
+/// The sockets are never allowed to block, so a destination that is failing
+/// does not hold up the others
+static void stack_magicq_transport_send_datagram(StackMagicQTransport *transport, struct iovec *iov, size_t iov_count, StackMagicQQueueSlot *slot)
+{
+	size_t bytes = 0;
+	for (size_t i = 0; i < iov_count; i++)
+	{
+		bytes += iov[i].iov_len;
+	}
+
+	// Capture what we're about to send (if capture is enabled)
+	if (stack_magicq_capture_enabled())
+	{
+		for (size_t i = 0; i < transport->destination_count; i++)
+		{
+			stack_magicq_capture_write(STACK_MAGICQ_CAPTURE_OUTGOING, slot->source, &transport->destinations[i].address, iov, iov_count);
+		}
+	}
+
+	// The sockets are connected, so there's no address to give
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = iov_count;
+
+	int64_t now = stack_magicq_transport_now();
+	bool any_ok = false, primary_ok = false;
+	for (size_t i = 0; i < transport->destination_count; i++)
+	{
+		StackMagicQDestination *destination = &transport->destinations[i];
+
+		// If the destination is down, it's reconnected in the background
+		if (destination->sock <= 0 && !stack_magicq_transport_connect_destination(destination, now))
+		{
+			stack_magicq_transport_destination_result(transport, destination, false, 0);
+			continue;
+		}
+
+		ssize_t s = sendmsg(destination->sock, &msg, MSG_DONTWAIT);
+		if (s < 0)
+		{
+			int error = errno;
+
+			// Nobody listening, or a momentarily full buffer, don't need a new
+			// socket. Anything else might (e.g. the route has changed), so
+			// reconnect
+			if (error != ECONNREFUSED && error != EAGAIN && error != EWOULDBLOCK && error != ENOBUFS)
+			{
+				stack_magicq_transport_disconnect_destination(destination);
+			}
+
+			stack_magicq_transport_destination_result(transport, destination, false, error);
+		}
+		else
+		{
+			stack_magicq_transport_destination_result(transport, destination, true, 0);
+			any_ok = true;
+			primary_ok = primary_ok || i == 0;
+		}
+	}
+
+	// The metrics count datagrams rather than sends, so that a cue's counters
+	// don't depend on how many destinations there are. How each destination
+	// is faring is kept by destination_result
+	stack_magicq_metrics_record_send(slot->metrics, bytes, any_ok);
+
+	// The ledger already holds what this datagram was meant to change, so if
+	// the primary console didn't get it, those playbacks must not be used to
+	// suppress the next command. A backup or visualiser that is switched off
+	// doesn't matter
+	if (!primary_ok)
+	{
+		stack_magicq_ledger_forget_playbacks(&slot->playbacks);
+	}
+}
+
+/// Sends the set of bundle elements in a queue slot to MagicQ, either as a
+/// single bundle or as a datagram per message, depending on the transport
+/// configuration
+static void stack_magicq_transport_send_elements(StackMagicQTransport *transport, StackMagicQQueueSlot *slot)
+{
+	char *elements = slot->data;
+	size_t length = slot->length;
+
+	if (transport->bundle)
+	{
+		// An OSC bundle with a timetag of 1, which means "immediately", unless
+		// we're leaving MagicQ to apply the bundle at its due time
+		char bundle_header[STACK_MAGICQ_BUNDLE_HEADER_SIZE] = {
+			'#', 'b', 'u', 'n', 'd', 'l', 'e', '\0',
+			0, 0, 0, 0, 0, 0, 0, 1
+		};
+		if (transport->timetags && slot->due > 0)
+		{
+			stack_magicq_transport_get_timetag(slot->due, &bundle_header[8]);
+		}
+
+		struct iovec iov[2];
+		iov[0].iov_base = bundle_header;
+		iov[0].iov_len = STACK_MAGICQ_BUNDLE_HEADER_SIZE;
+		iov[1].iov_base = elements;
+		iov[1].iov_len = length;
+
+		stack_magicq_transport_send_datagram(transport, iov, 2, slot);
+		return;
+	}
+
+	// Send each element's message as a datagram of its own
+	size_t offset = 0;
+	while (offset + 4 <= length)
+	{
+		uint32_t element_size;
+		memcpy(&element_size, &elements[offset], 4);
+		element_size = ntohl(element_size);
+		offset += 4;
+
+		if (offset + element_size > length)
+		{
+			stack_log("stack_magicq_transport_send_elements(): Truncated bundle element\n");
+			break;
+		}
+
+		// Number CREP packets in the order they go out
+		if (transport->protocol == STACK_MAGICQ_PROTOCOL_CREP && element_size >= STACK_MAGICQ_CREP_HEADER_SIZE)
+		{
+			elements[offset + STACK_MAGICQ_CREP_SEQUENCE_OFFSET] = (char)transport->crep_sequence++;
+		}
+
+		struct iovec iov;
+		iov.iov_base = &elements[offset];
+		iov.iov_len = element_size;
+		stack_magicq_transport_send_datagram(transport, &iov, 1, slot);
+
+		offset += element_size;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// SEND QUEUE
+
+/// Sends the message set in a queue slot (or a scheduled slot) and records how
+/// long it took to get from the cue to the kernel. Must only be called from the
+/// sender thread
+static void stack_magicq_transport_send_slot(StackMagicQTransport *transport, StackMagicQQueueSlot *slot)
+{
+	stack_magicq_transport_send_elements(transport, slot);
+
+	// A message set that was held back on purpose is timed from when it was
+	// due, which is also how late it was. Only this thread writes the maximums,
+	// so a plain compare is fine. The first latency is kept separately so it
+	// can be compared with the rest
+	int64_t now = stack_magicq_transport_now();
+	int64_t latency = now - slot->enqueue_time;
+	if (slot->due > 0 && !transport->timetags)
+	{
+		latency = slot->due > slot->enqueue_time ? now - slot->due : latency;
+		transport->scheduled_sent++;
+		transport->total_schedule_error += latency;
+		if (latency > transport->max_schedule_error)
+		{
+			transport->max_schedule_error = latency;
+		}
+	}
+
+	if (transport->sets_sent == 0)
+	{
+		transport->first_latency = latency;
+	}
+	transport->sets_sent++;
+	transport->last_latency = latency;
+	transport->total_latency += latency;
+	if (latency > transport->max_latency)
+	{
+		transport->max_latency = latency;
+	}
+	stack_magicq_metrics_record_latency(slot->metrics, latency / 1000);
+	stack_magicq_metrics_unref(slot->metrics);
+	slot->metrics = NULL;
+}
+
+/// Moves a message set from one slot to another, along with its reference to
+/// the metrics
+static void stack_magicq_transport_move_slot(StackMagicQQueueSlot *to, StackMagicQQueueSlot *from)
+{
+	memcpy(to->data, from->data, from->length);
+	to->length = from->length;
+	to->enqueue_time = from->enqueue_time;
+	to->due = from->due;
+	to->cancel = from->cancel;
+	to->priority = from->priority;
+	to->collapse_key = from->collapse_key;
+	to->source = from->source;
+	to->playbacks = from->playbacks;
+	to->metrics = from->metrics;
+	from->metrics = NULL;
+}
+
+/// Holds back a message set from the queue until its due time. Returns false
+/// if there is no room to hold it. Must only be called from the sender thread
+static bool stack_magicq_transport_schedule(StackMagicQTransport *transport, StackMagicQQueueSlot *slot)
+{
+	if (transport->scheduled_count == STACK_MAGICQ_MAX_SCHEDULED)
+	{
+		return false;
+	}
+
+	stack_magicq_transport_move_slot(&transport->scheduled[transport->scheduled_count++], slot);
+	return true;
+}
+
+/// Removes a held-back message set, keeping the rest packed at the start of
+/// the array. Must only be called from the sender thread
+static void stack_magicq_transport_unschedule(StackMagicQTransport *transport, size_t index)
+{
+	StackMagicQQueueSlot *last = &transport->scheduled[--transport->scheduled_count];
+	if (&transport->scheduled[index] != last)
+	{
+		stack_magicq_transport_move_slot(&transport->scheduled[index], last);
+	}
+	last->metrics = NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// RATE LIMITING (SENDER THREAD ONLY)
+
+/// Counts the datagrams that a message set will be sent as
+static size_t stack_magicq_transport_count_datagrams(StackMagicQTransport *transport, StackMagicQQueueSlot *slot)
+{
+	if (transport->bundle)
+	{
+		return 1;
+	}
+
+	size_t count = 0, offset = 0;
+	while (offset + 4 <= slot->length)
+	{
+		uint32_t element_size;
+		memcpy(&element_size, &slot->data[offset], 4);
+		offset += 4 + ntohl(element_size);
+		count++;
+	}
+
+	return count;
+}
+
+/// Hands a message set to the rate limiter, or sends it straight away if the
+/// rate isn't limited. A level change replaces any waiting level change for
+/// the same playbacks. Returns false if there's no room for it to wait
+static bool stack_magicq_transport_submit(StackMagicQTransport *transport, StackMagicQQueueSlot *slot)
+{
+	if (transport->rate_limit <= 0.0)
+	{
+		stack_magicq_transport_send_slot(transport, slot);
+		return true;
+	}
+
+	StackMagicQPendingQueue *queue = &transport->pending[slot->priority];
+
+	// Replace an older level for the same playbacks, keeping its place in
+	// the queue
+	if (slot->collapse_key != 0)
+	{
+		for (size_t i = 0; i < queue->count; i++)
+		{
+			StackMagicQQueueSlot *pending = &queue->slots[(queue->head + i) % STACK_MAGICQ_MAX_PENDING];
+			if (pending->collapse_key == slot->collapse_key)
+			{
+				stack_magicq_metrics_unref(pending->metrics);
+				stack_magicq_transport_move_slot(pending, slot);
+				transport->collapsed++;
+				return true;
+			}
+		}
+	}
+
+	if (queue->count == STACK_MAGICQ_MAX_PENDING)
+	{
+		return false;
+	}
+
+	// It's going to have to wait if there's anything as or more important
+	// already waiting, or if we're out of tokens
+	bool waiting = transport->tokens < 1.0;
+	for (size_t priority = 0; priority <= (size_t)slot->priority; priority++)
+	{
+		waiting = waiting || transport->pending[priority].count > 0;
+	}
+	if (waiting)
+	{
+		transport->delayed++;
+	}
+
+	stack_magicq_transport_move_slot(&queue->slots[(queue->head + queue->count) % STACK_MAGICQ_MAX_PENDING], slot);
+	queue->count++;
+
+	return true;
+}
+
+/// Sends as many waiting message sets as the rate limit allows, most important
+/// first. Returns when the next one can be sent, or zero if nothing is waiting
+static int64_t stack_magicq_transport_send_pending(StackMagicQTransport *transport)
+{
+	if (transport->rate_limit <= 0.0)
+	{
+		return 0;
+	}
+
+	// Top up the bucket for the time that has passed
+	int64_t now = stack_magicq_transport_now();
+	transport->tokens += (double)(now - transport->last_refill) * transport->rate_limit / 1e9;
+	if (transport->tokens > transport->rate_burst)
+	{
+		transport->tokens = transport->rate_burst;
+	}
+	transport->last_refill = now;
+
+	for (size_t priority = 0; priority < STACK_MAGICQ_PRIORITY_COUNT; priority++)
+	{
+		StackMagicQPendingQueue *queue = &transport->pending[priority];
+		while (queue->count > 0)
+		{
+			// Wait until there's a whole token. A message set that is sent as
+			// several datagrams may take the bucket below zero, so that it
+			// can't be held back forever
+			if (transport->tokens < 1.0)
+			{
+				return now + (int64_t)((1.0 - transport->tokens) * 1e9 / transport->rate_limit) + 1;
+			}
+
+			StackMagicQQueueSlot *slot = &queue->slots[queue->head];
+			transport->tokens -= (double)stack_magicq_transport_count_datagrams(transport, slot);
+			stack_magicq_transport_send_slot(transport, slot);
+			queue->head = (queue->head + 1) % STACK_MAGICQ_MAX_PENDING;
+			queue->count--;
+		}
+	}
+
+	return 0;
+}
+
+/// Drops any held-back message sets from the given source, returning how many
+/// were dropped. Must only be called from the sender thread
+static size_t stack_magicq_transport_cancel_scheduled(StackMagicQTransport *transport, uint64_t source)
+{
+	size_t i = 0, recalled = 0;
+	while (i < transport->scheduled_count)
+	{
+		if (transport->scheduled[i].source == source)
+		{
+			stack_magicq_metrics_unref(transport->scheduled[i].metrics);
+			transport->scheduled[i].metrics = NULL;
+			stack_magicq_transport_unschedule(transport, i);
+			transport->cancelled++;
+			recalled++;
+		}
+		else
+		{
+			i++;
+		}
+	}
+
+	return recalled;
+}
+
+/// Sends (or hands to the rate limiter) any held-back message sets whose time
+/// has come. Returns the due time
+/// of the next one still waiting, or zero if there are none. Must only be
+/// called from the sender thread
+static int64_t stack_magicq_transport_send_scheduled(StackMagicQTransport *transport)
+{
+	int64_t now = stack_magicq_transport_now();
+	int64_t next_due = 0;
+
+	size_t i = 0;
+	while (i < transport->scheduled_count)
+	{
+		StackMagicQQueueSlot *scheduled = &transport->scheduled[i];
+		if (scheduled->due <= now && stack_magicq_transport_submit(transport, scheduled))
+		{
+			stack_magicq_transport_unschedule(transport, i);
+		}
+		else if (scheduled->due <= now)
+		{
+			// The rate limiter is full, so try again once it has room
+			i++;
+		}
+		else
+		{
+			if (next_due == 0 || scheduled->due < next_due)
+			{
+				next_due = scheduled->due;
+			}
+			i++;
+		}
+	}
+
+	return next_due;
+}
+
+/// Takes the next message set off the queue and either sends it (via the rate
+/// limiter), holds it back until its due time, or acts on it if it is a
+/// cancellation. Returns false if the queue was empty, or if the rate limiter
+/// has no room for the message set (which is then left on the queue). Must
+/// only be called from the sender thread
+static bool stack_magicq_transport_dequeue(StackMagicQTransport *transport)
+{
+	size_t pos = transport->dequeue_pos;
+	StackMagicQQueueSlot *slot = &transport->queue[pos & (STACK_MAGICQ_QUEUE_SIZE - 1)];
+
+	// If the producer hasn't finished with this slot yet, we're empty
+	if (slot->sequence.load(std::memory_order_acquire) != pos + 1)
+	{
+		return false;
+	}
+
+	if (slot->cancel)
+	{
+		// Only this thread knows whether anything was still held back, so it
+		// tells the cue that asked
+		stack_magicq_metrics_record_cancel(slot->metrics, stack_magicq_transport_cancel_scheduled(transport, slot->source));
+		stack_magicq_metrics_unref(slot->metrics);
+		slot->metrics = NULL;
+	}
+	else
+	{
+		// When using timetags MagicQ does the waiting for us. If we've run out
+		// of room to hold things back, sending early beats not sending
+		bool hold = slot->due > 0 && !transport->timetags && slot->due > stack_magicq_transport_now();
+		if ((!hold || !stack_magicq_transport_schedule(transport, slot)) && !stack_magicq_transport_submit(transport, slot))
+		{
+			return false;
+		}
+	}
+	transport->dequeued++;
+
+	// Hand the slot back to the producers for the next lap of the ring
+	slot->sequence.store(pos + STACK_MAGICQ_QUEUE_SIZE, std::memory_order_release);
+	transport->dequeue_pos = pos + 1;
+
+	return true;
+}
+
+/// The sender thread: waits for messages to arrive on the queue and sends them,
+/// holding back any that have a due time until it arrives
+static void stack_magicq_transport_sender(StackMagicQTransport *transport)
+{
+	int64_t next_due = 0, next_token = 0;
+	while (transport->running)
+	{
+		// Wake up for whichever comes first: the next scheduled message set
+		// or the rate limiter having room to send
+		int64_t wake = next_due;
+		if (next_token != 0 && (wake == 0 || next_token < wake))
+		{
+			wake = next_token;
+		}
+
+		// If any destination is down, wake up periodically to reconnect it in
+		// the background, rather than waiting for the next cue to fire
+		if (!stack_magicq_transport_connect_destinations(transport))
+		{
+			int64_t retry = stack_magicq_transport_now() + STACK_MAGICQ_RECONNECT_MIN_BACKOFF;
+			if (wake == 0 || retry < wake)
+			{
+				wake = retry;
+			}
+		}
+
+		// Sleep until something is queued or it's time to wake up. Waiting on
+		// the monotonic clock with an absolute time means we wake as close to
+		// the due time as the kernel's timer slack allows
+		if (wake == 0)
+		{
+			sem_wait(&transport->queue_sem);
+		}
+		else
+		{
+			struct timespec timeout;
+			timeout.tv_sec = wake / 1000000000LL;
+			timeout.tv_nsec = wake % 1000000000LL;
+			sem_clockwait(&transport->queue_sem, CLOCK_MONOTONIC, &timeout);
+		}
+
+		// Drain everything that's available, then send whatever is due and
+		// whatever the rate limit allows
+		while (stack_magicq_transport_dequeue(transport));
+		next_due = stack_magicq_transport_send_scheduled(transport);
+		next_token = stack_magicq_transport_send_pending(transport);
+	}
+}
+
+/// Claims a free slot on the send queue. Returns NULL if the queue is full
+static StackMagicQQueueSlot *stack_magicq_transport_claim(StackMagicQTransport *transport, size_t *claimed_pos)
+{
+	size_t pos = transport->enqueue_pos.load(std::memory_order_relaxed);
+	while (true)
+	{
+		StackMagicQQueueSlot *slot = &transport->queue[pos & (STACK_MAGICQ_QUEUE_SIZE - 1)];
+		intptr_t diff = (intptr_t)slot->sequence.load(std::memory_order_acquire) - (intptr_t)pos;
+		if (diff == 0)
+		{
+			// The slot is free: try and claim it
+			if (transport->enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+			{
+				*claimed_pos = pos;
+				return slot;
+			}
+		}
+		else if (diff < 0)
+		{
+			// The consumer hasn't freed this slot yet: we're full
+			return NULL;
+		}
+		else
+		{
+			// Another producer beat us to it, try again
+			pos = transport->enqueue_pos.load(std::memory_order_relaxed);
+		}
+	}
+}
+
+/// Places a set of pre-encoded OSC bundle elements on the send queue. This never
+/// blocks, and is safe to call from any number of threads at once. Returns false
+/// if the queue is full (or the elements are too large), in which case the
+/// messages are dropped. If metrics are given, the sending of the messages is
+/// recorded against them as well as the plugin-wide metrics. The source is the
+/// unique ID of the cue sending the messages, for capture and cancellation. If
+/// a due time (from stack_magicq_transport_now()) is given, the messages are
+/// sent at that time rather than straight away. If the rate at which we send is
+/// limited, more urgent message sets go first, and a level change replaces any
+/// waiting one with the same (non-zero) collapse key. The playbacks (which may
+/// be NULL) are those that the messages change, which the ledger forgets if
+/// they don't reach the primary console
+bool stack_magicq_transport_enqueue(StackMagicQTransport *transport, const char *elements, size_t length, uint64_t source, StackMagicQMetrics *metrics, int64_t due, StackMagicQPriority priority, uint64_t collapse_key, const StackMagicQPlaybackSet *playbacks)
+{
+	size_t pos = 0;
+	StackMagicQQueueSlot *slot = NULL;
+	if (length > STACK_MAGICQ_MAX_ELEMENTS || (slot = stack_magicq_transport_claim(transport, &pos)) == NULL)
+	{
+		transport->dropped++;
+		return false;
+	}
+
+	// Fill the slot and publish it to the sender thread
+	memcpy(slot->data, elements, length);
+	slot->length = length;
+	slot->enqueue_time = stack_magicq_transport_now();
+	slot->due = due;
+	slot->cancel = false;
+	slot->priority = priority;
+	slot->collapse_key = collapse_key;
+	slot->source = source;
+	if (playbacks != NULL)
+	{
+		slot->playbacks = *playbacks;
+	}
+	else
+	{
+		stack_magicq_playback_set_clear(&slot->playbacks);
+	}
+	slot->metrics = metrics;
+	if (metrics != NULL)
+	{
+		stack_magicq_metrics_ref(metrics);
+	}
+	slot->sequence.store(pos + 1, std::memory_order_release);
+	transport->enqueued++;
+
+	sem_post(&transport->queue_sem);
+	return true;
+}
+
+/// Cancels any message sets from the given source that are still waiting for
+/// their due time. Message sets that have already been sent (including those
+/// sent early with a timetag, or because there was no room to hold them back)
+/// can't be recalled. This happens on the sender thread, which records how
+/// many message sets it recalled against the metrics (if given) with
+/// stack_magicq_metrics_record_cancel(). Returns false if the queue is full,
+/// in which case nothing is cancelled
+bool stack_magicq_transport_cancel(StackMagicQTransport *transport, uint64_t source, StackMagicQMetrics *metrics)
+{
+	size_t pos = 0;
+	StackMagicQQueueSlot *slot = stack_magicq_transport_claim(transport, &pos);
+	if (slot == NULL)
+	{
+		return false;
+	}
+
+	// The cancellation goes through the queue, so that it is always seen after
+	// the message sets it cancels
+	slot->length = 0;
+	slot->enqueue_time = stack_magicq_transport_now();
+	slot->due = 0;
+	slot->cancel = true;
+	slot->priority = STACK_MAGICQ_PRIORITY_CONTROL;
+	slot->collapse_key = 0;
+	slot->source = source;
+	stack_magicq_playback_set_clear(&slot->playbacks);
+	slot->metrics = metrics;
+	if (metrics != NULL)
+	{
+		stack_magicq_metrics_ref(metrics);
+	}
+	slot->sequence.store(pos + 1, std::memory_order_release);
+	transport->enqueued++;
+
+	sem_post(&transport->queue_sem);
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// STATISTICS
+
+/// Gets a snapshot of the transport counters
+void stack_magicq_transport_get_stats(StackMagicQTransport *transport, StackMagicQTransportStats *stats)
+{
+	stats->enqueued = transport->enqueued;
+	uint64_t dequeued = transport->dequeued;
+	stats->dropped = transport->dropped;
+	stats->sent = transport->sent;
+	stats->send_errors = transport->send_errors;
+
+	stats->first_latency = transport->first_latency;
+	stats->last_latency = transport->last_latency;
+	stats->max_latency = transport->max_latency;
+	uint64_t sets_sent = transport->sets_sent;
+	stats->mean_latency = sets_sent > 0 ? transport->total_latency / (int64_t)sets_sent : 0;
+
+	stats->scheduled = transport->scheduled_sent;
+	stats->max_schedule_error = transport->max_schedule_error;
+	stats->mean_schedule_error = stats->scheduled > 0 ? transport->total_schedule_error / (int64_t)stats->scheduled : 0;
+	stats->cancelled = transport->cancelled;
+	stats->delayed = transport->delayed;
+	stats->collapsed = transport->collapsed;
+
+	// The counters are read independently so may be momentarily inconsistent
+	int64_t depth = (int64_t)stats->enqueued - (int64_t)dequeued;
+	stats->queue_depth = depth > 0 ? (size_t)depth : 0;
+}
+
+/// Gets the number of destinations that packets are sent to
+size_t stack_magicq_transport_get_destination_count(StackMagicQTransport *transport)
+{
+	return transport->destination_count;
+}
+
+/// Gets a snapshot of the counters for a single destination. Returns false if
+/// the index is out of range
+bool stack_magicq_transport_get_destination_stats(StackMagicQTransport *transport, size_t index, StackMagicQDestinationStats *stats)
+{
+	if (index >= transport->destination_count)
+	{
+		return false;
+	}
+
+	StackMagicQDestination *destination = &transport->destinations[index];
+	stats->address = destination->address;
+	stats->healthy = destination->healthy;
+	stats->consecutive_errors = destination->consecutive_errors;
+	stats->sent = destination->sent;
+	stats->send_errors = destination->send_errors;
+
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// CREATION AND DESTRUCTION
+
+/// Creates a new transport, connects its sockets and starts its sender thread.
+/// Connecting here means the first cue to fire doesn't pay for it
+static StackMagicQTransport *stack_magicq_transport_create()
+{
+	StackMagicQTransport *transport = new StackMagicQTransport();
+	transport->ref_count = 1;
+	transport->protocol = stack_magicq_transport_get_protocol();
+	transport->port = stack_magicq_transport_get_port(transport->protocol);
+	transport->bundle = transport->protocol == STACK_MAGICQ_PROTOCOL_OSC && stack_magicq_transport_get_bundle_mode();
+	transport->timetags = transport->bundle && stack_magicq_transport_get_timetag_mode();
+	transport->crep_sequence = 0;
+	stack_magicq_transport_get_rate_limit(transport);
+	stack_magicq_transport_get_destinations(transport);
+
+	// Connect now. The sender thread takes over the sockets once it starts,
+	// and retries any that fail here
+	stack_magicq_transport_connect_destinations(transport);
+
+	// Set up the queue, marking every slot as free for the first lap
+	transport->queue = new StackMagicQQueueSlot[STACK_MAGICQ_QUEUE_SIZE];
+	for (size_t i = 0; i < STACK_MAGICQ_QUEUE_SIZE; i++)
+	{
+		transport->queue[i].sequence = i;
+		transport->queue[i].length = 0;
+		transport->queue[i].enqueue_time = 0;
+		transport->queue[i].due = 0;
+		transport->queue[i].cancel = false;
+		transport->queue[i].priority = STACK_MAGICQ_PRIORITY_CONTROL;
+		transport->queue[i].collapse_key = 0;
+		transport->queue[i].source = 0;
+		transport->queue[i].metrics = NULL;
+	}
+	transport->enqueue_pos = 0;
+	transport->dequeue_pos = 0;
+	sem_init(&transport->queue_sem, 0, 0);
+
+	// Nothing is waiting for its due time yet
+	transport->scheduled = new StackMagicQQueueSlot[STACK_MAGICQ_MAX_SCHEDULED];
+	transport->scheduled_count = 0;
+
+	// Nothing is waiting for the rate limiter yet
+	for (size_t i = 0; i < STACK_MAGICQ_PRIORITY_COUNT; i++)
+	{
+		transport->pending[i].slots = new StackMagicQQueueSlot[STACK_MAGICQ_MAX_PENDING];
+		transport->pending[i].head = 0;
+		transport->pending[i].count = 0;
+	}
+
+	// Counters
+	transport->enqueued = 0;
+	transport->dequeued = 0;
+	transport->dropped = 0;
+	transport->sent = 0;
+	transport->send_errors = 0;
+	transport->first_latency = 0;
+	transport->last_latency = 0;
+	transport->max_latency = 0;
+	transport->total_latency = 0;
+	transport->sets_sent = 0;
+	transport->scheduled_sent = 0;
+	transport->cancelled = 0;
+	transport->max_schedule_error = 0;
+	transport->total_schedule_error = 0;
+	transport->delayed = 0;
+	transport->collapsed = 0;
+
+	// Start the sender
+	transport->running = true;
+	transport->sender_thread = std::thread(stack_magicq_transport_sender, transport);
+
+	return transport;
+}
+
+/// Destroys a transport once the last reference has gone
+static void stack_magicq_transport_destroy(StackMagicQTransport *transport)
+{
+	// Stop the sender thread
+	transport->running = false;
+	sem_post(&transport->queue_sem);
+	transport->sender_thread.join();
+
+	// Summarise what happened, so that performance can be compared between runs
+	StackMagicQTransportStats stats;
+	stack_magicq_transport_get_stats(transport, &stats);
+	stack_log("stack_magicq_transport_destroy(): %lu message sets queued, %lu dropped, %lu datagrams sent, %lu failed; latency first %ldus, mean %ldus, max %ldus\n", stats.enqueued, stats.dropped, stats.sent, stats.send_errors, stats.first_latency / 1000, stats.mean_latency / 1000, stats.max_latency / 1000);
+	if (stats.scheduled > 0 || stats.cancelled > 0)
+	{
+		stack_log("stack_magicq_transport_destroy(): %lu scheduled message sets sent, %lu cancelled; lateness mean %ldus, max %ldus\n", stats.scheduled, stats.cancelled, stats.mean_schedule_error / 1000, stats.max_schedule_error / 1000);
+	}
+	if (transport->rate_limit > 0.0)
+	{
+		stack_log("stack_magicq_transport_destroy(): %lu message sets delayed by the rate limit, %lu collapsed\n", stats.delayed, stats.collapsed);
+	}
+	if (stack_magicq_ledger_enabled())
+	{
+		StackMagicQLedgerStats ledger_stats;
+		stack_magicq_ledger_get_stats(&ledger_stats);
+		stack_log("stack_magicq_transport_destroy(): %lu commands checked against the ledger, %lu suppressed, %lu datagrams that didn't reach the primary console\n", ledger_stats.checked, ledger_stats.suppressed, ledger_stats.invalidations);
+	}
+
+	for (size_t i = 0; i < transport->destination_count; i++)
+	{
+		stack_magicq_transport_disconnect_destination(&transport->destinations[i]);
+	}
+
+	// Release anything that never got sent
+	for (size_t i = 0; i < STACK_MAGICQ_QUEUE_SIZE; i++)
+	{
+		stack_magicq_metrics_unref(transport->queue[i].metrics);
+	}
+	for (size_t i = 0; i < transport->scheduled_count; i++)
+	{
+		stack_magicq_metrics_unref(transport->scheduled[i].metrics);
+	}
+	for (size_t i = 0; i < STACK_MAGICQ_PRIORITY_COUNT; i++)
+	{
+		StackMagicQPendingQueue *queue = &transport->pending[i];
+		for (size_t j = 0; j < queue->count; j++)
+		{
+			stack_magicq_metrics_unref(queue->slots[(queue->head + j) % STACK_MAGICQ_MAX_PENDING].metrics);
+		}
+		delete [] queue->slots;
+	}
+
+	sem_destroy(&transport->queue_sem);
+	delete [] transport->queue;
+	delete [] transport->scheduled;
+	delete transport;
+}
+
+/// Creates the plugin-wide transport, holding a reference on behalf of the
+/// plugin itself. Should be called once from stack_init_plugin()
+bool stack_magicq_transport_init()
+{
+	std::unique_lock<std::mutex> lock(smq_transport_mutex);
+	if (smq_transport == NULL)
+	{
+		smq_transport = stack_magicq_transport_create();
+		stack_log("stack_magicq_transport_init(): Transport created for %lu destination(s) (%s, bundles %s, timetags %s, rate limit %.0f/s)\n", smq_transport->destination_count, smq_transport->protocol == STACK_MAGICQ_PROTOCOL_CREP ? "CREP" : "OSC", smq_transport->bundle ? "on" : "off", smq_transport->timetags ? "on" : "off", smq_transport->rate_limit);
+	}
+
+	return true;
+}
+
+/// Gets a new reference to the plugin-wide transport, creating it if necessary.
+/// Each call must be paired with a call to stack_magicq_transport_unref()
+StackMagicQTransport *stack_magicq_transport_ref()
+{
+	std::unique_lock<std::mutex> lock(smq_transport_mutex);
+	if (smq_transport == NULL)
+	{
+		smq_transport = stack_magicq_transport_create();
+	}
+	else
+	{
+		smq_transport->ref_count++;
+	}
+
+	return smq_transport;
+}
+
+/// Releases a reference to the transport, destroying it if it was the last
+void stack_magicq_transport_unref(StackMagicQTransport *transport)
+{
+	if (transport == NULL)
+	{
+		return;
+	}
+
+	std::unique_lock<std::mutex> lock(smq_transport_mutex);
+	if (--transport->ref_count == 0)
+	{
+		if (transport == smq_transport)
+		{
+			smq_transport = NULL;
+		}
+		stack_magicq_transport_destroy(transport);
+	}
+}
@@ -0,0 +1,326 @@
+#ifndef _STACKMAGICQTRANSPORT_H_INCLUDED
+#define _STACKMAGICQTRANSPORT_H_INCLUDED
+
+// Includes:
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <semaphore.h>
+#include <netinet/in.h>
+#include "StackMagicQMetrics.h"
+#include "StackMagicQPlaybackSet.h"
+
+// Defines:
+// The largest datagram we will send (fits in a standard Ethernet MTU)
+#define STACK_MAGICQ_MAX_PACKET 1472
+
+// The size of the header of an OSC bundle ("#bundle" plus the timetag)
+#define STACK_MAGICQ_BUNDLE_HEADER_SIZE 16
+
+// The largest set of bundle elements we will queue, allowing room for the
+// bundle header
+#define STACK_MAGICQ_MAX_ELEMENTS (STACK_MAGICQ_MAX_PACKET - STACK_MAGICQ_BUNDLE_HEADER_SIZE)
+
+// The number of slots in the send queue. Must be a power of two
+#define STACK_MAGICQ_QUEUE_SIZE 1024
+
+// The most consoles (or visualisers) that we will send each packet to
+#define STACK_MAGICQ_MAX_DESTINATIONS 8
+
+// The number of sends in a row that must succeed before an unhealthy
+// destination counts as healthy again. With nobody listening, UDP reports the
+// refusal on the send after the one that caused it, so sends alternate
+// between failing and succeeding
+#define STACK_MAGICQ_DESTINATION_RECOVERY_SENDS 3
+
+// The shortest and longest waits between attempts to reconnect a destination,
+// in nanoseconds. The wait doubles after each failed attempt
+#define STACK_MAGICQ_RECONNECT_MIN_BACKOFF 100000000LL
+#define STACK_MAGICQ_RECONNECT_MAX_BACKOFF 5000000000LL
+
+// The most message sets that can be held back waiting for their due time. Any
+// more than this are sent as soon as they are queued
+#define STACK_MAGICQ_MAX_SCHEDULED 64
+
+// The most message sets of each priority that can wait for the rate limiter.
+// Once full, message sets are left on the send queue
+#define STACK_MAGICQ_MAX_PENDING 256
+
+// The protocols we can speak to MagicQ
+typedef enum StackMagicQProtocol {
+	// OpenSoundControl, with either /rpc or structured /pb addresses
+	STACK_MAGICQ_PROTOCOL_OSC = 0,
+
+	// The ChamSys Remote Ethernet Protocol, which (unlike OSC) also works when
+	// MagicQ is running in demo mode
+	STACK_MAGICQ_PROTOCOL_CREP = 1,
+} StackMagicQProtocol;
+
+// How urgent a message set is when the rate at which we send is limited
+typedef enum StackMagicQPriority {
+	// Commands that change what a playback is doing (go, jump, activate, stop
+	// and release), which are sent first
+	STACK_MAGICQ_PRIORITY_CONTROL = 0,
+
+	// Level changes, which can be collapsed in to the latest value if more
+	// than one is waiting for the same playbacks
+	STACK_MAGICQ_PRIORITY_LEVEL = 1,
+
+	STACK_MAGICQ_PRIORITY_COUNT
+} StackMagicQPriority;
+
+// The OSC messages for a single cue firing, waiting in the send queue. The
+// messages are stored as OSC bundle elements (a big-endian int32 size followed
+// by the message) so that the sender can either wrap them in a bundle or send
+// them individually. CREP packets are stored the same way, but are always sent
+// individually
+struct StackMagicQQueueSlot
+{
+	// Sequence number used to hand the slot between producers and the consumer
+	std::atomic<size_t> sequence;
+
+	// Length of the data in the slot
+	size_t length;
+
+	// When the data was queued (steady clock, nanoseconds)
+	int64_t enqueue_time;
+
+	// When the data should be sent (steady clock, nanoseconds), or zero to
+	// send it as soon as possible
+	int64_t due;
+
+	// If set, the slot carries no data and instead cancels any message sets
+	// from the same source that are still waiting for their due time. How
+	// many were recalled is recorded against the metrics
+	bool cancel;
+
+	// How urgent the data is, and a key identifying the playbacks it sets the
+	// level of (zero if it can't be collapsed). A message set that is waiting
+	// for the rate limiter is replaced by a newer one with the same key
+	StackMagicQPriority priority;
+	uint64_t collapse_key;
+
+	// The unique ID of the cue that queued the data (zero if none)
+	uint64_t source;
+
+	// The playbacks that the data changes, which the ledger forgets if the
+	// data doesn't reach the primary console
+	StackMagicQPlaybackSet playbacks;
+
+	// The metrics of the cue that queued the data (may be NULL). The slot
+	// holds a reference to these until the data has been sent
+	StackMagicQMetrics *metrics;
+
+	// The encoded bundle elements
+	char data[STACK_MAGICQ_MAX_ELEMENTS];
+};
+
+// Snapshot of the transport counters
+struct StackMagicQTransportStats
+{
+	// Number of message sets currently waiting in the queue
+	size_t queue_depth;
+
+	// Number of message sets accepted in to the queue
+	uint64_t enqueued;
+
+	// Number of message sets dropped because the queue was full
+	uint64_t dropped;
+
+	// Number of datagrams successfully sent
+	uint64_t sent;
+
+	// Number of datagrams that failed to send
+	uint64_t send_errors;
+
+	// Time from a message set being queued to it being handed to the kernel,
+	// in nanoseconds: for the first set, the most recent set, the worst so far,
+	// and the mean
+	int64_t first_latency;
+	int64_t last_latency;
+	int64_t max_latency;
+	int64_t mean_latency;
+
+	// Number of message sets that were given a due time, and how late they
+	// were handed to the kernel, in nanoseconds: the worst so far and the mean
+	uint64_t scheduled;
+	int64_t max_schedule_error;
+	int64_t mean_schedule_error;
+
+	// Number of scheduled message sets that were cancelled before they were due
+	uint64_t cancelled;
+
+	// Number of message sets that the rate limiter held back, and that were
+	// replaced by newer levels for the same playbacks before being sent
+	uint64_t delayed;
+	uint64_t collapsed;
+};
+
+// Message sets waiting for the rate limiter, oldest first
+struct StackMagicQPendingQueue
+{
+	StackMagicQQueueSlot *slots;
+	size_t head;
+	size_t count;
+};
+
+// A console (or visualiser) that receives every packet we send
+struct StackMagicQDestination
+{
+	// The address (unicast or multicast) and port to send to
+	struct sockaddr_in address;
+
+	// A UDP socket connected to the address (zero if not connected). Only
+	// ever touched by the sender thread once it has started
+	int sock;
+
+	// The current wait between reconnection attempts, and when the next one
+	// may happen (steady clock, nanoseconds)
+	int64_t backoff;
+	int64_t next_attempt;
+
+	// Whether sends to this destination are succeeding (see
+	// STACK_MAGICQ_DESTINATION_RECOVERY_SENDS)
+	std::atomic<bool> healthy;
+
+	// Number of sends in a row that have failed
+	std::atomic<uint32_t> consecutive_errors;
+
+	// Number of sends in a row that have succeeded, and the number of failed
+	// sends when the destination last became unhealthy. Only ever touched by
+	// the sender thread
+	uint32_t consecutive_successes;
+	uint64_t errors_when_unhealthy;
+
+	// Counters of datagrams sent to this destination
+	std::atomic<uint64_t> sent;
+	std::atomic<uint64_t> send_errors;
+};
+
+// Snapshot of the counters for a single destination
+struct StackMagicQDestinationStats
+{
+	// The address and port of the destination
+	struct sockaddr_in address;
+
+	// Whether sends to this destination are succeeding
+	bool healthy;
+
+	// Number of sends in a row that have failed
+	uint32_t consecutive_errors;
+
+	// Number of datagrams successfully sent to the destination
+	uint64_t sent;
+
+	// Number of datagrams that failed to send to the destination
+	uint64_t send_errors;
+};
+
+// StackMagicQTransport is the single, plugin-wide UDP transport that every
+// MagicQ cue sends its commands through. It is reference counted: the plugin
+// holds one reference from stack_init_plugin(), and each cue holds another for
+// its lifetime. Cues place pre-encoded messages on a lock-free queue and a
+// dedicated sender thread does the (potentially blocking) socket work
+struct StackMagicQTransport
+{
+	// Reference count
+	std::atomic<int32_t> ref_count;
+
+	// The protocol we speak, and the UDP port we talk to MagicQ on (unless
+	// overridden by destinations)
+	StackMagicQProtocol protocol;
+	uint16_t port;
+
+	// The consoles that every packet is sent to. The first is the primary
+	// console, whose state the ledger follows
+	StackMagicQDestination destinations[STACK_MAGICQ_MAX_DESTINATIONS];
+	size_t destination_count;
+
+	// Whether to send each cue's messages as a single OSC bundle (true) or as
+	// one datagram per message (false). Never set when speaking CREP
+	bool bundle;
+
+	// Whether to send scheduled message sets straight away with an OSC timetag
+	// of their due time, leaving MagicQ to apply them, rather than holding them
+	// back until they are due. Only possible when sending bundles
+	bool timetags;
+
+	// The send queue: many producers (cue list pulse threads), one consumer
+	// (the sender thread)
+	StackMagicQQueueSlot *queue;
+	std::atomic<size_t> enqueue_pos;
+	size_t dequeue_pos;
+
+	// Posted once for each message set placed on the queue
+	sem_t queue_sem;
+
+	// The sender thread
+	std::thread sender_thread;
+	std::atomic<bool> running;
+
+	// Message sets that are waiting for their due time. Only ever touched by
+	// the sender thread
+	StackMagicQQueueSlot *scheduled;
+	size_t scheduled_count;
+
+	// The rate limiter: a token bucket holding up to rate_burst datagrams,
+	// refilled at rate_limit datagrams per second (zero for no limit), and the
+	// message sets of each priority waiting for it. Only ever touched by the
+	// sender thread
+	double rate_limit;
+	double rate_burst;
+	double tokens;
+	int64_t last_refill;
+	StackMagicQPendingQueue pending[STACK_MAGICQ_PRIORITY_COUNT];
+
+	// The forward sequence number of the next CREP packet. Only ever touched
+	// by the sender thread
+	uint8_t crep_sequence;
+
+	// Counters. The enqueued, dequeued and dropped counters count message sets
+	// (and cancellations), whereas the sent and send_errors counters count datagrams (summed across
+	// all destinations)
+	std::atomic<uint64_t> enqueued;
+	std::atomic<uint64_t> dequeued;
+	std::atomic<uint64_t> dropped;
+	std::atomic<uint64_t> sent;
+	std::atomic<uint64_t> send_errors;
+
+	// Number of message sets handed to the kernel, and their queue-to-send
+	// latency, in nanoseconds
+	std::atomic<uint64_t> sets_sent;
+	std::atomic<int64_t> first_latency;
+	std::atomic<int64_t> last_latency;
+	std::atomic<int64_t> max_latency;
+	std::atomic<int64_t> total_latency;
+
+	// Scheduling counters, and how late scheduled message sets were sent, in
+	// nanoseconds
+	std::atomic<uint64_t> scheduled_sent;
+	std::atomic<uint64_t> cancelled;
+	std::atomic<int64_t> max_schedule_error;
+	std::atomic<int64_t> total_schedule_error;
+
+	// Rate limiter counters
+	std::atomic<uint64_t> delayed;
+	std::atomic<uint64_t> collapsed;
+};
+
+// Functions: Transport lifecycle
+bool stack_magicq_transport_init();
+StackMagicQTransport *stack_magicq_transport_ref();
+void stack_magicq_transport_unref(StackMagicQTransport *transport);
+
+// Functions: Sending
+bool stack_magicq_transport_enqueue(StackMagicQTransport *transport, const char *elements, size_t length, uint64_t source, StackMagicQMetrics *metrics, int64_t due, StackMagicQPriority priority, uint64_t collapse_key, const StackMagicQPlaybackSet *playbacks);
+bool stack_magicq_transport_cancel(StackMagicQTransport *transport, uint64_t source, StackMagicQMetrics *metrics);
+int64_t stack_magicq_transport_now();
+
+// Functions: Statistics
+void stack_magicq_transport_get_stats(StackMagicQTransport *transport, StackMagicQTransportStats *stats);
+size_t stack_magicq_transport_get_destination_count(StackMagicQTransport *transport);
+bool stack_magicq_transport_get_destination_stats(StackMagicQTransport *transport, size_t index, StackMagicQDestinationStats *stats);
+
+#endif
@@ -0,0 +1,1320 @@
+// stack-magicq-bench: measures how long the MagicQ plugin takes to get a cue's
+// messages on to the wire, without Stack or a console. The plugin is hosted on
+// a minimal stand-in for Stack (see tools/stub) and a cue is fired repeatedly,
+// going through the real compile, queue and sender thread, to a UDP socket on
+// the loopback interface. Other STACK_MAGICQ_* settings are honoured, so that
+// (for example) STACK_MAGICQ_PROTOCOL=crep or STACK_MAGICQ_OSC_BUNDLE=1 can be
+// compared. With a pre-wait, cues are instead pulsed through it as Stack would,
+// and the time the messages arrive is compared with the time the pre-wait ends
+// (which is what STACK_MAGICQ_SCHEDULE_AHEAD and STACK_MAGICQ_OSC_TIMETAGS
+// affect)
+
+// Includes:
+#include "StackCue.h"
+#include "StackJson.h"
+#include "../src/StackMagicQCREP.h"
+#include "../src/StackMagicQCue.h"
+#include "../src/StackMagicQMetrics.h"
+#include "../src/StackMagicQOSC.h"
+#include "../src/StackMagicQProgram.h"
+#include "../src/StackMagicQTransport.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include <dirent.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+// The entry point of the plugin
+extern "C" bool stack_init_plugin();
+
+// Defines:
+#define SMQB_DEFAULT_FIRES 10000
+#define SMQB_DEFAULT_PROGRAM "activate 1-4; level 1-4 50; go 5"
+#define SMQB_DEFAULT_CUES 1
+#define SMQB_DEFAULT_PULSE_INTERVAL 1000
+
+// How long to wait for a fire's datagrams to arrive before giving up on them
+#define SMQB_ARRIVAL_TIMEOUT (1000 * NANOSECS_PER_MILLISEC)
+
+// The number of times a piece of work is repeated between readings of the
+// clock, when it's too quick to time on its own
+#define SMQB_BATCH 100
+
+// The fewest times every cue is played and pulsed when measuring them
+#define SMQB_MIN_SWEEPS 10
+
+// The most datagrams that may be on their way during the throughput test, to
+// stay well clear of the plugin's queue size
+#define SMQB_THROUGHPUT_WINDOW 256
+
+// How many times each way of loading or saving a show is timed, keeping the
+// best
+#define SMQB_LOAD_ROUNDS 3
+
+// The number of rows in the cue list when timing redraws of it
+#define SMQB_FIELD_ROWS 10000
+
+// The size of the IPv4 and UDP headers of each datagram
+#define SMQB_UDP_OVERHEAD 28
+
+// Global: The socket standing in for the console, and what has arrived on it.
+// The arrival time is written before the count, so that once a count has been
+// seen the time of the datagram that made it is too
+static int smqb_sock = -1;
+static std::atomic<uint64_t> smqb_received(0);
+static std::atomic<int64_t> smqb_last_arrival(0);
+static std::atomic<bool> smqb_stop(false);
+
+// Global: Somewhere to put the results of work that is being timed, so that it
+// isn't optimised away
+static volatile size_t smqb_sink = 0;
+
+// Global: The thread running stack_magicq_bench_receiver
+static std::thread smqb_receiver;
+
+// What is being measured, and the cues it is measured with
+struct StackMagicQBench
+{
+	const StackCueClass *cue_class;
+	std::vector<StackCue*> cues;
+	const char *program;
+
+	// The number of times to fire a cue, and the number of datagrams each
+	// fire sends
+	size_t fires;
+	uint64_t per_fire;
+
+	// The pre-wait of the cues (zero if none), and the time between pulses
+	// during it (nanoseconds)
+	int64_t pre_wait;
+	int64_t interval;
+};
+
+// A thing the tool can measure: its name (as given to -m), the function that
+// measures it and reports the results (returning the exit code of the tool),
+// and a description for the usage
+struct StackMagicQBenchMode
+{
+	const char *name;
+	int (*func)(StackMagicQBench *bench);
+	const char *description;
+};
+
+/// Receives datagrams until asked to stop, noting when each arrived
+static void stack_magicq_bench_receiver()
+{
+	char buffer[65536];
+	while (!smqb_stop.load(std::memory_order_relaxed))
+	{
+		if (recv(smqb_sock, buffer, sizeof(buffer), 0) < 0)
+		{
+			// Timed out (so that we can check whether to stop) or interrupted
+			continue;
+		}
+
+		smqb_last_arrival.store(stack_magicq_transport_now(), std::memory_order_relaxed);
+		smqb_received.fetch_add(1, std::memory_order_release);
+	}
+}
+
+/// Creates the socket standing in for the console, on an unused port of the
+/// loopback interface, returning the port
+static uint16_t stack_magicq_bench_open_socket()
+{
+	smqb_sock = socket(AF_INET, SOCK_DGRAM, 0);
+	if (smqb_sock < 0)
+	{
+		perror("socket");
+		return 0;
+	}
+
+	// Leave plenty of room for bursts, and time out so the receiver can stop
+	int buffer_size = 4 * 1024 * 1024;
+	setsockopt(smqb_sock, SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof(buffer_size));
+	struct timeval timeout = { 0, 100000 };
+	setsockopt(smqb_sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+	struct sockaddr_in address;
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	address.sin_port = 0;
+	socklen_t length = sizeof(address);
+	if (bind(smqb_sock, (struct sockaddr*)&address, sizeof(address)) != 0 || getsockname(smqb_sock, (struct sockaddr*)&address, &length) != 0)
+	{
+		perror("bind");
+		close(smqb_sock);
+		smqb_sock = -1;
+		return 0;
+	}
+
+	return ntohs(address.sin_port);
+}
+
+/// Waits until at least the given number of datagrams has arrived. Returns
+/// false if they didn't arrive in time
+static bool stack_magicq_bench_wait_for(uint64_t count, int64_t timeout)
+{
+	const int64_t give_up = stack_magicq_transport_now() + timeout;
+	while (smqb_received.load(std::memory_order_acquire) < count)
+	{
+		if (stack_magicq_transport_now() > give_up)
+		{
+			return false;
+		}
+		sched_yield();
+	}
+
+	return true;
+}
+
+/// Fires the cue: plays it and gives it the pulse that takes it beyond its
+/// pre-wait, which is when it hands its messages to the transport. Returns the
+/// time of that pulse
+static int64_t stack_magicq_bench_fire(const StackCueClass *cue_class, StackCue *cue)
+{
+	cue_class->stop_func(cue);
+	cue_class->play_func(cue);
+	const int64_t fire_time = stack_magicq_transport_now();
+	cue_class->pulse_func(cue, stack_get_clock_time());
+	return fire_time;
+}
+
+/// Fires a cue with a pre-wait: plays it and pulses it at the given interval
+/// until its pre-wait is over, as Stack would. Returns the time the pre-wait
+/// ends, which is when its messages are due
+static int64_t stack_magicq_bench_fire_pre_wait(const StackCueClass *cue_class, StackCue *cue, int64_t pre_wait, int64_t interval)
+{
+	cue_class->stop_func(cue);
+	cue_class->play_func(cue);
+	const int64_t due = cue->start_time + pre_wait;
+	while (cue->state == STACK_CUE_STATE_PLAYING_PRE)
+	{
+		usleep((useconds_t)(interval / NANOSECS_PER_MICROSEC));
+		cue_class->pulse_func(cue, stack_get_clock_time());
+	}
+	return due;
+}
+
+/// Gets a percentile (0 to 100) of a sorted set of values
+static int64_t stack_magicq_bench_percentile(const std::vector<int64_t> &sorted, double percentile)
+{
+	if (sorted.empty())
+	{
+		return 0;
+	}
+
+	size_t index = (size_t)ceil(percentile / 100.0 * (double)sorted.size());
+	return sorted[index > 0 ? index - 1 : 0];
+}
+
+/// Stops the receiver and destroys the cues
+static void stack_magicq_bench_finish(const StackCueClass *cue_class, std::vector<StackCue*> &cues)
+{
+	for (StackCue *cue : cues)
+	{
+		cue_class->destroy_func(cue);
+	}
+	cues.clear();
+
+	smqb_stop = true;
+	smqb_receiver.join();
+	close(smqb_sock);
+}
+
+/// Sorts a set of times (in nanoseconds) and prints their percentiles, in
+/// nanoseconds or (if there's a chance of them getting large) microseconds
+static void stack_magicq_bench_print_times(const char *label, std::vector<int64_t> &times, bool microseconds)
+{
+	std::sort(times.begin(), times.end());
+	const double scale = microseconds ? 1000.0 : 1.0;
+	printf("%s (%s): p50 %.1f, p99 %.1f, p99.9 %.1f, max %.1f over %lu\n", label, microseconds ? "us" : "ns",
+		stack_magicq_bench_percentile(times, 50.0) / scale,
+		stack_magicq_bench_percentile(times, 99.0) / scale,
+		stack_magicq_bench_percentile(times, 99.9) / scale,
+		stack_magicq_bench_percentile(times, 100.0) / scale,
+		times.size());
+}
+
+/// Fires the cues one at a time, timing from the pulse until the last of
+/// their datagrams arrives, then fires them back to back to find how many
+/// datagrams per second get through. Returns the exit code of the tool
+static int stack_magicq_bench_wire(StackMagicQBench *bench)
+{
+	// Latency: fire one at a time, timing from the pulse until the last of
+	// the datagrams arrives
+	std::vector<int64_t> latencies;
+	latencies.reserve(bench->fires);
+	size_t lost = 0;
+	for (size_t i = 0; i < bench->fires; i++)
+	{
+		const uint64_t expected = smqb_received.load(std::memory_order_acquire) + bench->per_fire;
+		const int64_t fire_time = stack_magicq_bench_fire(bench->cue_class, bench->cues[i % bench->cues.size()]);
+		if (stack_magicq_bench_wait_for(expected, SMQB_ARRIVAL_TIMEOUT))
+		{
+			latencies.push_back(smqb_last_arrival.load(std::memory_order_relaxed) - fire_time);
+		}
+		else
+		{
+			// Don't let stragglers count towards the next fire
+			lost++;
+			usleep(100000);
+		}
+	}
+	std::sort(latencies.begin(), latencies.end());
+
+	// Throughput: fire back to back, only holding back to stay within the
+	// queue, and time until the last datagram arrives
+	StackMagicQTransport *transport = stack_magicq_transport_ref();
+	StackMagicQTransportStats before, after;
+	stack_magicq_transport_get_stats(transport, &before);
+
+	const uint64_t first = smqb_received.load(std::memory_order_acquire);
+	const int64_t start = stack_magicq_transport_now();
+	for (size_t i = 0; i < bench->fires; i++)
+	{
+		while ((uint64_t)i * bench->per_fire > smqb_received.load(std::memory_order_acquire) - first + SMQB_THROUGHPUT_WINDOW)
+		{
+			sched_yield();
+		}
+		stack_magicq_bench_fire(bench->cue_class, bench->cues[i % bench->cues.size()]);
+	}
+	stack_magicq_bench_wait_for(first + bench->fires * bench->per_fire, SMQB_ARRIVAL_TIMEOUT);
+	const uint64_t throughput_received = smqb_received.load(std::memory_order_acquire) - first;
+	const int64_t elapsed = smqb_last_arrival.load(std::memory_order_relaxed) - start;
+
+	stack_magicq_transport_get_stats(transport, &after);
+	stack_magicq_transport_unref(transport);
+
+	// Report
+	const StackMagicQHistogram *kernel = stack_magicq_metrics_get_latency(stack_magicq_metrics_get_global());
+	printf("Fire to wire (us): p50 %.1f, p99 %.1f, p99.9 %.1f, max %.1f over %lu fires (%lu lost)\n",
+		stack_magicq_bench_percentile(latencies, 50.0) / 1000.0,
+		stack_magicq_bench_percentile(latencies, 99.0) / 1000.0,
+		stack_magicq_bench_percentile(latencies, 99.9) / 1000.0,
+		stack_magicq_bench_percentile(latencies, 100.0) / 1000.0,
+		latencies.size(), lost);
+	printf("Pulse to kernel, as the plugin measures it (us): p50 %ld, p99 %ld, p99.9 %ld\n",
+		stack_magicq_metrics_get_percentile(kernel, 50.0),
+		stack_magicq_metrics_get_percentile(kernel, 99.0),
+		stack_magicq_metrics_get_percentile(kernel, 99.9));
+	printf("Throughput: %.0f packets per second (%lu of %lu arrived, %lu dropped by the queue)\n",
+		elapsed > 0 ? (double)throughput_received * NANOSECS_PER_SEC / (double)elapsed : 0.0,
+		throughput_received, bench->fires * bench->per_fire, after.dropped - before.dropped);
+
+	return lost == 0 ? 0 : 1;
+}
+
+/// Fires the cues one at a time through their pre-wait, and reports how far
+/// from the end of the pre-wait the last of their datagrams arrived (negative
+/// if early, as they will be with timetags, which leave the timing to the
+/// console). Returns the exit code of the tool
+static int stack_magicq_bench_pre_wait(StackMagicQBench *bench)
+{
+	for (StackCue *cue : bench->cues)
+	{
+		stack_property_set_int64(stack_cue_get_property(cue, "pre_time"), STACK_PROPERTY_VERSION_DEFINED, bench->pre_wait);
+	}
+
+	std::vector<int64_t> jitters;
+	jitters.reserve(bench->fires);
+	size_t lost = 0;
+	for (size_t i = 0; i < bench->fires; i++)
+	{
+		const uint64_t expected = smqb_received.load(std::memory_order_acquire) + bench->per_fire;
+		const int64_t due = stack_magicq_bench_fire_pre_wait(bench->cue_class, bench->cues[i % bench->cues.size()], bench->pre_wait, bench->interval);
+		if (stack_magicq_bench_wait_for(expected, SMQB_ARRIVAL_TIMEOUT))
+		{
+			jitters.push_back(smqb_last_arrival.load(std::memory_order_relaxed) - due);
+		}
+		else
+		{
+			lost++;
+			usleep(100000);
+		}
+	}
+	std::sort(jitters.begin(), jitters.end());
+
+	printf("Pre-wait %.1f ms, pulsed every %.1f us\n", bench->pre_wait / 1000000.0, bench->interval / 1000.0);
+	printf("Arrival after due (us): min %.1f, p50 %.1f, p99 %.1f, p99.9 %.1f, max %.1f over %lu fires (%lu lost)\n",
+		stack_magicq_bench_percentile(jitters, 0.0) / 1000.0,
+		stack_magicq_bench_percentile(jitters, 50.0) / 1000.0,
+		stack_magicq_bench_percentile(jitters, 99.0) / 1000.0,
+		stack_magicq_bench_percentile(jitters, 99.9) / 1000.0,
+		stack_magicq_bench_percentile(jitters, 100.0) / 1000.0,
+		jitters.size(), lost);
+
+	return lost == 0 ? 0 : 1;
+}
+
+/// Encodes one command the way the plugin did before it compiled cues when they
+/// were played: a zeroed buffer, the /rpc address written with snprintf and
+/// measured with strlen, then padded and given an empty type tag. It is
+/// appended to a buffer of bundle elements, as the transport expects. Returns
+/// the new length of the data in the buffer
+static size_t stack_magicq_bench_snprintf_element(char *elements, size_t offset, size_t size, MagicQOperation operation, int playback, int level, const char *cue_id)
+{
+	char buffer[64];
+	memset(buffer, 0, sizeof(buffer));
+
+	switch (operation)
+	{
+		case MAGICQ_OPERATION_ACTIVATE:
+			snprintf(buffer, 32, "/rpc/%dA", playback);
+			break;
+		case MAGICQ_OPERATION_RELEASE:
+			snprintf(buffer, 32, "/rpc/%dR", playback);
+			break;
+		case MAGICQ_OPERATION_GO:
+			snprintf(buffer, 32, "/rpc/%dG", playback);
+			break;
+		case MAGICQ_OPERATION_STOP:
+			snprintf(buffer, 32, "/rpc/%dS", playback);
+			break;
+		case MAGICQ_OPERATION_SET_LEVEL:
+			snprintf(buffer, 32, "/rpc/%d,%dL", playback, level);
+			break;
+		case MAGICQ_OPERATION_JUMP_TO_CUE_ID:
+			snprintf(buffer, 32, "/rpc/%d,%sJ", playback, cue_id);
+			break;
+	}
+
+	// The address and its terminator, padded to four bytes, then the type tag
+	size_t length = (strlen(buffer) + 1 + 3) & ~(size_t)3;
+	buffer[length] = ',';
+	length += 4;
+
+	if (offset + 4 + length > size)
+	{
+		return offset;
+	}
+	uint32_t element_size = htonl((uint32_t)length);
+	memcpy(&elements[offset], &element_size, 4);
+	memcpy(&elements[offset + 4], buffer, length);
+	return offset + 4 + length;
+}
+
+/// Encodes every command of a cue the way the plugin did before it compiled
+/// cues when they were played: on the firing pulse, each command read the
+/// properties it needed by name and was encoded with snprintf. Returns the
+/// length of the encoded commands
+static size_t stack_magicq_bench_encode_on_pulse(StackCue *cue, const StackMagicQProgram *program, char *elements, size_t size)
+{
+	size_t length = 0;
+	for (size_t i = 0; i < program->step_count; i++)
+	{
+		const StackMagicQStep *step = &program->steps[i];
+		for (int playback = stack_magicq_playback_set_next(&step->playbacks, 0); playback > 0; playback = stack_magicq_playback_set_next(&step->playbacks, playback))
+		{
+			// Each command looked up the playback, and then the level or cue
+			// ID, by name
+			char *text = NULL;
+			stack_property_get_string(stack_cue_get_property(cue, "program"), STACK_PROPERTY_VERSION_LIVE, &text);
+			if (step->operation == MAGICQ_OPERATION_SET_LEVEL || step->operation == MAGICQ_OPERATION_JUMP_TO_CUE_ID)
+			{
+				stack_property_get_string(stack_cue_get_property(cue, "program"), STACK_PROPERTY_VERSION_LIVE, &text);
+			}
+
+			length = stack_magicq_bench_snprintf_element(elements, length, size, step->operation, playback, step->level, step->cue_id);
+		}
+	}
+
+	return length;
+}
+
+/// Compares getting a fire's messages ready on the firing pulse: copying the
+/// messages that were compiled when the cue was played (as the transport does
+/// when they are queued), against encoding them as the plugin used to. Each
+/// is timed over a batch of fires, to keep the clock out of it. The whole
+/// firing pulse is timed too, although that also includes waking the sender
+/// thread (and, on a single CPU, the send itself). Returns the exit code of the
+/// tool
+static int stack_magicq_bench_encode(StackMagicQBench *bench)
+{
+	StackMagicQProgram program;
+	if (!stack_magicq_program_parse(bench->program, &program))
+	{
+		return 1;
+	}
+
+	StackCue *cue = bench->cues[0];
+	bench->cue_class->stop_func(cue);
+	bench->cue_class->play_func(cue);
+	const StackMagicQCue *mcue = STACK_MAGICQ_CUE(cue);
+
+	static char elements[STACK_MAGICQ_MAX_ELEMENTS];
+	std::vector<int64_t> cached, encoding;
+	size_t encoded_length = 0;
+	for (size_t i = 0; i < bench->fires; i += SMQB_BATCH)
+	{
+		int64_t start = stack_magicq_transport_now();
+		for (size_t j = 0; j < SMQB_BATCH; j++)
+		{
+			memcpy(elements, mcue->packet, mcue->packet_length);
+			smqb_sink = smqb_sink + (size_t)elements[j % mcue->packet_length];
+		}
+		cached.push_back((stack_magicq_transport_now() - start) / SMQB_BATCH);
+
+		start = stack_magicq_transport_now();
+		for (size_t j = 0; j < SMQB_BATCH; j++)
+		{
+			encoded_length += stack_magicq_bench_encode_on_pulse(cue, &program, elements, sizeof(elements));
+		}
+		encoding.push_back((stack_magicq_transport_now() - start) / SMQB_BATCH);
+	}
+
+	// The whole firing pulse, with the play that compiles the messages before
+	// the timing starts
+	std::vector<int64_t> pulses;
+	size_t lost = 0;
+	for (size_t i = 0; i < bench->fires; i++)
+	{
+		cue = bench->cues[i % bench->cues.size()];
+		const uint64_t expected = smqb_received.load(std::memory_order_acquire) + bench->per_fire;
+		bench->cue_class->stop_func(cue);
+		bench->cue_class->play_func(cue);
+		const int64_t start = stack_magicq_transport_now();
+		bench->cue_class->pulse_func(cue, stack_get_clock_time());
+		pulses.push_back(stack_magicq_transport_now() - start);
+		lost += stack_magicq_bench_wait_for(expected, SMQB_ARRIVAL_TIMEOUT) ? 0 : 1;
+	}
+
+	printf("Messages: %lu bytes compiled at play, %lu bytes encoded on the pulse\n", mcue->packet_length, encoded_length / (encoding.size() * SMQB_BATCH));
+	stack_magicq_bench_print_times("Getting a fire ready, compiled at play", cached, false);
+	stack_magicq_bench_print_times("Getting a fire ready, encoded on the pulse", encoding, false);
+	stack_magicq_bench_print_times("Whole firing pulse, compiled at play", pulses, false);
+	if (lost > 0)
+	{
+		printf("%lu fires lost\n", lost);
+	}
+
+	return lost == 0 ? 0 : 1;
+}
+
+// Global: Properties of a MagicQ cue, looked up by name in turn to stand in
+// for the lookups the plugin used to do before it kept its properties
+static const char *smqb_property_names[] = { "program", "fade_start_level", "fade_curve", "force_send", "pre_time", "action_time", "post_time", "name", "program" };
+
+/// Looks up a number of a cue's properties by name and reads them, as the
+/// plugin used to on every play and pulse
+static void stack_magicq_bench_lookup_properties(StackCue *cue, size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+	{
+		StackProperty *property = stack_cue_get_property(cue, smqb_property_names[i % (sizeof(smqb_property_names) / sizeof(smqb_property_names[0]))]);
+		smqb_sink = smqb_sink + (size_t)property;
+	}
+}
+
+/// Times playing every cue, and pulsing every cue while it's in its pre-wait
+/// (as Stack does for every running cue, many times a second), per cue. Each is
+/// also timed with the property lookups by name that the plugin used to do
+/// (nine on play and six on pulse) added in. Use -c to set the number of cues.
+/// Returns the exit code of the tool
+static int stack_magicq_bench_cues(StackMagicQBench *bench)
+{
+	// A pre-wait that won't end while we're measuring, so that pulses don't
+	// fire the cues
+	for (StackCue *cue : bench->cues)
+	{
+		stack_property_set_int64(stack_cue_get_property(cue, "pre_time"), STACK_PROPERTY_VERSION_DEFINED, 3600 * NANOSECS_PER_SEC);
+	}
+
+	const size_t cue_count = bench->cues.size();
+	const size_t sweeps = std::max(bench->fires / cue_count, (size_t)SMQB_MIN_SWEEPS);
+	std::vector<int64_t> plays, pulses, named_plays, named_pulses;
+	for (size_t sweep = 0; sweep < sweeps; sweep++)
+	{
+		int64_t start = stack_magicq_transport_now();
+		for (StackCue *cue : bench->cues)
+		{
+			bench->cue_class->stop_func(cue);
+			bench->cue_class->play_func(cue);
+		}
+		plays.push_back((stack_magicq_transport_now() - start) / (int64_t)cue_count);
+
+		start = stack_magicq_transport_now();
+		for (StackCue *cue : bench->cues)
+		{
+			bench->cue_class->pulse_func(cue, stack_get_clock_time());
+		}
+		pulses.push_back((stack_magicq_transport_now() - start) / (int64_t)cue_count);
+
+		start = stack_magicq_transport_now();
+		for (StackCue *cue : bench->cues)
+		{
+			bench->cue_class->stop_func(cue);
+			bench->cue_class->play_func(cue);
+			stack_magicq_bench_lookup_properties(cue, 9);
+		}
+		named_plays.push_back((stack_magicq_transport_now() - start) / (int64_t)cue_count);
+
+		start = stack_magicq_transport_now();
+		for (StackCue *cue : bench->cues)
+		{
+			bench->cue_class->pulse_func(cue, stack_get_clock_time());
+			stack_magicq_bench_lookup_properties(cue, 6);
+		}
+		named_pulses.push_back((stack_magicq_transport_now() - start) / (int64_t)cue_count);
+	}
+
+	for (StackCue *cue : bench->cues)
+	{
+		bench->cue_class->stop_func(cue);
+	}
+
+	printf("Per cue, over %lu sweeps of %lu cues:\n", sweeps, cue_count);
+	stack_magicq_bench_print_times("Play", plays, false);
+	stack_magicq_bench_print_times("Play, with lookups by name", named_plays, false);
+	stack_magicq_bench_print_times("Pulse", pulses, false);
+	stack_magicq_bench_print_times("Pulse, with lookups by name", named_pulses, false);
+
+	return 0;
+}
+
+/// Encodes every command of a program, over and over, with the typed OSC
+/// encoder (in whichever addressing STACK_MAGICQ_OSC_ADDRESSING asks for) and
+/// with snprintf as the plugin used to, and reports how many commands per
+/// second each manages. Returns the exit code of the tool
+static int stack_magicq_bench_osc(StackMagicQBench *bench)
+{
+	StackMagicQProgram program;
+	if (!stack_magicq_program_parse(bench->program, &program))
+	{
+		return 1;
+	}
+
+	// The commands of the program, one per playback of each step
+	std::vector<const StackMagicQStep*> steps;
+	std::vector<int> playbacks;
+	for (size_t i = 0; i < program.step_count; i++)
+	{
+		const StackMagicQStep *step = &program.steps[i];
+		for (int playback = stack_magicq_playback_set_next(&step->playbacks, 0); playback > 0; playback = stack_magicq_playback_set_next(&step->playbacks, playback))
+		{
+			steps.push_back(step);
+			playbacks.push_back(playback);
+		}
+	}
+	if (steps.empty())
+	{
+		return 1;
+	}
+
+	static char elements[STACK_MAGICQ_MAX_ELEMENTS];
+	std::vector<int64_t> typed, formatted;
+	size_t typed_bytes = 0, formatted_bytes = 0;
+	for (size_t i = 0; i < bench->fires; i += SMQB_BATCH)
+	{
+		int64_t start = stack_magicq_transport_now();
+		for (size_t j = 0; j < SMQB_BATCH; j++)
+		{
+			size_t length = 0;
+			for (size_t k = 0; k < steps.size(); k++)
+			{
+				length = stack_magicq_osc_append_operation(elements, length, sizeof(elements), steps[k]->operation, (int16_t)playbacks[k], steps[k]->level, steps[k]->cue_id);
+			}
+			typed_bytes += length;
+		}
+		typed.push_back((stack_magicq_transport_now() - start) / (int64_t)(SMQB_BATCH * steps.size()));
+
+		start = stack_magicq_transport_now();
+		for (size_t j = 0; j < SMQB_BATCH; j++)
+		{
+			size_t length = 0;
+			for (size_t k = 0; k < steps.size(); k++)
+			{
+				length = stack_magicq_bench_snprintf_element(elements, length, sizeof(elements), steps[k]->operation, playbacks[k], steps[k]->level, steps[k]->cue_id);
+			}
+			formatted_bytes += length;
+		}
+		formatted.push_back((stack_magicq_transport_now() - start) / (int64_t)(SMQB_BATCH * steps.size()));
+	}
+
+	const size_t rounds = typed.size() * SMQB_BATCH;
+	printf("%lu commands per fire, %s addressing: %lu bytes typed, %lu bytes with snprintf\n", steps.size(),
+		stack_magicq_osc_get_addressing() == STACK_MAGICQ_OSC_ADDRESSING_STRUCTURED ? "structured" : "/rpc",
+		typed_bytes / rounds, formatted_bytes / rounds);
+	stack_magicq_bench_print_times("Per command, typed encoder", typed, false);
+	stack_magicq_bench_print_times("Per command, snprintf", formatted, false);
+
+	// Both are sorted now
+	const int64_t typed_p50 = stack_magicq_bench_percentile(typed, 50.0), formatted_p50 = stack_magicq_bench_percentile(formatted, 50.0);
+	printf("Throughput (commands per second, at p50): typed %.0f, snprintf %.0f\n",
+		typed_p50 > 0 ? (double)NANOSECS_PER_SEC / (double)typed_p50 : 0.0,
+		formatted_p50 > 0 ? (double)NANOSECS_PER_SEC / (double)formatted_p50 : 0.0);
+
+	return 0;
+}
+
+/// Makes the JSON that a show stores for a cue, with a program on its own
+/// playback, as Stack would give it to from_json
+static std::string stack_magicq_bench_cue_json(size_t index)
+{
+	const int playback = (int)(index % 255) + 1;
+	char json[256];
+	snprintf(json, sizeof(json), "{\"StackMagicQCue\":{\"program\":[[\"activate\",\"%d\"],[\"level\",\"%d\",%d],[\"go\",\"%d\"]],\"fade_start_level\":0,\"fade_curve\":1,\"force_send\":false}}",
+		playback, playback, (int)(index % 101), playback);
+	return json;
+}
+
+/// Loads a cue from its JSON one property at a time, with every property change
+/// notifying the cue list and revalidating the cue, as the plugin used to
+static void stack_magicq_bench_load_by_property(StackCue *cue, const char *json_data)
+{
+	Json::Value root;
+	stack_json_read_string(json_data, &root);
+	const Json::Value &data = root["StackMagicQCue"];
+
+	std::string program;
+	for (const Json::Value &step : data["program"])
+	{
+		program += program.empty() ? "" : "; ";
+		for (Json::ArrayIndex i = 0; i < step.size(); i++)
+		{
+			program += (i > 0 ? " " : "") + step[i].asString();
+		}
+	}
+	stack_property_set_string(stack_cue_get_property(cue, "program"), STACK_PROPERTY_VERSION_DEFINED, program.c_str());
+	stack_property_set_int16(stack_cue_get_property(cue, "fade_start_level"), STACK_PROPERTY_VERSION_DEFINED, (int16_t)data["fade_start_level"].asInt());
+	stack_property_set_int16(stack_cue_get_property(cue, "fade_curve"), STACK_PROPERTY_VERSION_DEFINED, (int16_t)data["fade_curve"].asInt());
+	stack_property_set_bool(stack_cue_get_property(cue, "force_send"), STACK_PROPERTY_VERSION_DEFINED, data["force_send"].asBool());
+}
+
+/// Loads a whole show into new cues, either as Stack does or a property at a
+/// time, and destroys them again. Returns how long reading the cues in took,
+/// not counting creating them
+static int64_t stack_magicq_bench_load_show(StackMagicQBench *bench, const std::vector<std::string> &show, bool by_property)
+{
+	std::vector<StackCue*> cues(show.size());
+	for (size_t i = 0; i < show.size(); i++)
+	{
+		cues[i] = bench->cue_class->create_func(NULL);
+	}
+
+	const int64_t start = stack_magicq_transport_now();
+	for (size_t i = 0; i < show.size(); i++)
+	{
+		if (by_property)
+		{
+			stack_magicq_bench_load_by_property(cues[i], show[i].c_str());
+		}
+		else
+		{
+			bench->cue_class->from_json_func(cues[i], show[i].c_str());
+		}
+	}
+	const int64_t elapsed = stack_magicq_transport_now() - start;
+
+	for (StackCue *cue : cues)
+	{
+		bench->cue_class->destroy_func(cue);
+	}
+
+	return elapsed;
+}
+
+/// Times loading shows of 1000, 10000 and 50000 cues: reading each cue's JSON
+/// as Stack does, against setting its properties one at a time. With a single
+/// run the order of the two matters as much as the difference between them, so
+/// they take turns and the best of a few rounds is kept. The stand-in for Stack
+/// does nothing when told the cue list has changed, so the real saving from
+/// notifying it once per cue is larger. Returns the exit code of the tool
+static int stack_magicq_bench_load(StackMagicQBench *bench)
+{
+	static const size_t sizes[] = { 1000, 10000, 50000 };
+	for (size_t size : sizes)
+	{
+		std::vector<std::string> show;
+		show.reserve(size);
+		for (size_t i = 0; i < size; i++)
+		{
+			show.push_back(stack_magicq_bench_cue_json(i));
+		}
+
+		int64_t parse = INT64_MAX, bulk = INT64_MAX, by_property = INT64_MAX;
+		for (int round = 0; round < SMQB_LOAD_ROUNDS; round++)
+		{
+			// Both ways parse the same JSON, so time that on its own
+			const int64_t start = stack_magicq_transport_now();
+			for (const std::string &json : show)
+			{
+				Json::Value root;
+				stack_json_read_string(json.c_str(), &root);
+			}
+			parse = std::min(parse, stack_magicq_transport_now() - start);
+
+			const bool property_first = (round % 2 == 1);
+			by_property = property_first ? std::min(by_property, stack_magicq_bench_load_show(bench, show, true)) : by_property;
+			bulk = std::min(bulk, stack_magicq_bench_load_show(bench, show, false));
+			by_property = property_first ? by_property : std::min(by_property, stack_magicq_bench_load_show(bench, show, true));
+		}
+
+		printf("Loading %lu cues: %.1f ms (%.2f us per cue), or %.1f ms (%.2f us per cue) a property at a time, of which parsing the JSON is %.1f ms\n", size,
+			bulk / 1000000.0, bulk / 1000.0 / (double)size, by_property / 1000000.0, by_property / 1000.0 / (double)size, parse / 1000000.0);
+	}
+
+	return 0;
+}
+
+/// Saves a cue as the plugin used to: building a tree of JSON values, writing it
+/// out with jsoncpp and copying the result. Returns the JSON, to be freed with
+/// free()
+static char *stack_magicq_bench_to_json_tree(StackCue *cue)
+{
+	const StackMagicQProgram *program = &STACK_MAGICQ_CUE(cue)->program;
+	Json::Value cue_root;
+	Json::Value &steps = cue_root["program"] = Json::Value(Json::arrayValue);
+	char text[STACK_MAGICQ_PLAYBACK_SET_MAX_TEXT];
+	for (size_t i = 0; i < program->step_count; i++)
+	{
+		const StackMagicQStep *step = &program->steps[i];
+		Json::Value &json_step = steps.append(Json::Value(Json::arrayValue));
+		json_step.append(stack_magicq_program_get_operation_name(step->operation));
+		stack_magicq_playback_set_format(&step->playbacks, text, sizeof(text));
+		json_step.append(text);
+		if (step->operation == MAGICQ_OPERATION_SET_LEVEL)
+		{
+			json_step.append(step->level);
+		}
+		else if (step->operation == MAGICQ_OPERATION_JUMP_TO_CUE_ID && step->cue_id[0] != '\0')
+		{
+			json_step.append(step->cue_id);
+		}
+	}
+
+	int16_t fade_start_level = 0, fade_curve = 0;
+	bool force_send = false;
+	stack_property_get_int16(stack_cue_get_property(cue, "fade_start_level"), STACK_PROPERTY_VERSION_DEFINED, &fade_start_level);
+	stack_property_get_int16(stack_cue_get_property(cue, "fade_curve"), STACK_PROPERTY_VERSION_DEFINED, &fade_curve);
+	stack_property_get_bool(stack_cue_get_property(cue, "force_send"), STACK_PROPERTY_VERSION_DEFINED, &force_send);
+	cue_root["fade_start_level"] = fade_start_level;
+	cue_root["fade_curve"] = fade_curve;
+	cue_root["force_send"] = force_send;
+
+	Json::StreamWriterBuilder builder;
+	return strdup(Json::writeString(builder, cue_root).c_str());
+}
+
+/// Times saving shows of 1000, 10000 and 50000 cues, one cue at a time as Stack
+/// does: streaming each into the plugin's shared buffer, against building a
+/// tree of JSON values for each as the plugin used to. As with loading, the two
+/// take turns and the best of a few rounds is kept. Returns the exit code of the
+/// tool
+static int stack_magicq_bench_save(StackMagicQBench *bench)
+{
+	static const size_t sizes[] = { 1000, 10000, 50000 };
+	for (size_t size : sizes)
+	{
+		std::vector<StackCue*> cues(size);
+		size_t bytes = 0;
+		for (size_t i = 0; i < size; i++)
+		{
+			cues[i] = bench->cue_class->create_func(NULL);
+			bench->cue_class->from_json_func(cues[i], stack_magicq_bench_cue_json(i).c_str());
+		}
+
+		int64_t streamed = INT64_MAX, tree = INT64_MAX;
+		for (int round = 0; round < SMQB_LOAD_ROUNDS; round++)
+		{
+			for (int turn = 0; turn < 2; turn++)
+			{
+				const bool use_tree = (turn == round % 2);
+				size_t turn_bytes = 0;
+				const int64_t start = stack_magicq_transport_now();
+				for (StackCue *cue : cues)
+				{
+					char *json_data = use_tree ? stack_magicq_bench_to_json_tree(cue) : bench->cue_class->to_json_func(cue);
+					turn_bytes += strlen(json_data);
+					if (use_tree)
+					{
+						free(json_data);
+					}
+					else
+					{
+						bench->cue_class->free_json_func(cue, json_data);
+					}
+				}
+				const int64_t elapsed = stack_magicq_transport_now() - start;
+				streamed = use_tree ? streamed : std::min(streamed, elapsed);
+				bytes = use_tree ? bytes : turn_bytes;
+				tree = use_tree ? std::min(tree, elapsed) : tree;
+			}
+		}
+
+		for (StackCue *cue : cues)
+		{
+			bench->cue_class->destroy_func(cue);
+		}
+
+		printf("Saving %lu cues: %.1f ms (%.2f us per cue), or %.1f ms (%.2f us per cue) building a tree of values, for %lu bytes of JSON\n", size,
+			streamed / 1000000.0, streamed / 1000.0 / (double)size, tree / 1000000.0, tree / 1000.0 / (double)size, bytes);
+	}
+
+	return 0;
+}
+
+// Global: The columns that Stack can show for a MagicQ cue, in the order the
+// plugin used to compare their names in
+static const char *smqb_field_names[] = {
+	"playback", "level", "jump_target", "actions", "last_sent", "packets_sent",
+	"bytes_sent", "send_errors", "last_latency_us", "p99_latency_us"
+};
+
+/// Redraws every column of every row of the cue list, as Stack does when the
+/// list is scrolled or refreshed, optionally rendering every field again rather
+/// than using what was rendered last time. Returns how long it took
+static int64_t stack_magicq_bench_redraw(StackMagicQBench *bench, const std::vector<StackCue*> &cues, bool render)
+{
+	size_t characters = 0;
+	const int64_t start = stack_magicq_transport_now();
+	for (StackCue *cue : cues)
+	{
+		if (render)
+		{
+			STACK_MAGICQ_CUE(cue)->dirty_fields = ~(uint32_t)0;
+		}
+		for (const char *field : smqb_field_names)
+		{
+			characters += bench->cue_class->get_field_func(cue, field)[0];
+		}
+	}
+	const int64_t elapsed = stack_magicq_transport_now() - start;
+	smqb_sink = characters;
+
+	return elapsed;
+}
+
+/// Finds which column a name is with a chain of string comparisons, as the
+/// plugin used to. Returns the index of the column, or -1
+static int stack_magicq_bench_compare_field(const char *field)
+{
+	for (size_t i = 0; i < sizeof(smqb_field_names) / sizeof(smqb_field_names[0]); i++)
+	{
+		if (strcmp(field, smqb_field_names[i]) == 0)
+		{
+			return (int)i;
+		}
+	}
+
+	return -1;
+}
+
+/// Times redrawing a cue list of SMQB_FIELD_ROWS cues: with nothing changed since
+/// the last redraw, after every cue has sent (so its metrics columns are rendered
+/// again), and rendering every column every time, as the plugin used to. Also
+/// times finding the columns by name with a chain of string comparisons rather
+/// than a hash table. The best of a few rounds is kept. Returns the exit code of
+/// the tool
+static int stack_magicq_bench_fields(StackMagicQBench *bench)
+{
+	std::vector<StackCue*> cues(SMQB_FIELD_ROWS);
+	for (size_t i = 0; i < cues.size(); i++)
+	{
+		cues[i] = bench->cue_class->create_func(NULL);
+		bench->cue_class->from_json_func(cues[i], stack_magicq_bench_cue_json(i).c_str());
+	}
+	stack_magicq_bench_redraw(bench, cues, false);
+
+	int64_t unchanged = INT64_MAX, after_send = INT64_MAX, rendered = INT64_MAX, compared = INT64_MAX;
+	for (int round = 0; round < SMQB_LOAD_ROUNDS; round++)
+	{
+		unchanged = std::min(unchanged, stack_magicq_bench_redraw(bench, cues, false));
+
+		for (StackCue *cue : cues)
+		{
+			stack_magicq_metrics_record_send(STACK_MAGICQ_CUE(cue)->metrics, 64, true);
+			stack_magicq_metrics_record_latency(STACK_MAGICQ_CUE(cue)->metrics, 100 + round);
+		}
+		after_send = std::min(after_send, stack_magicq_bench_redraw(bench, cues, false));
+
+		rendered = std::min(rendered, stack_magicq_bench_redraw(bench, cues, true));
+
+		int found = 0;
+		const int64_t start = stack_magicq_transport_now();
+		for (size_t i = 0; i < cues.size(); i++)
+		{
+			for (const char *field : smqb_field_names)
+			{
+				found += stack_magicq_bench_compare_field(field);
+			}
+		}
+		compared = std::min(compared, stack_magicq_transport_now() - start);
+		smqb_sink = (size_t)found;
+	}
+
+	for (StackCue *cue : cues)
+	{
+		bench->cue_class->destroy_func(cue);
+	}
+
+	const double fields = (double)(cues.size() * (sizeof(smqb_field_names) / sizeof(smqb_field_names[0])));
+	printf("Redrawing %lu rows of %lu columns: %.2f ms (%.0f ns per field) unchanged, %.2f ms (%.0f ns per field) after every cue sent, %.2f ms (%.0f ns per field) rendering every field\n",
+		cues.size(), sizeof(smqb_field_names) / sizeof(smqb_field_names[0]),
+		unchanged / 1000000.0, unchanged / fields, after_send / 1000000.0, after_send / fields, rendered / 1000000.0, rendered / fields);
+	printf("Finding the columns with string comparisons: %.2f ms (%.0f ns per field)\n", compared / 1000000.0, compared / fields);
+
+	return 0;
+}
+
+/// Gets the size of a command as a packet of its own, in a given protocol (and
+/// for OSC, the style of address currently chosen), without the size that
+/// precedes each bundle element. Returns zero if it can't be encoded
+static size_t stack_magicq_bench_command_size(bool crep, MagicQOperation operation, int16_t playback, int16_t level, const char *cue_id)
+{
+	char elements[STACK_MAGICQ_MAX_ELEMENTS];
+	const size_t length = crep ? stack_magicq_crep_append_operation(elements, 0, sizeof(elements), operation, playback, level, cue_id) : stack_magicq_osc_append_operation(elements, 0, sizeof(elements), operation, playback, level, cue_id);
+	return length > 4 ? length - 4 : 0;
+}
+
+/// Chooses the style of OSC address, as STACK_MAGICQ_OSC_ADDRESSING does
+static void stack_magicq_bench_set_addressing(const char *addressing)
+{
+	setenv("STACK_MAGICQ_OSC_ADDRESSING", addressing, 1);
+	stack_magicq_osc_init();
+}
+
+/// Prints the bytes a fire of the program puts on the network in each protocol:
+/// every command as a datagram of its own, and for OSC, as one bundle. Counts
+/// the IPv4 and UDP headers of each datagram too
+static void stack_magicq_bench_print_program_bytes(const char *label, bool crep, const StackMagicQProgram *program)
+{
+	size_t payload = 0, datagrams = 0;
+	for (size_t i = 0; i < program->step_count; i++)
+	{
+		const StackMagicQStep *step = &program->steps[i];
+		for (int playback = stack_magicq_playback_set_next(&step->playbacks, 0); playback > 0; playback = stack_magicq_playback_set_next(&step->playbacks, playback))
+		{
+			payload += stack_magicq_bench_command_size(crep, step->operation, (int16_t)playback, step->level, step->cue_id);
+			datagrams++;
+		}
+	}
+
+	printf("%-16s %6lu bytes in %lu datagrams", label, payload + datagrams * SMQB_UDP_OVERHEAD, datagrams);
+	if (!crep)
+	{
+		// A bundle has a header, and a size before each message
+		printf(", or %lu bytes as a bundle", STACK_MAGICQ_BUNDLE_HEADER_SIZE + payload + datagrams * 4 + SMQB_UDP_OVERHEAD);
+	}
+	printf("\n");
+}
+
+/// Compares the size of each command, and of a fire of the cue's program, in
+/// CREP and in OSC (with both styles of address). Returns the exit code of the
+/// tool
+static int stack_magicq_bench_crep(StackMagicQBench *bench)
+{
+	StackMagicQProgram program;
+	if (!stack_magicq_program_parse(bench->program, &program))
+	{
+		return 1;
+	}
+
+	const char *addressing = getenv("STACK_MAGICQ_OSC_ADDRESSING");
+	const std::string previous_addressing = addressing != NULL ? addressing : "";
+
+	static const struct { const char *label; MagicQOperation operation; int16_t level; const char *cue_id; } commands[] = {
+		{ "activate 10", MAGICQ_OPERATION_ACTIVATE, 0, "" },
+		{ "release 10", MAGICQ_OPERATION_RELEASE, 0, "" },
+		{ "go 10", MAGICQ_OPERATION_GO, 0, "" },
+		{ "stop 10", MAGICQ_OPERATION_STOP, 0, "" },
+		{ "level 10 50", MAGICQ_OPERATION_SET_LEVEL, 50, "" },
+		{ "jump 10 12.5", MAGICQ_OPERATION_JUMP_TO_CUE_ID, 0, "12.5" },
+	};
+	printf("Bytes per command, without IPv4 and UDP headers (%d bytes per datagram):\n", SMQB_UDP_OVERHEAD);
+	printf("%-16s %6s %9s %11s\n", "Command", "CREP", "OSC /rpc", "OSC struct");
+	for (const auto &command : commands)
+	{
+		const size_t crep = stack_magicq_bench_command_size(true, command.operation, 10, command.level, command.cue_id);
+		stack_magicq_bench_set_addressing("rpc");
+		const size_t rpc = stack_magicq_bench_command_size(false, command.operation, 10, command.level, command.cue_id);
+		stack_magicq_bench_set_addressing("structured");
+		const size_t structured = stack_magicq_bench_command_size(false, command.operation, 10, command.level, command.cue_id);
+		printf("%-16s %6lu %9lu %11lu\n", command.label, crep, rpc, structured);
+	}
+
+	printf("Bytes per fire of the program, with IPv4 and UDP headers:\n");
+	stack_magicq_bench_print_program_bytes("CREP", true, &program);
+	stack_magicq_bench_set_addressing("rpc");
+	stack_magicq_bench_print_program_bytes("OSC /rpc", false, &program);
+	stack_magicq_bench_set_addressing("structured");
+	stack_magicq_bench_print_program_bytes("OSC structured", false, &program);
+
+	stack_magicq_bench_set_addressing(previous_addressing.c_str());
+
+	return 0;
+}
+
+/// Counts the file descriptors the process has open. Returns -1 if they can't
+/// be counted
+static int stack_magicq_bench_count_fds()
+{
+	DIR *dir = opendir("/proc/self/fd");
+	if (dir == NULL)
+	{
+		return -1;
+	}
+
+	int count = 0;
+	for (struct dirent *entry = readdir(dir); entry != NULL; entry = readdir(dir))
+	{
+		count += (entry->d_name[0] != '.') ? 1 : 0;
+	}
+	closedir(dir);
+
+	// Don't count the descriptor we were reading the directory with
+	return count - 1;
+}
+
+/// Compares the file descriptors and first-fire latency of the shared transport
+/// with those of a socket per cue, as the plugin used to have. Every cue but the
+/// first (which has already been fired once) is fired for the first time and
+/// then again, through the plugin. The plugin used to do the same, but created
+/// each cue's socket on its first fire: that is stood in for by sending the
+/// program's datagrams from a new socket per cue, without the rest of the
+/// plugin, so it flatters the old way. Returns the exit code of the tool
+static int stack_magicq_bench_fds(StackMagicQBench *bench)
+{
+	if (bench->cues.size() < 2)
+	{
+		fprintf(stderr, "Needs at least two cues (e.g. -c 1000)\n");
+		return 1;
+	}
+
+	// Through the plugin, whose only socket was opened with it
+	const int fds_before = stack_magicq_bench_count_fds();
+	std::vector<int64_t> first, again;
+	for (int pass = 0; pass < 2; pass++)
+	{
+		for (size_t i = 1; i < bench->cues.size(); i++)
+		{
+			const uint64_t expected = smqb_received.load(std::memory_order_acquire) + bench->per_fire;
+			const int64_t fire_time = stack_magicq_bench_fire(bench->cue_class, bench->cues[i]);
+			if (stack_magicq_bench_wait_for(expected, SMQB_ARRIVAL_TIMEOUT))
+			{
+				(pass == 0 ? first : again).push_back(smqb_last_arrival.load(std::memory_order_relaxed) - fire_time);
+			}
+		}
+	}
+	const int fds_shared = stack_magicq_bench_count_fds();
+
+	// The program's commands, one datagram each
+	StackMagicQProgram program;
+	if (!stack_magicq_program_parse(bench->program, &program))
+	{
+		return 1;
+	}
+	std::vector<std::string> datagrams;
+	for (size_t i = 0; i < program.step_count; i++)
+	{
+		const StackMagicQStep *step = &program.steps[i];
+		for (int playback = stack_magicq_playback_set_next(&step->playbacks, 0); playback > 0; playback = stack_magicq_playback_set_next(&step->playbacks, playback))
+		{
+			char element[STACK_MAGICQ_MAX_ELEMENTS];
+			const size_t length = stack_magicq_bench_snprintf_element(element, 0, sizeof(element), step->operation, playback, step->level, step->cue_id);
+			datagrams.push_back(std::string(&element[4], length > 4 ? length - 4 : 0));
+		}
+	}
+
+	// A socket per cue, created when the cue is first fired
+	struct sockaddr_in destination;
+	socklen_t destination_length = sizeof(destination);
+	getsockname(smqb_sock, (struct sockaddr*)&destination, &destination_length);
+	std::vector<int> sockets;
+	std::vector<int64_t> own_first, own_again;
+	for (int pass = 0; pass < 2; pass++)
+	{
+		for (size_t i = 1; i < bench->cues.size(); i++)
+		{
+			const uint64_t expected = smqb_received.load(std::memory_order_acquire) + datagrams.size();
+			const int64_t fire_time = stack_magicq_transport_now();
+			if (pass == 0)
+			{
+				const int sock = socket(AF_INET, SOCK_DGRAM, 0);
+				if (sock < 0)
+				{
+					break;
+				}
+				sockets.push_back(sock);
+			}
+			if (i > sockets.size())
+			{
+				break;
+			}
+			for (const std::string &datagram : datagrams)
+			{
+				sendto(sockets[i - 1], datagram.data(), datagram.size(), 0, (struct sockaddr*)&destination, destination_length);
+			}
+			if (stack_magicq_bench_wait_for(expected, SMQB_ARRIVAL_TIMEOUT))
+			{
+				(pass == 0 ? own_first : own_again).push_back(smqb_last_arrival.load(std::memory_order_relaxed) - fire_time);
+			}
+		}
+	}
+	const int fds_own = stack_magicq_bench_count_fds();
+	for (int sock : sockets)
+	{
+		close(sock);
+	}
+
+	printf("Open descriptors: %d before firing, %d after firing %lu cues through the shared transport, %d with a socket per cue\n",
+		fds_before, fds_shared, bench->cues.size() - 1, fds_own);
+	if (sockets.size() < bench->cues.size() - 1)
+	{
+		printf("Ran out of descriptors after %lu sockets\n", sockets.size());
+	}
+	stack_magicq_bench_print_times("First fire of a cue, shared transport", first, true);
+	stack_magicq_bench_print_times("Next fire of a cue, shared transport", again, true);
+	stack_magicq_bench_print_times("First fire of a cue, own socket (sending only)", own_first, true);
+	stack_magicq_bench_print_times("Next fire of a cue, own socket (sending only)", own_again, true);
+
+	return 0;
+}
+
+// Global: The things the tool can measure
+static const StackMagicQBenchMode smqb_modes[] = {
+	{ "wire", stack_magicq_bench_wire, "fire-to-wire latency and throughput (the default)" },
+	{ "encode", stack_magicq_bench_encode, "getting a fire ready with messages compiled at play, against encoding on the pulse" },
+	{ "osc", stack_magicq_bench_osc, "commands per second from the typed OSC encoder, against snprintf" },
+	{ "cues", stack_magicq_bench_cues, "play and pulse per cue (e.g. with -c 10000), against looking up properties by name" },
+	{ "load", stack_magicq_bench_load, "loading shows of 1k, 10k and 50k cues" },
+	{ "save", stack_magicq_bench_save, "saving shows of 1k, 10k and 50k cues" },
+	{ "fields", stack_magicq_bench_fields, "redrawing the cue list's columns for 10k rows, against rendering them every time" },
+	{ "crep", stack_magicq_bench_crep, "bytes per command and per fire in CREP, against OSC" },
+	{ "fds", stack_magicq_bench_fds, "descriptors and first-fire latency (e.g. with -c 1000), against a socket per cue" },
+};
+
+/// Prints the usage of the tool
+static void stack_magicq_bench_usage(const char *program)
+{
+	fprintf(stderr, "Usage: %s [-m mode] [-n fires] [-p program] [-c cues] [-w pre-wait] [-i interval]\n", program);
+	fprintf(stderr, "  -m  What to measure (default wire):\n");
+	for (const StackMagicQBenchMode &mode : smqb_modes)
+	{
+		fprintf(stderr, "        %-8s %s\n", mode.name, mode.description);
+	}
+	fprintf(stderr, "  -n  The number of times to fire a cue (default %d)\n", SMQB_DEFAULT_FIRES);
+	fprintf(stderr, "  -p  The program of the cues (default \"%s\")\n", SMQB_DEFAULT_PROGRAM);
+	fprintf(stderr, "  -c  The number of cues to create and fire in turn (default %d)\n", SMQB_DEFAULT_CUES);
+	fprintf(stderr, "  -w  Give the cues a pre-wait of this many milliseconds, and measure\n");
+	fprintf(stderr, "      how far from the end of it their messages arrive\n");
+	fprintf(stderr, "  -i  The microseconds between pulses during a pre-wait (default %d)\n", SMQB_DEFAULT_PULSE_INTERVAL);
+}
+
+int main(int argc, char **argv)
+{
+	StackMagicQBench bench;
+	bench.fires = SMQB_DEFAULT_FIRES;
+	bench.program = SMQB_DEFAULT_PROGRAM;
+	bench.pre_wait = 0;
+	bench.interval = SMQB_DEFAULT_PULSE_INTERVAL * NANOSECS_PER_MICROSEC;
+	size_t cue_count = SMQB_DEFAULT_CUES;
+	const StackMagicQBenchMode *mode = &smqb_modes[0];
+
+	int opt;
+	while ((opt = getopt(argc, argv, "m:n:p:c:w:i:")) != -1)
+	{
+		switch (opt)
+		{
+			case 'm':
+				mode = NULL;
+				for (const StackMagicQBenchMode &candidate : smqb_modes)
+				{
+					if (strcmp(candidate.name, optarg) == 0)
+					{
+						mode = &candidate;
+					}
+				}
+				if (mode == NULL)
+				{
+					stack_magicq_bench_usage(argv[0]);
+					return 1;
+				}
+				break;
+			case 'n':
+				bench.fires = (size_t)strtoul(optarg, NULL, 10);
+				break;
+			case 'p':
+				bench.program = optarg;
+				break;
+			case 'c':
+				cue_count = (size_t)strtoul(optarg, NULL, 10);
+				break;
+			case 'w':
+				bench.pre_wait = (int64_t)strtoul(optarg, NULL, 10) * NANOSECS_PER_MILLISEC;
+				break;
+			case 'i':
+				bench.interval = (int64_t)strtoul(optarg, NULL, 10) * NANOSECS_PER_MICROSEC;
+				break;
+			default:
+				stack_magicq_bench_usage(argv[0]);
+				return 1;
+		}
+	}
+
+	if (bench.fires == 0 || cue_count == 0 || bench.interval <= 0)
+	{
+		stack_magicq_bench_usage(argv[0]);
+		return 1;
+	}
+
+	// Point the plugin at our socket, and start it up
+	uint16_t port = stack_magicq_bench_open_socket();
+	if (port == 0)
+	{
+		return 1;
+	}
+	char destination[32];
+	snprintf(destination, sizeof(destination), "127.0.0.1:%u", port);
+	setenv("STACK_MAGICQ_DESTINATIONS", destination, 1);
+
+	if (!stack_init_plugin())
+	{
+		fprintf(stderr, "The plugin failed to initialise\n");
+		return 1;
+	}
+	smqb_receiver = std::thread(stack_magicq_bench_receiver);
+
+	// Every cue sends its whole program on every fire, even though the previous
+	// fire has already set the same state on the console, or the number of
+	// datagrams per fire wouldn't be fixed (with STACK_MAGICQ_SUPPRESS_REDUNDANT)
+	bench.cue_class = stack_get_cue_class("StackMagicQCue");
+	for (size_t i = 0; i < cue_count; i++)
+	{
+		StackCue *cue = bench.cue_class->create_func(NULL);
+		stack_property_set_string(stack_cue_get_property(cue, "program"), STACK_PROPERTY_VERSION_DEFINED, bench.program);
+		stack_property_set_bool(stack_cue_get_property(cue, "force_send"), STACK_PROPERTY_VERSION_DEFINED, true);
+		char error[256];
+		if (bench.cue_class->get_error_func(cue, error, sizeof(error)))
+		{
+			fprintf(stderr, "Invalid program '%s': %s\n", bench.program, error);
+			return 1;
+		}
+		bench.cues.push_back(cue);
+	}
+
+	// Fire once to find out how many datagrams each fire sends
+	stack_magicq_bench_fire(bench.cue_class, bench.cues[0]);
+	usleep(200000);
+	bench.per_fire = smqb_received.load(std::memory_order_acquire);
+	if (bench.per_fire == 0)
+	{
+		fprintf(stderr, "Nothing arrived from the plugin\n");
+		return 1;
+	}
+
+	printf("Program: %s (%lu datagrams per fire, %lu cue(s))\n", bench.program, bench.per_fire, bench.cues.size());
+	int result = bench.pre_wait > 0 ? stack_magicq_bench_pre_wait(&bench) : mode->func(&bench);
+
+	stack_magicq_bench_finish(bench.cue_class, bench.cues);
+	return result;
+}
@@ -0,0 +1,289 @@
+// stack-magicq-console: a stand-in for a MagicQ console, for testing the plugin
+// without one. It understands the OSC messages and CREP packets the plugin
+// sends, keeps track of the state of each playback, and reports changes back
+// as MagicQ's OSC feedback would. Datagrams can be dropped at random in either direction to
+// exercise reliable delivery (see STACK_MAGICQ_RELIABLE)
+
+// Includes:
+#include "../src/StackMagicQCommand.h"
+#include "stack-magicq-decode.h"
+#include <cmath>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+// The state of a single playback
+struct StackMagicQConsolePlayback
+{
+	int level;
+	bool active;
+	double cue_id;
+};
+
+// Global: The state of every playback
+static StackMagicQConsolePlayback smqc_playbacks[STACK_MAGICQ_MAX_PLAYBACK + 1];
+
+// Global: Where feedback goes, and the socket it goes from
+static struct sockaddr_in smqc_feedback;
+static int smqc_sock = -1;
+
+// Global: The chance of dropping a datagram in each direction (0.0 - 1.0)
+static double smqc_drop_incoming = 0.0;
+static double smqc_drop_feedback = 0.0;
+
+// Global: Whether to print every message
+static bool smqc_verbose = false;
+
+// Global: Counters
+static size_t smqc_received = 0, smqc_dropped = 0;
+static size_t smqc_feedback_sent = 0, smqc_feedback_dropped = 0;
+
+// Global: Set when we are asked to stop
+static volatile sig_atomic_t smqc_stop = 0;
+
+/// Prints the usage of the tool
+static void stack_magicq_console_usage(const char *program)
+{
+	fprintf(stderr, "Usage: %s [-p port] [-f host[:port]] [-d probability] [-D probability] [-v]\n", program);
+	fprintf(stderr, "  -p  The port to listen for commands on (default 8000, use 6553 for CREP)\n");
+	fprintf(stderr, "  -f  Where to send feedback (default 127.0.0.1:9000)\n");
+	fprintf(stderr, "  -d  The chance of dropping each incoming datagram (0.0 - 1.0)\n");
+	fprintf(stderr, "  -D  The chance of dropping each feedback datagram (0.0 - 1.0)\n");
+	fprintf(stderr, "  -v  Print every message received\n");
+}
+
+/// Parses a destination of the form "host[:port]", where host is an IPv4 address
+static bool stack_magicq_console_parse_destination(const char *text, struct sockaddr_in *address)
+{
+	char host[64];
+	strncpy(host, text, sizeof(host) - 1);
+	host[sizeof(host) - 1] = '\0';
+
+	memset(address, 0, sizeof(*address));
+	address->sin_family = AF_INET;
+	address->sin_port = htons(9000);
+
+	char *colon = strrchr(host, ':');
+	if (colon != NULL)
+	{
+		*colon = '\0';
+		int port = atoi(colon + 1);
+		if (port < 1 || port > 65535)
+		{
+			return false;
+		}
+		address->sin_port = htons((uint16_t)port);
+	}
+
+	return inet_pton(AF_INET, host, &address->sin_addr) == 1;
+}
+
+/// Returns whether a datagram should be dropped, given the chance of doing so
+static bool stack_magicq_console_should_drop(double probability)
+{
+	return probability > 0.0 && drand48() < probability;
+}
+
+/// Sends a feedback message with an optional float argument
+static void stack_magicq_console_send_feedback(int playback, const char *suffix, bool has_value, float value)
+{
+	char message[128];
+	memset(message, 0, sizeof(message));
+
+	int address_length = snprintf(message, 64, "/pb/%d%s", playback, suffix);
+	size_t length = ((size_t)address_length + 1 + 3) & ~((size_t)3);
+
+	if (has_value)
+	{
+		memcpy(&message[length], ",f", 2);
+		length += 4;
+
+		uint32_t raw;
+		memcpy(&raw, &value, 4);
+		raw = htonl(raw);
+		memcpy(&message[length], &raw, 4);
+		length += 4;
+	}
+	else
+	{
+		memcpy(&message[length], ",", 1);
+		length += 4;
+	}
+
+	if (stack_magicq_console_should_drop(smqc_drop_feedback))
+	{
+		smqc_feedback_dropped++;
+		return;
+	}
+
+	if (sendto(smqc_sock, message, length, 0, (struct sockaddr *)&smqc_feedback, sizeof(smqc_feedback)) == (ssize_t)length)
+	{
+		smqc_feedback_sent++;
+	}
+}
+
+/// Applies an operation to a playback and reports the result
+static void stack_magicq_console_apply(MagicQOperation operation, int playback, double value, void *user_data)
+{
+	StackMagicQConsolePlayback *pb = &smqc_playbacks[playback];
+	switch (operation)
+	{
+		case MAGICQ_OPERATION_ACTIVATE:
+			pb->active = true;
+			stack_magicq_console_send_feedback(playback, "/activate", false, 0.0f);
+			break;
+		case MAGICQ_OPERATION_RELEASE:
+			pb->active = false;
+			stack_magicq_console_send_feedback(playback, "/release", false, 0.0f);
+			break;
+		case MAGICQ_OPERATION_GO:
+			pb->active = true;
+			pb->cue_id = floor(pb->cue_id) + 1.0;
+			stack_magicq_console_send_feedback(playback, "/go", true, (float)pb->cue_id);
+			break;
+		case MAGICQ_OPERATION_STOP:
+			stack_magicq_console_send_feedback(playback, "/stop", true, (float)pb->cue_id);
+			break;
+		case MAGICQ_OPERATION_SET_LEVEL:
+			pb->level = value < 0.0 ? 0 : (value > 100.0 ? 100 : (int)(value + 0.5));
+			stack_magicq_console_send_feedback(playback, "", true, (float)pb->level);
+			break;
+		case MAGICQ_OPERATION_JUMP_TO_CUE_ID:
+			pb->cue_id = value;
+			stack_magicq_console_send_feedback(playback, "/cue", true, (float)pb->cue_id);
+			break;
+	}
+}
+
+/// Prints each message as it's decoded, if asked to
+static void stack_magicq_console_print_message(const char *text, bool crep, uint8_t sequence, void *user_data)
+{
+	if (!smqc_verbose)
+	{
+		return;
+	}
+
+	if (crep)
+	{
+		printf("CREP #%u: %s\n", (unsigned int)sequence, text);
+	}
+	else
+	{
+		printf("%s\n", text);
+	}
+}
+
+// Global: Decodes what we receive, applying it to smqc_playbacks
+static StackMagicQDecoder smqc_decoder = { stack_magicq_console_apply, stack_magicq_console_print_message, NULL, 0, 0 };
+
+/// Called when we are asked to stop
+static void stack_magicq_console_signal(int signal)
+{
+	smqc_stop = 1;
+}
+
+int main(int argc, char **argv)
+{
+	int port = 8000;
+	if (!stack_magicq_console_parse_destination("127.0.0.1", &smqc_feedback))
+	{
+		return 1;
+	}
+
+	int opt;
+	while ((opt = getopt(argc, argv, "p:f:d:D:v")) != -1)
+	{
+		switch (opt)
+		{
+			case 'p':
+				port = atoi(optarg);
+				if (port < 1 || port > 65535)
+				{
+					fprintf(stderr, "Invalid port: %s\n", optarg);
+					return 1;
+				}
+				break;
+			case 'f':
+				if (!stack_magicq_console_parse_destination(optarg, &smqc_feedback))
+				{
+					fprintf(stderr, "Invalid feedback destination: %s\n", optarg);
+					return 1;
+				}
+				break;
+			case 'd':
+				smqc_drop_incoming = atof(optarg);
+				break;
+			case 'D':
+				smqc_drop_feedback = atof(optarg);
+				break;
+			case 'v':
+				smqc_verbose = true;
+				break;
+			default:
+				stack_magicq_console_usage(argv[0]);
+				return 1;
+		}
+	}
+
+	smqc_sock = socket(PF_INET, SOCK_DGRAM, 0);
+	if (smqc_sock < 0)
+	{
+		fprintf(stderr, "Failed to create socket\n");
+		return 1;
+	}
+
+	struct sockaddr_in bind_address;
+	memset(&bind_address, 0, sizeof(bind_address));
+	bind_address.sin_family = AF_INET;
+	bind_address.sin_addr.s_addr = htonl(INADDR_ANY);
+	bind_address.sin_port = htons((uint16_t)port);
+	if (bind(smqc_sock, (struct sockaddr *)&bind_address, sizeof(bind_address)) != 0)
+	{
+		fprintf(stderr, "Failed to listen on port %d\n", port);
+		close(smqc_sock);
+		return 1;
+	}
+
+	// Stop cleanly (and print the counters) when interrupted. We don't restart
+	// recvfrom() so that it returns when a signal arrives
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = stack_magicq_console_signal;
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+
+	srand48((long)time(NULL));
+	printf("Listening on port %d\n", port);
+	fflush(stdout);
+
+	char buffer[65536];
+	while (!smqc_stop)
+	{
+		ssize_t received = recv(smqc_sock, buffer, sizeof(buffer), 0);
+		if (received <= 0)
+		{
+			continue;
+		}
+
+		smqc_received++;
+		if (stack_magicq_console_should_drop(smqc_drop_incoming))
+		{
+			smqc_dropped++;
+			continue;
+		}
+
+		stack_magicq_decode_packet(&smqc_decoder, buffer, (size_t)received);
+		fflush(stdout);
+	}
+
+	printf("Received %lu datagrams (%lu dropped), %lu messages (%lu not understood); sent %lu feedback datagrams (%lu dropped)\n",
+		smqc_received, smqc_dropped, smqc_decoder.messages, smqc_decoder.unknown, smqc_feedback_sent, smqc_feedback_dropped);
+
+	close(smqc_sock);
+	return 0;
+}
@@ -0,0 +1,176 @@
+// Includes:
+#include "stack-magicq-decode.h"
+#include "../src/StackMagicQCREP.h"
+#include <cstdlib>
+#include <cstring>
+#include <arpa/inet.h>
+
+/// Passes a decoded operation on, if it's for a playback that exists
+static void stack_magicq_decode_apply(StackMagicQDecoder *decoder, MagicQOperation operation, long playback, double value)
+{
+	if (playback < 0 || playback > STACK_MAGICQ_MAX_PLAYBACK)
+	{
+		decoder->unknown++;
+		return;
+	}
+
+	if (decoder->operation != NULL)
+	{
+		decoder->operation(operation, (int)playback, value, decoder->user_data);
+	}
+}
+
+/// Decodes the text of a remote playback command, e.g. "1,50L"
+static bool stack_magicq_decode_rpc(StackMagicQDecoder *decoder, const char *text)
+{
+	char *command = NULL;
+	long playback = strtol(text, &command, 10);
+	if (command == text)
+	{
+		return false;
+	}
+
+	double value = 0.0;
+	if (*command == ',')
+	{
+		value = strtod(command + 1, &command);
+	}
+
+	switch (*command)
+	{
+		case 'A': stack_magicq_decode_apply(decoder, MAGICQ_OPERATION_ACTIVATE, playback, value); return true;
+		case 'R': stack_magicq_decode_apply(decoder, MAGICQ_OPERATION_RELEASE, playback, value); return true;
+		case 'G': stack_magicq_decode_apply(decoder, MAGICQ_OPERATION_GO, playback, value); return true;
+		case 'S': stack_magicq_decode_apply(decoder, MAGICQ_OPERATION_STOP, playback, value); return true;
+		case 'L': stack_magicq_decode_apply(decoder, MAGICQ_OPERATION_SET_LEVEL, playback, value); return true;
+		case 'J': stack_magicq_decode_apply(decoder, MAGICQ_OPERATION_JUMP_TO_CUE_ID, playback, value); return true;
+	}
+
+	return false;
+}
+
+/// Decodes a single OSC message. We understand both styles of address the
+/// plugin sends: /rpc/<n><op> (with ",<value>" before the op for levels and
+/// jumps) and /pb/<n>[/release|/go|/stop] (with a float level for the former)
+static void stack_magicq_decode_message(StackMagicQDecoder *decoder, const char *data, size_t length)
+{
+	const char *end = (const char*)memchr(data, '\0', length);
+	if (end == NULL)
+	{
+		decoder->unknown++;
+		return;
+	}
+
+	decoder->messages++;
+	if (decoder->message != NULL)
+	{
+		decoder->message(data, false, 0, decoder->user_data);
+	}
+
+	char *command = NULL;
+	if (strncmp(data, "/rpc/", 5) == 0)
+	{
+		if (stack_magicq_decode_rpc(decoder, &data[5]))
+		{
+			return;
+		}
+	}
+	else if (strncmp(data, "/pb/", 4) == 0)
+	{
+		long playback = strtol(&data[4], &command, 10);
+		if (*command == '\0')
+		{
+			// The level follows the address and a ",f" type tag
+			size_t offset = ((size_t)(end - data) + 1 + 3) & ~((size_t)3);
+			if (offset + 8 <= length && strncmp(&data[offset], ",f", 2) == 0)
+			{
+				uint32_t raw;
+				float level;
+				memcpy(&raw, &data[offset + 4], 4);
+				raw = ntohl(raw);
+				memcpy(&level, &raw, 4);
+				stack_magicq_decode_apply(decoder, MAGICQ_OPERATION_SET_LEVEL, playback, level);
+				return;
+			}
+		}
+		else if (strcmp(command, "/release") == 0)
+		{
+			stack_magicq_decode_apply(decoder, MAGICQ_OPERATION_RELEASE, playback, 0.0);
+			return;
+		}
+		else if (strcmp(command, "/go") == 0)
+		{
+			stack_magicq_decode_apply(decoder, MAGICQ_OPERATION_GO, playback, 0.0);
+			return;
+		}
+		else if (strcmp(command, "/stop") == 0)
+		{
+			stack_magicq_decode_apply(decoder, MAGICQ_OPERATION_STOP, playback, 0.0);
+			return;
+		}
+	}
+
+	decoder->unknown++;
+}
+
+/// Decodes a ChamSys Remote Ethernet Protocol packet: a ten byte header (with
+/// the version at offset 4 and the length of the command text at offset 8,
+/// both little-endian) followed by the text of a remote playback command
+static void stack_magicq_decode_crep(StackMagicQDecoder *decoder, const char *data, size_t length)
+{
+	unsigned int version = (unsigned int)(uint8_t)data[4] | ((unsigned int)(uint8_t)data[5] << 8);
+	size_t text_length = (size_t)(uint8_t)data[8] | ((size_t)(uint8_t)data[9] << 8);
+	if (version != STACK_MAGICQ_CREP_VERSION || text_length > length - STACK_MAGICQ_CREP_HEADER_SIZE || text_length >= 64)
+	{
+		decoder->unknown++;
+		return;
+	}
+
+	char text[64];
+	memcpy(text, &data[STACK_MAGICQ_CREP_HEADER_SIZE], text_length);
+	text[text_length] = '\0';
+
+	decoder->messages++;
+	if (decoder->message != NULL)
+	{
+		decoder->message(text, true, (uint8_t)data[STACK_MAGICQ_CREP_SEQUENCE_OFFSET], decoder->user_data);
+	}
+
+	if (!stack_magicq_decode_rpc(decoder, text))
+	{
+		decoder->unknown++;
+	}
+}
+
+/// Decodes an OSC packet, which may be a message or a (nested) bundle, or a
+/// CREP packet
+void stack_magicq_decode_packet(StackMagicQDecoder *decoder, const char *data, size_t length)
+{
+	if (length >= STACK_MAGICQ_CREP_HEADER_SIZE && memcmp(data, "CREP", 4) == 0)
+	{
+		stack_magicq_decode_crep(decoder, data, length);
+	}
+	else if (length >= 16 && memcmp(data, "#bundle", 8) == 0)
+	{
+		size_t offset = 16;
+		while (offset + 4 <= length)
+		{
+			uint32_t element_size;
+			memcpy(&element_size, &data[offset], 4);
+			element_size = ntohl(element_size);
+			offset += 4;
+
+			if (element_size > length - offset)
+			{
+				break;
+			}
+
+			stack_magicq_decode_packet(decoder, &data[offset], element_size);
+			offset += element_size;
+		}
+	}
+	else if (length >= 4 && data[0] == '/')
+	{
+		stack_magicq_decode_message(decoder, data, length);
+	}
+}
@@ -0,0 +1,35 @@
+#ifndef _STACKMAGICQDECODE_H_INCLUDED
+#define _STACKMAGICQDECODE_H_INCLUDED
+
+// Decoding of the datagrams the MagicQ plugin sends, as a console would see
+// them. Shared by stack-magicq-console and the encoder tests
+
+// Includes:
+#include "../src/StackMagicQCommand.h"
+#include <cstddef>
+#include <cstdint>
+
+// Called for each operation decoded from a datagram. The value is the level
+// for SET_LEVEL, the cue ID for JUMP_TO_CUE_ID, and zero otherwise
+typedef void (*stack_magicq_decode_operation_t)(MagicQOperation operation, int playback, double value, void *user_data);
+
+// Called with the text of each message: the address of an OSC message, or the
+// command text of a CREP packet along with its forward sequence number
+typedef void (*stack_magicq_decode_message_t)(const char *text, bool crep, uint8_t sequence, void *user_data);
+
+struct StackMagicQDecoder
+{
+	// Callbacks (either may be NULL), and the data passed to them
+	stack_magicq_decode_operation_t operation;
+	stack_magicq_decode_message_t message;
+	void *user_data;
+
+	// The number of messages seen, and the number that weren't understood
+	size_t messages;
+	size_t unknown;
+};
+
+// Functions:
+void stack_magicq_decode_packet(StackMagicQDecoder *decoder, const char *data, size_t length);
+
+#endif
@@ -0,0 +1,224 @@
+// stack-magicq-replay: re-sends the datagrams in a capture file written by the
+// MagicQ plugin (see STACK_MAGICQ_CAPTURE_FILE) to a UDP destination, either
+// with their original timing or as fast as possible
+
+// Includes:
+#include "../src/StackMagicQCapture.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+
+/// Prints the usage of the tool
+static void stack_magicq_replay_usage(const char *program)
+{
+	fprintf(stderr, "Usage: %s [-f] [-i] [-a host[:port]] <capture file> [host[:port]]\n", program);
+	fprintf(stderr, "  -f  Send as fast as possible, rather than with the original timing\n");
+	fprintf(stderr, "  -i  Replay the incoming (feedback) datagrams rather than the outgoing ones\n");
+	fprintf(stderr, "  -a  Only replay the datagrams sent to (or received from) this address. The\n");
+	fprintf(stderr, "      plugin captures a copy of each datagram for every destination, so this\n");
+	fprintf(stderr, "      defaults to the address of the first datagram in the capture\n");
+	fprintf(stderr, "The destination defaults to 127.0.0.1:8000\n");
+}
+
+/// Parses a destination of the form "host[:port]", where host is an IPv4 address
+static bool stack_magicq_replay_parse_destination(const char *text, struct sockaddr_in *address)
+{
+	char host[64];
+	strncpy(host, text, sizeof(host) - 1);
+	host[sizeof(host) - 1] = '\0';
+
+	memset(address, 0, sizeof(*address));
+	address->sin_family = AF_INET;
+	address->sin_port = htons(8000);
+
+	char *colon = strrchr(host, ':');
+	if (colon != NULL)
+	{
+		*colon = '\0';
+		int port = atoi(colon + 1);
+		if (port < 1 || port > 65535)
+		{
+			return false;
+		}
+		address->sin_port = htons((uint16_t)port);
+	}
+
+	return inet_pton(AF_INET, host, &address->sin_addr) == 1;
+}
+
+int main(int argc, char **argv)
+{
+	bool fast = false;
+	StackMagicQCaptureDirection direction = STACK_MAGICQ_CAPTURE_OUTGOING;
+	bool have_filter = false;
+	struct sockaddr_in filter;
+	memset(&filter, 0, sizeof(filter));
+
+	int opt;
+	while ((opt = getopt(argc, argv, "fia:")) != -1)
+	{
+		switch (opt)
+		{
+			case 'a':
+				if (!stack_magicq_replay_parse_destination(optarg, &filter))
+				{
+					fprintf(stderr, "Invalid address: %s\n", optarg);
+					return 1;
+				}
+				have_filter = true;
+				break;
+			case 'f':
+				fast = true;
+				break;
+			case 'i':
+				direction = STACK_MAGICQ_CAPTURE_INCOMING;
+				break;
+			default:
+				stack_magicq_replay_usage(argv[0]);
+				return 1;
+		}
+	}
+
+	if (optind >= argc)
+	{
+		stack_magicq_replay_usage(argv[0]);
+		return 1;
+	}
+
+	struct sockaddr_in dest;
+	if (!stack_magicq_replay_parse_destination(optind + 1 < argc ? argv[optind + 1] : "127.0.0.1", &dest))
+	{
+		fprintf(stderr, "Invalid destination: %s\n", argv[optind + 1]);
+		return 1;
+	}
+
+	// Map the capture file
+	int fd = open(argv[optind], O_RDONLY);
+	if (fd < 0)
+	{
+		fprintf(stderr, "Failed to open %s\n", argv[optind]);
+		return 1;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(StackMagicQCaptureHeader))
+	{
+		fprintf(stderr, "%s is not a capture file\n", argv[optind]);
+		close(fd);
+		return 1;
+	}
+
+	void *mapping = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (mapping == MAP_FAILED)
+	{
+		fprintf(stderr, "Failed to map %s\n", argv[optind]);
+		return 1;
+	}
+
+	// Check that it's a capture we understand
+	const StackMagicQCaptureHeader *header = (const StackMagicQCaptureHeader*)mapping;
+	if (memcmp(header->magic, STACK_MAGICQ_CAPTURE_MAGIC, sizeof(header->magic)) != 0 || header->version != STACK_MAGICQ_CAPTURE_VERSION || header->record_size != sizeof(StackMagicQCaptureRecord)
+		|| sizeof(StackMagicQCaptureHeader) + header->record_count * sizeof(StackMagicQCaptureRecord) > (size_t)st.st_size)
+	{
+		fprintf(stderr, "%s is not a compatible capture file\n", argv[optind]);
+		return 1;
+	}
+
+	// Gather the complete records in the direction we want, in the order in
+	// which they were written
+	const StackMagicQCaptureRecord *records = (const StackMagicQCaptureRecord*)((const char*)mapping + sizeof(StackMagicQCaptureHeader));
+	std::vector<const StackMagicQCaptureRecord*> replay;
+	for (uint64_t i = 0; i < header->record_count; i++)
+	{
+		if (records[i].sequence.load() != 0 && records[i].direction == (uint32_t)direction && records[i].length <= STACK_MAGICQ_CAPTURE_MAX_DATA)
+		{
+			replay.push_back(&records[i]);
+		}
+	}
+	std::sort(replay.begin(), replay.end(), [](const StackMagicQCaptureRecord *a, const StackMagicQCaptureRecord *b) {
+		return a->sequence.load() < b->sequence.load();
+	});
+
+	// Every datagram is captured once for each destination it went to, so
+	// only replay those for a single address, or we'd send each one several
+	// times over
+	if (!have_filter && !replay.empty())
+	{
+		memset(&filter, 0, sizeof(filter));
+		filter.sin_family = AF_INET;
+		filter.sin_addr.s_addr = replay.front()->address;
+		filter.sin_port = replay.front()->port;
+	}
+	replay.erase(std::remove_if(replay.begin(), replay.end(), [&filter](const StackMagicQCaptureRecord *record) {
+		return record->address != filter.sin_addr.s_addr || record->port != filter.sin_port;
+	}), replay.end());
+
+	char filter_host[INET_ADDRSTRLEN];
+	inet_ntop(AF_INET, &filter.sin_addr, filter_host, sizeof(filter_host));
+	printf("Replaying the datagrams %s %s:%u\n", direction == STACK_MAGICQ_CAPTURE_OUTGOING ? "sent to" : "received from", filter_host, (unsigned int)ntohs(filter.sin_port));
+
+	int sock = socket(PF_INET, SOCK_DGRAM, 0);
+	if (sock < 0)
+	{
+		fprintf(stderr, "Failed to create socket\n");
+		return 1;
+	}
+
+	// Send them, keeping the original gaps between them unless asked not to
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	int64_t start_ns = (int64_t)start.tv_sec * 1000000000 + start.tv_nsec;
+	size_t sent = 0, failed = 0;
+	for (const StackMagicQCaptureRecord *record : replay)
+	{
+		if (!fast)
+		{
+			int64_t due = start_ns + (record->timestamp - replay.front()->timestamp);
+			struct timespec due_ts;
+			due_ts.tv_sec = due / 1000000000;
+			due_ts.tv_nsec = due % 1000000000;
+
+			// Only sleep again if we were interrupted. On any other error,
+			// send it now rather than never
+			int error;
+			do
+			{
+				error = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due_ts, NULL);
+			} while (error == EINTR);
+		}
+
+		if (sendto(sock, record->data, record->length, 0, (struct sockaddr *)&dest, sizeof(dest)) == (ssize_t)record->length)
+		{
+			sent++;
+		}
+		else
+		{
+			failed++;
+		}
+	}
+
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double elapsed = (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+	printf("Replayed %lu datagrams (%lu failed) in %.3fs", sent, failed, elapsed);
+	if (elapsed > 0.0)
+	{
+		printf(" (%.0f datagrams/s)", (double)sent / elapsed);
+	}
+	printf("\n");
+
+	close(sock);
+	munmap(mapping, (size_t)st.st_size);
+	return failed > 0 ? 2 : 0;
+}
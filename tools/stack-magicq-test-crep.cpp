@@ -0,0 +1,170 @@
+// stack-magicq-test-crep: checks that the ChamSys Remote Ethernet Protocol
+// packets the plugin encodes have the header MagicQ expects, and decode to the
+// same operations as a console (in the shape of stack-magicq-console) would
+// see them
+
+// Includes:
+#include "../src/StackMagicQCREP.h"
+#include "stack-magicq-decode.h"
+#include <cmath>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <arpa/inet.h>
+
+// Checks a condition, reporting it if it fails
+#define SMQT_CHECK(_c) stack_magicq_test_check((_c), #_c, __LINE__)
+
+// An operation to encode, the command text it should be sent as, and what it
+// should decode as
+struct StackMagicQTestCase
+{
+	MagicQOperation operation;
+	int16_t playback;
+	int16_t level;
+	const char *cue_id;
+	const char *text;
+	double value;
+};
+
+// Global: One of every operation, on a spread of playbacks
+static const StackMagicQTestCase smqt_cases[] = {
+	{ MAGICQ_OPERATION_ACTIVATE, 1, 0, NULL, "1A", 0.0 },
+	{ MAGICQ_OPERATION_RELEASE, 2, 0, NULL, "2R", 0.0 },
+	{ MAGICQ_OPERATION_GO, 3, 0, NULL, "3G", 0.0 },
+	{ MAGICQ_OPERATION_STOP, 4, 0, NULL, "4S", 0.0 },
+	{ MAGICQ_OPERATION_SET_LEVEL, 5, 50, NULL, "5,50L", 50.0 },
+	{ MAGICQ_OPERATION_SET_LEVEL, STACK_MAGICQ_MAX_PLAYBACK, 100, NULL, "255,100L", 100.0 },
+	{ MAGICQ_OPERATION_JUMP_TO_CUE_ID, 6, 0, "12.5", "6,12.5J", 12.5 },
+};
+
+// Global: What the decoder found
+static MagicQOperation smqt_operation;
+static int smqt_playback;
+static double smqt_value;
+static size_t smqt_operations = 0;
+static uint8_t smqt_sequence;
+
+// Global: The number of checks that failed
+static int smqt_failures = 0;
+
+// The plugin's encoder uses the OSC encoder's logging
+void stack_log(const char *format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	vfprintf(stderr, format, args);
+	va_end(args);
+}
+
+static void stack_magicq_test_check(bool condition, const char *text, int line)
+{
+	if (!condition)
+	{
+		fprintf(stderr, "Line %d: check failed: %s\n", line, text);
+		smqt_failures++;
+	}
+}
+
+/// Records the operation that the decoder finds
+static void stack_magicq_test_record(MagicQOperation operation, int playback, double value, void *user_data)
+{
+	smqt_operation = operation;
+	smqt_playback = playback;
+	smqt_value = value;
+	smqt_operations++;
+}
+
+/// Records the sequence number of the packet that the decoder finds
+static void stack_magicq_test_record_message(const char *text, bool crep, uint8_t sequence, void *user_data)
+{
+	SMQT_CHECK(crep);
+	smqt_sequence = sequence;
+}
+
+/// Encodes every case, checking the header byte by byte, then stamps a
+/// sequence number on it (as the transport does) and decodes it
+static void stack_magicq_test_packets()
+{
+	uint8_t sequence = 250;
+	for (const StackMagicQTestCase &test : smqt_cases)
+	{
+		char elements[128];
+		size_t length = stack_magicq_crep_append_operation(elements, 0, sizeof(elements), test.operation, test.playback, test.level, test.cue_id);
+		size_t text_length = strlen(test.text);
+		SMQT_CHECK(length == 4 + STACK_MAGICQ_CREP_HEADER_SIZE + text_length);
+
+		// The element size is big-endian, like an OSC bundle element's
+		uint32_t element_size;
+		memcpy(&element_size, elements, 4);
+		SMQT_CHECK(ntohl(element_size) == STACK_MAGICQ_CREP_HEADER_SIZE + text_length);
+
+		// "CREP", the version (little-endian), zeroed sequence numbers, and the
+		// length of the text (little-endian), then the text unterminated
+		const unsigned char *packet = (const unsigned char*)&elements[4];
+		SMQT_CHECK(memcmp(packet, "CREP", 4) == 0);
+		SMQT_CHECK(packet[4] == (STACK_MAGICQ_CREP_VERSION & 0xff));
+		SMQT_CHECK(packet[5] == (STACK_MAGICQ_CREP_VERSION >> 8));
+		SMQT_CHECK(packet[STACK_MAGICQ_CREP_SEQUENCE_OFFSET] == 0);
+		SMQT_CHECK(packet[7] == 0);
+		SMQT_CHECK(packet[8] == (text_length & 0xff));
+		SMQT_CHECK(packet[9] == (text_length >> 8));
+		SMQT_CHECK(memcmp(&packet[STACK_MAGICQ_CREP_HEADER_SIZE], test.text, text_length) == 0);
+
+		elements[4 + STACK_MAGICQ_CREP_SEQUENCE_OFFSET] = (char)sequence;
+		StackMagicQDecoder decoder = { stack_magicq_test_record, stack_magicq_test_record_message, NULL, 0, 0 };
+		smqt_operations = 0;
+		stack_magicq_decode_packet(&decoder, &elements[4], length - 4);
+		SMQT_CHECK(decoder.messages == 1);
+		SMQT_CHECK(decoder.unknown == 0);
+		SMQT_CHECK(smqt_operations == 1);
+		SMQT_CHECK(smqt_sequence == sequence);
+		SMQT_CHECK(smqt_operation == test.operation);
+		SMQT_CHECK(smqt_playback == test.playback);
+		SMQT_CHECK(fabs(smqt_value - test.value) < 0.001);
+
+		// Wrap around, as the transport's counter does
+		sequence++;
+	}
+}
+
+/// Checks that nothing is written when a packet doesn't fit, and that packets
+/// with another version or a length beyond the datagram aren't understood
+static void stack_magicq_test_limits()
+{
+	char elements[16];
+	memset(elements, 0x55, sizeof(elements));
+	SMQT_CHECK(stack_magicq_crep_append_operation(elements, 4, sizeof(elements), MAGICQ_OPERATION_SET_LEVEL, 1, 50, NULL) == 4);
+	SMQT_CHECK(elements[4] == 0x55);
+
+	char packet[64];
+	size_t length = stack_magicq_crep_append_operation(packet, 0, sizeof(packet), MAGICQ_OPERATION_GO, 1, 0, NULL) - 4;
+
+	StackMagicQDecoder decoder = { stack_magicq_test_record, NULL, NULL, 0, 0 };
+	smqt_operations = 0;
+	packet[4 + 4] = 1;
+	stack_magicq_decode_packet(&decoder, &packet[4], length);
+	SMQT_CHECK(smqt_operations == 0);
+	SMQT_CHECK(decoder.unknown == 1);
+
+	packet[4 + 4] = 0;
+	packet[4 + 8] = (char)(length - STACK_MAGICQ_CREP_HEADER_SIZE + 1);
+	stack_magicq_decode_packet(&decoder, &packet[4], length);
+	SMQT_CHECK(smqt_operations == 0);
+	SMQT_CHECK(decoder.unknown == 2);
+}
+
+int main(int argc, char **argv)
+{
+	stack_magicq_test_packets();
+	stack_magicq_test_limits();
+
+	if (smqt_failures > 0)
+	{
+		fprintf(stderr, "%d check(s) failed\n", smqt_failures);
+		return 1;
+	}
+
+	printf("All CREP checks passed\n");
+	return 0;
+}
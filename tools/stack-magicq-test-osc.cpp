@@ -0,0 +1,197 @@
+// stack-magicq-test-osc: checks that the OSC the plugin encodes, in both styles
+// of address and as bundles, decodes to the same operations as a console (in
+// the shape of stack-magicq-console) would see them
+
+// Includes:
+#include "../src/StackMagicQOSC.h"
+#include "stack-magicq-decode.h"
+#include <cmath>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+// Defines:
+#define SMQT_MAX_DECODED 32
+
+// Checks a condition, reporting it if it fails
+#define SMQT_CHECK(_c) stack_magicq_test_check((_c), #_c, __LINE__)
+
+// An operation that has been decoded
+struct StackMagicQTestDecoded
+{
+	MagicQOperation operation;
+	int playback;
+	double value;
+};
+
+// An operation to encode, and what it should decode as
+struct StackMagicQTestCase
+{
+	MagicQOperation operation;
+	int16_t playback;
+	int16_t level;
+	const char *cue_id;
+	double value;
+};
+
+// Global: The operations decoded so far
+static StackMagicQTestDecoded smqt_decoded[SMQT_MAX_DECODED];
+static size_t smqt_decoded_count = 0;
+
+// Global: The number of checks that failed
+static int smqt_failures = 0;
+
+// Global: One of every operation, on a spread of playbacks
+static const StackMagicQTestCase smqt_cases[] = {
+	{ MAGICQ_OPERATION_ACTIVATE, 1, 0, NULL, 0.0 },
+	{ MAGICQ_OPERATION_RELEASE, 2, 0, NULL, 0.0 },
+	{ MAGICQ_OPERATION_GO, 3, 0, NULL, 0.0 },
+	{ MAGICQ_OPERATION_STOP, 4, 0, NULL, 0.0 },
+	{ MAGICQ_OPERATION_SET_LEVEL, 5, 50, NULL, 50.0 },
+	{ MAGICQ_OPERATION_SET_LEVEL, 0, 0, NULL, 0.0 },
+	{ MAGICQ_OPERATION_SET_LEVEL, STACK_MAGICQ_MAX_PLAYBACK, 100, NULL, 100.0 },
+	{ MAGICQ_OPERATION_JUMP_TO_CUE_ID, 6, 0, "12.5", 12.5 },
+	{ MAGICQ_OPERATION_JUMP_TO_CUE_ID, 7, 0, "3", 3.0 },
+};
+
+// The plugin's encoder logs when it's configured
+void stack_log(const char *format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	vfprintf(stderr, format, args);
+	va_end(args);
+}
+
+static void stack_magicq_test_check(bool condition, const char *text, int line)
+{
+	if (!condition)
+	{
+		fprintf(stderr, "Line %d: check failed: %s\n", line, text);
+		smqt_failures++;
+	}
+}
+
+/// Records each operation that the decoder finds
+static void stack_magicq_test_record(MagicQOperation operation, int playback, double value, void *user_data)
+{
+	if (smqt_decoded_count < SMQT_MAX_DECODED)
+	{
+		smqt_decoded[smqt_decoded_count++] = StackMagicQTestDecoded{ operation, playback, value };
+	}
+}
+
+/// Checks that a decoded operation is the one that was encoded
+static void stack_magicq_test_check_decoded(const StackMagicQTestDecoded *decoded, const StackMagicQTestCase *test)
+{
+	SMQT_CHECK(decoded->operation == test->operation);
+	SMQT_CHECK(decoded->playback == test->playback);
+	SMQT_CHECK(fabs(decoded->value - test->value) < 0.001);
+}
+
+/// Encodes every case as a separate message, decoding each one on its own as
+/// it would arrive when bundles are off
+static void stack_magicq_test_messages(const char *addressing)
+{
+	setenv("STACK_MAGICQ_OSC_ADDRESSING", addressing, 1);
+	stack_magicq_osc_init();
+
+	for (const StackMagicQTestCase &test : smqt_cases)
+	{
+		char elements[256];
+		size_t length = stack_magicq_osc_append_operation(elements, 0, sizeof(elements), test.operation, test.playback, test.level, test.cue_id);
+		SMQT_CHECK(length > 4);
+
+		// The element size should cover exactly the rest of the element, and
+		// OSC messages are always a multiple of four bytes long
+		uint32_t element_size;
+		memcpy(&element_size, elements, 4);
+		element_size = ntohl(element_size);
+		SMQT_CHECK(element_size == length - 4);
+		SMQT_CHECK(element_size % 4 == 0);
+
+		StackMagicQDecoder decoder = { stack_magicq_test_record, NULL, NULL, 0, 0 };
+		smqt_decoded_count = 0;
+		stack_magicq_decode_packet(&decoder, &elements[4], element_size);
+		SMQT_CHECK(decoder.messages == 1);
+		SMQT_CHECK(decoder.unknown == 0);
+		SMQT_CHECK(smqt_decoded_count == 1);
+		if (smqt_decoded_count == 1)
+		{
+			stack_magicq_test_check_decoded(&smqt_decoded[0], &test);
+		}
+	}
+}
+
+/// Encodes every case in to a single bundle, as the transport sends them when
+/// bundles are on, and checks they all decode in order
+static void stack_magicq_test_bundle(const char *addressing)
+{
+	setenv("STACK_MAGICQ_OSC_ADDRESSING", addressing, 1);
+	stack_magicq_osc_init();
+
+	// "#bundle", then a timetag of 1 ("immediately"), then the elements
+	char bundle[1024] = { '#', 'b', 'u', 'n', 'd', 'l', 'e', '\0', 0, 0, 0, 0, 0, 0, 0, 1 };
+	size_t length = 16;
+	size_t case_count = sizeof(smqt_cases) / sizeof(smqt_cases[0]);
+	for (const StackMagicQTestCase &test : smqt_cases)
+	{
+		size_t new_length = stack_magicq_osc_append_operation(bundle, length, sizeof(bundle), test.operation, test.playback, test.level, test.cue_id);
+		SMQT_CHECK(new_length > length);
+		length = new_length;
+	}
+
+	StackMagicQDecoder decoder = { stack_magicq_test_record, NULL, NULL, 0, 0 };
+	smqt_decoded_count = 0;
+	stack_magicq_decode_packet(&decoder, bundle, length);
+	SMQT_CHECK(decoder.messages == case_count);
+	SMQT_CHECK(decoder.unknown == 0);
+	SMQT_CHECK(smqt_decoded_count == case_count);
+	for (size_t i = 0; i < case_count && i < smqt_decoded_count; i++)
+	{
+		stack_magicq_test_check_decoded(&smqt_decoded[i], &smqt_cases[i]);
+	}
+}
+
+/// Checks that nothing is written when a message doesn't fit, and that long
+/// cue IDs are truncated to the longest address rather than overrunning it
+static void stack_magicq_test_limits()
+{
+	setenv("STACK_MAGICQ_OSC_ADDRESSING", "rpc", 1);
+	stack_magicq_osc_init();
+
+	char elements[16];
+	memset(elements, 0x55, sizeof(elements));
+	SMQT_CHECK(stack_magicq_osc_append_operation(elements, 4, sizeof(elements), MAGICQ_OPERATION_SET_LEVEL, 1, 50, NULL) == 4);
+	SMQT_CHECK(elements[4] == 0x55);
+
+	char cue_id[STACK_MAGICQ_OSC_MAX_ADDRESS * 2];
+	memset(cue_id, '1', sizeof(cue_id) - 1);
+	cue_id[sizeof(cue_id) - 1] = '\0';
+
+	char address[STACK_MAGICQ_OSC_MAX_ADDRESS + 1];
+	address[STACK_MAGICQ_OSC_MAX_ADDRESS] = 0x55;
+	size_t length = stack_magicq_osc_append_rpc_command(address, 0, MAGICQ_OPERATION_JUMP_TO_CUE_ID, 1, 0, cue_id);
+	SMQT_CHECK(length == STACK_MAGICQ_OSC_MAX_ADDRESS - 1);
+	SMQT_CHECK(strlen(address) == length);
+	SMQT_CHECK(address[STACK_MAGICQ_OSC_MAX_ADDRESS] == 0x55);
+}
+
+int main(int argc, char **argv)
+{
+	stack_magicq_test_messages("rpc");
+	stack_magicq_test_messages("structured");
+	stack_magicq_test_bundle("rpc");
+	stack_magicq_test_bundle("structured");
+	stack_magicq_test_limits();
+
+	if (smqt_failures > 0)
+	{
+		fprintf(stderr, "%d check(s) failed\n", smqt_failures);
+		return 1;
+	}
+
+	printf("All OSC checks passed\n");
+	return 0;
+}
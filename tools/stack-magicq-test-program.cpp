@@ -0,0 +1,293 @@
+// stack-magicq-test-program: checks the parsing and formatting of playback sets
+// and cue programs, and that programs are saved to and loaded from JSON
+// (including the fixed set of actions that older shows store). The cue is
+// hosted on the stand-in for Stack in tools/stub
+
+// Includes:
+#include "StackCue.h"
+#include "../src/StackMagicQPlaybackSet.h"
+#include "../src/StackMagicQProgram.h"
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+// The entry point of the plugin
+extern "C" bool stack_init_plugin();
+
+// Checks a condition, reporting it if it fails
+#define SMQT_CHECK(_c) stack_magicq_test_check((_c), #_c, __LINE__)
+
+// Global: The number of checks that failed
+static int smqt_failures = 0;
+
+static void stack_magicq_test_check(bool condition, const char *text, int line)
+{
+	if (!condition)
+	{
+		fprintf(stderr, "Line %d: check failed: %s\n", line, text);
+		smqt_failures++;
+	}
+}
+
+/// Parses a playback set and formats it again, returning the text (or
+/// "invalid" if it didn't parse)
+static std::string stack_magicq_test_set(const char *text)
+{
+	StackMagicQPlaybackSet set;
+	if (!stack_magicq_playback_set_parse(text, &set))
+	{
+		return "invalid";
+	}
+
+	char formatted[STACK_MAGICQ_PLAYBACK_SET_MAX_TEXT];
+	stack_magicq_playback_set_format(&set, formatted, sizeof(formatted));
+	return formatted;
+}
+
+/// Parses a program and formats it again, returning the text (or "invalid"
+/// if it didn't parse)
+static std::string stack_magicq_test_program(const char *text)
+{
+	StackMagicQProgram program;
+	if (!stack_magicq_program_parse(text, &program))
+	{
+		return "invalid";
+	}
+
+	char formatted[STACK_MAGICQ_PROGRAM_MAX_TEXT];
+	stack_magicq_program_format(&program, formatted, sizeof(formatted));
+	return formatted;
+}
+
+/// Checks playback sets, including spaces within them and the limits
+static void stack_magicq_test_sets()
+{
+	SMQT_CHECK(stack_magicq_test_set("1-8,12,15") == "1-8,12,15");
+	SMQT_CHECK(stack_magicq_test_set("1, 2") == "1-2");
+	SMQT_CHECK(stack_magicq_test_set("1 - 4") == "1-4");
+	SMQT_CHECK(stack_magicq_test_set(" 5 , 3,4 ") == "3-5");
+	SMQT_CHECK(stack_magicq_test_set("255") == "255");
+	SMQT_CHECK(stack_magicq_test_set("") == "");
+
+	SMQT_CHECK(stack_magicq_test_set("0") == "invalid");
+	SMQT_CHECK(stack_magicq_test_set("256") == "invalid");
+	SMQT_CHECK(stack_magicq_test_set("4-1") == "invalid");
+	SMQT_CHECK(stack_magicq_test_set("1,") == "invalid");
+	SMQT_CHECK(stack_magicq_test_set("1 2") == "invalid");
+	SMQT_CHECK(stack_magicq_test_set("a") == "invalid");
+
+	StackMagicQPlaybackSet set;
+	stack_magicq_playback_set_parse("1-4,200", &set);
+	SMQT_CHECK(stack_magicq_playback_set_count(&set) == 5);
+	SMQT_CHECK(stack_magicq_playback_set_contains(&set, 200));
+	SMQT_CHECK(!stack_magicq_playback_set_contains(&set, 5));
+	SMQT_CHECK(stack_magicq_playback_set_next(&set, 4) == 200);
+	SMQT_CHECK(stack_magicq_playback_set_next(&set, 200) == -1);
+}
+
+/// Checks that programs survive being parsed and formatted, in their tidiest
+/// form
+static void stack_magicq_test_round_trips()
+{
+	const char *canonical = "activate 1-4; level 1-4 50; go 5; jump 6 2.5";
+	SMQT_CHECK(stack_magicq_test_program(canonical) == canonical);
+	SMQT_CHECK(stack_magicq_test_program(stack_magicq_test_program(canonical).c_str()) == canonical);
+
+	StackMagicQProgram program;
+	SMQT_CHECK(stack_magicq_program_parse(canonical, &program));
+	SMQT_CHECK(program.step_count == 4);
+	SMQT_CHECK(program.steps[1].operation == MAGICQ_OPERATION_SET_LEVEL);
+	SMQT_CHECK(program.steps[1].level == 50);
+	SMQT_CHECK(program.steps[3].operation == MAGICQ_OPERATION_JUMP_TO_CUE_ID);
+	SMQT_CHECK(strcmp(program.steps[3].cue_id, "2.5") == 0);
+
+	// Spaces within playback sets, new lines, case and empty steps
+	SMQT_CHECK(stack_magicq_test_program("activate 1, 2") == "activate 1-2");
+	SMQT_CHECK(stack_magicq_test_program("level 1 - 4 50") == "level 1-4 50");
+	SMQT_CHECK(stack_magicq_test_program("jump 1,2 5") == "jump 1-2 5");
+	SMQT_CHECK(stack_magicq_test_program("jump 1, 2") == "jump 1-2");
+	SMQT_CHECK(stack_magicq_test_program("  GO 5 ;\n stop 4 ;; release 1 ,2 ") == "go 5; stop 4; release 1-2");
+	SMQT_CHECK(stack_magicq_test_program("") == "");
+
+	// Missing playbacks, arguments and unknown operations
+	SMQT_CHECK(stack_magicq_test_program("go") == "invalid");
+	SMQT_CHECK(stack_magicq_test_program("level 1") == "invalid");
+	SMQT_CHECK(stack_magicq_test_program("level 50") == "invalid");
+	SMQT_CHECK(stack_magicq_test_program("activate 1 2") == "invalid");
+	SMQT_CHECK(stack_magicq_test_program("activate 1,") == "invalid");
+	SMQT_CHECK(stack_magicq_test_program("flash 1") == "invalid");
+	SMQT_CHECK(stack_magicq_test_program("go 1; flash 1") == "invalid");
+}
+
+/// Checks that only plain decimal cue IDs are accepted, whether parsed or added
+/// directly (as when loading a show)
+static void stack_magicq_test_cue_ids()
+{
+	SMQT_CHECK(stack_magicq_test_program("jump 3 12") == "jump 3 12");
+	SMQT_CHECK(stack_magicq_test_program("jump 3 12.25") == "jump 3 12.25");
+
+	const char *invalid[] = { "nan", "inf", "1e3", "0x10", ".5", "5.", "-1", "1.2.3", "12a", "12345678901234567" };
+	for (const char *cue_id : invalid)
+	{
+		std::string text = std::string("jump 3 ") + cue_id;
+		SMQT_CHECK(stack_magicq_test_program(text.c_str()) == "invalid");
+	}
+
+	StackMagicQProgram program;
+	StackMagicQPlaybackSet playbacks;
+	stack_magicq_program_clear(&program);
+	stack_magicq_playback_set_parse("3", &playbacks);
+	SMQT_CHECK(!stack_magicq_program_add_step(&program, MAGICQ_OPERATION_JUMP_TO_CUE_ID, &playbacks, 0, "x"));
+	SMQT_CHECK(!stack_magicq_program_add_step(&program, MAGICQ_OPERATION_JUMP_TO_CUE_ID, &playbacks, 0, "1e3"));
+	SMQT_CHECK(program.step_count == 0);
+	SMQT_CHECK(stack_magicq_program_add_step(&program, MAGICQ_OPERATION_JUMP_TO_CUE_ID, &playbacks, 0, ""));
+	SMQT_CHECK(stack_magicq_program_add_step(&program, MAGICQ_OPERATION_JUMP_TO_CUE_ID, &playbacks, 0, "7.5"));
+
+	// The cue ID is ignored for anything other than a jump
+	SMQT_CHECK(stack_magicq_program_add_step(&program, MAGICQ_OPERATION_GO, &playbacks, 0, "x"));
+	SMQT_CHECK(program.step_count == 3);
+	SMQT_CHECK(program.steps[2].cue_id[0] == '\0');
+}
+
+/// Checks that levels are kept within 0 to 100
+static void stack_magicq_test_levels()
+{
+	SMQT_CHECK(stack_magicq_test_program("level 1 150") == "level 1 100");
+	SMQT_CHECK(stack_magicq_test_program("level 1 0") == "level 1 0");
+	SMQT_CHECK(stack_magicq_test_program("level 1 fifty") == "invalid");
+	SMQT_CHECK(stack_magicq_test_program("level 1 5.5") == "invalid");
+
+	StackMagicQProgram program;
+	StackMagicQPlaybackSet playbacks;
+	stack_magicq_program_clear(&program);
+	stack_magicq_playback_set_parse("1", &playbacks);
+	stack_magicq_program_add_step(&program, MAGICQ_OPERATION_SET_LEVEL, &playbacks, -5, NULL);
+	stack_magicq_program_add_step(&program, MAGICQ_OPERATION_SET_LEVEL, &playbacks, 200, NULL);
+	stack_magicq_program_add_step(&program, MAGICQ_OPERATION_GO, &playbacks, 50, NULL);
+	SMQT_CHECK(program.steps[0].level == 0);
+	SMQT_CHECK(program.steps[1].level == 100);
+	SMQT_CHECK(program.steps[2].level == 0);
+}
+
+/// Checks that a program can have at most STACK_MAGICQ_PROGRAM_MAX_STEPS steps
+static void stack_magicq_test_step_limit()
+{
+	std::string text;
+	for (size_t i = 0; i < STACK_MAGICQ_PROGRAM_MAX_STEPS; i++)
+	{
+		text += i > 0 ? "; go 1" : "go 1";
+	}
+
+	StackMagicQProgram program;
+	SMQT_CHECK(stack_magicq_program_parse(text.c_str(), &program));
+	SMQT_CHECK(program.step_count == STACK_MAGICQ_PROGRAM_MAX_STEPS);
+
+	StackMagicQPlaybackSet playbacks;
+	stack_magicq_playback_set_parse("1", &playbacks);
+	SMQT_CHECK(!stack_magicq_program_add_step(&program, MAGICQ_OPERATION_GO, &playbacks, 0, NULL));
+	SMQT_CHECK(program.step_count == STACK_MAGICQ_PROGRAM_MAX_STEPS);
+
+	text += "; go 1";
+	SMQT_CHECK(!stack_magicq_program_parse(text.c_str(), &program));
+	SMQT_CHECK(program.step_count == 0);
+}
+
+/// Loads a cue from the JSON that Stack would give it (wrapped in an object
+/// named after the class), returning the text of its program
+static std::string stack_magicq_test_load(const StackCueClass *cue_class, StackCue *cue, const char *cue_json)
+{
+	std::string json = std::string("{\"StackMagicQCue\":") + cue_json + "}";
+	cue_class->from_json_func(cue, json.c_str());
+
+	char *program_text = NULL;
+	stack_property_get_string(stack_cue_get_property(cue, "program"), STACK_PROPERTY_VERSION_DEFINED, &program_text);
+	return program_text != NULL ? program_text : "";
+}
+
+/// Saves a cue to JSON, returning the JSON
+static std::string stack_magicq_test_save(const StackCueClass *cue_class, StackCue *cue)
+{
+	char *json_data = cue_class->to_json_func(cue);
+	std::string json = json_data != NULL ? json_data : "";
+	cue_class->free_json_func(cue, json_data);
+	return json;
+}
+
+/// Checks that programs are saved as arrays of steps, loaded back as the same
+/// text, and that the fixed actions of older shows become programs
+static void stack_magicq_test_json()
+{
+	const StackCueClass *cue_class = stack_get_cue_class("StackMagicQCue");
+	SMQT_CHECK(cue_class != NULL);
+	if (cue_class == NULL)
+	{
+		return;
+	}
+
+	// Text to an array of steps, and back
+	StackCue *cue = cue_class->create_func(NULL);
+	stack_property_set_string(stack_cue_get_property(cue, "program"), STACK_PROPERTY_VERSION_DEFINED, "activate 1, 2; level 1-2 50; go 5; jump 6 2.5");
+	std::string json = stack_magicq_test_save(cue_class, cue);
+	SMQT_CHECK(json.find("\"program\":[[\"activate\",\"1-2\"],[\"level\",\"1-2\",50],[\"go\",\"5\"],[\"jump\",\"6\",\"2.5\"]]") != std::string::npos);
+
+	StackCue *loaded = cue_class->create_func(NULL);
+	SMQT_CHECK(stack_magicq_test_load(cue_class, loaded, json.c_str()) == "activate 1-2; level 1-2 50; go 5; jump 6 2.5");
+	SMQT_CHECK(stack_magicq_test_save(cue_class, loaded) == json);
+
+	// Invalid steps are skipped, and levels are clamped
+	SMQT_CHECK(stack_magicq_test_load(cue_class, loaded, "{\"program\":[[\"go\",\"1\"],[\"jump\",\"2\",\"1e3\"],[\"flash\",\"3\"],[\"level\",\"0\",50],[\"level\",\"4\",150],7]}") == "go 1; level 4 100");
+
+	// The fixed actions of older shows, in the order they were always sent
+	SMQT_CHECK(stack_magicq_test_load(cue_class, loaded, "{\"playback\":3,\"level\":70,\"jump_cue_id\":\"4.5\",\"action_activate\":true,\"action_level\":true,\"action_go\":false,\"action_jump\":true,\"action_stop\":false,\"action_release\":true}") == "activate 3; level 3 70; jump 3 4.5; release 3");
+	SMQT_CHECK(stack_magicq_test_save(cue_class, loaded).find("\"program\":[[\"activate\",\"3\"],[\"level\",\"3\",70],[\"jump\",\"3\",\"4.5\"],[\"release\",\"3\"]]") != std::string::npos);
+	SMQT_CHECK(stack_magicq_test_load(cue_class, loaded, "{\"playback\":\"1-2\",\"action_go\":true}") == "go 1-2");
+	SMQT_CHECK(stack_magicq_test_load(cue_class, loaded, "{\"playback\":0,\"action_go\":true}") == "");
+
+	// Saving a second cue while the first cue's JSON is still held doesn't
+	// overwrite it, and both load back as they were saved
+	stack_property_set_string(stack_cue_get_property(loaded, "program"), STACK_PROPERTY_VERSION_DEFINED, "stop 9");
+	char *first = cue_class->to_json_func(cue);
+	char *second = cue_class->to_json_func(loaded);
+	SMQT_CHECK(first != NULL && second != NULL && first != second);
+	if (first != NULL && second != NULL)
+	{
+		SMQT_CHECK(std::string(first) == json);
+		SMQT_CHECK(stack_magicq_test_load(cue_class, loaded, second) == "stop 9");
+		SMQT_CHECK(stack_magicq_test_load(cue_class, loaded, first) == "activate 1-2; level 1-2 50; go 5; jump 6 2.5");
+	}
+	cue_class->free_json_func(cue, second);
+	cue_class->free_json_func(cue, first);
+
+	// Once given back, the shared buffer is used again
+	char *again = cue_class->to_json_func(cue);
+	SMQT_CHECK(again == first);
+	cue_class->free_json_func(cue, again);
+
+	cue_class->destroy_func(cue);
+	cue_class->destroy_func(loaded);
+}
+
+int main(int argc, char **argv)
+{
+	stack_magicq_test_sets();
+	stack_magicq_test_round_trips();
+	stack_magicq_test_cue_ids();
+	stack_magicq_test_levels();
+	stack_magicq_test_step_limit();
+
+	if (!stack_init_plugin())
+	{
+		fprintf(stderr, "The plugin failed to initialise\n");
+		return 1;
+	}
+	stack_magicq_test_json();
+
+	if (smqt_failures > 0)
+	{
+		fprintf(stderr, "%d check(s) failed\n", smqt_failures);
+		return 1;
+	}
+
+	printf("All program checks passed\n");
+	return 0;
+}
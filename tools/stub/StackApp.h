@@ -0,0 +1,15 @@
+#ifndef _STACKAPP_H_INCLUDED
+#define _STACKAPP_H_INCLUDED
+
+// Minimal stand-in for Stack's application window (see tools/stub/StackCue.h)
+
+// Includes:
+#include "StackCue.h"
+
+struct StackAppWindow
+{
+	GtkApplicationWindow parent;
+	StackCue *selected_cue;
+};
+
+#endif
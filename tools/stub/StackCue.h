@@ -0,0 +1,109 @@
+#ifndef _STACKCUE_H_INCLUDED
+#define _STACKCUE_H_INCLUDED
+
+// Minimal stand-in for Stack's cue API, just enough to host the MagicQ plugin
+// outside of Stack (see tools/stack-magicq-bench.cpp). The base cue runs its
+// pre-wait, action and post-wait against the clock, but has no cue list
+
+// Includes:
+#include "StackProperty.h"
+#include <gtk/gtk.h>
+#include <cstddef>
+#include <cstdint>
+
+// Defines:
+#define NANOSECS_PER_SEC ((stack_time_t)1000000000)
+#define NANOSECS_PER_MILLISEC ((stack_time_t)1000000)
+#define NANOSECS_PER_MICROSEC ((stack_time_t)1000)
+#define STACK_CUE(_c) ((StackCue*)(_c))
+#define STACK_CUE_MAX_PROPERTIES 32
+
+typedef int64_t stack_time_t;
+typedef uint64_t cue_uid_t;
+
+enum StackCueState
+{
+	STACK_CUE_STATE_ERROR,
+	STACK_CUE_STATE_STOPPED,
+	STACK_CUE_STATE_PREPARED,
+	STACK_CUE_STATE_PAUSED,
+	STACK_CUE_STATE_PLAYING_PRE,
+	STACK_CUE_STATE_PLAYING_ACTION,
+	STACK_CUE_STATE_PLAYING_POST,
+};
+
+struct StackCueList;
+
+struct StackCue
+{
+	// The name of the class, and the list the cue belongs to (always NULL here)
+	const char *_class_name;
+	StackCueList *parent;
+
+	// Unique identifier of the cue
+	cue_uid_t uid;
+
+	// Current state, and when the cue was started (clock time)
+	StackCueState state;
+	stack_time_t start_time;
+
+	// When the cue was paused (zero if it isn't), and how long it has spent
+	// paused in total since it was started
+	stack_time_t pause_time;
+	stack_time_t paused_time;
+
+	// The properties of the cue, including the base cue ones
+	StackProperty *properties[STACK_CUE_MAX_PROPERTIES];
+	size_t property_count;
+};
+
+// The functions that make up a cue class, in the order Stack declares them
+struct StackCueClass
+{
+	const char *class_name;
+	const char *super_class_name;
+	const char *friendly_name;
+	StackCue *(*create_func)(StackCueList *cue_list);
+	void (*destroy_func)(StackCue *cue);
+	bool (*play_func)(StackCue *cue);
+	void (*pause_func)(StackCue *cue);
+	void (*stop_func)(StackCue *cue);
+	void (*pulse_func)(StackCue *cue, stack_time_t clocktime);
+	void (*set_tabs_func)(StackCue *cue, GtkNotebook *notebook);
+	void (*unset_tabs_func)(StackCue *cue, GtkNotebook *notebook);
+	char *(*to_json_func)(StackCue *cue);
+	void (*free_json_func)(StackCue *cue, char *json_data);
+	void (*from_json_func)(StackCue *cue, const char *json_data);
+	bool (*get_error_func)(StackCue *cue, char *message, size_t size);
+	void *get_active_channels_func;
+	void *get_audio_func;
+	const char *(*get_field_func)(StackCue *cue, const char *field);
+	GdkPixbuf *(*get_icon_func)(StackCue *cue);
+	void *get_children_func;
+	void *get_next_cue_func;
+};
+
+// Functions: Base cue
+void stack_cue_init(StackCue *cue, StackCueList *cue_list);
+void stack_cue_destroy_base(StackCue *cue);
+void stack_cue_set_state(StackCue *cue, StackCueState state);
+void stack_cue_set_name(StackCue *cue, const char *name);
+void stack_cue_set_action_time(StackCue *cue, stack_time_t action_time);
+void stack_cue_add_property(StackCue *cue, StackProperty *property);
+StackProperty *stack_cue_get_property(StackCue *cue, const char *name);
+bool stack_cue_play_base(StackCue *cue);
+void stack_cue_pause_base(StackCue *cue);
+void stack_cue_stop_base(StackCue *cue);
+void stack_cue_pulse_base(StackCue *cue, stack_time_t clocktime);
+const char *stack_cue_get_field_base(StackCue *cue, const char *field);
+void stack_cue_get_running_times(StackCue *cue, stack_time_t clocktime, stack_time_t *pre, stack_time_t *action, stack_time_t *post, stack_time_t *paused, stack_time_t *real, stack_time_t *total);
+
+// Functions: Cue lists and classes
+void stack_cue_list_changed(StackCueList *cue_list, StackCue *cue, StackProperty *property);
+void stack_register_cue_class(StackCueClass *cue_class);
+const StackCueClass *stack_get_cue_class(const char *class_name);
+
+// Functions: Time
+stack_time_t stack_get_clock_time();
+
+#endif
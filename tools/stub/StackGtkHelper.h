@@ -0,0 +1,12 @@
+#ifndef _STACKGTKHELPER_H_INCLUDED
+#define _STACKGTKHELPER_H_INCLUDED
+
+// Minimal stand-in for Stack's GTK helpers (see tools/stub/StackCue.h)
+
+// Includes:
+#include <gtk/gtk.h>
+
+// Functions:
+void stack_limit_gtk_entry_int(GtkEntry *entry, bool allow_negative);
+
+#endif
@@ -0,0 +1,12 @@
+#ifndef _STACKJSON_H_INCLUDED
+#define _STACKJSON_H_INCLUDED
+
+// Minimal stand-in for Stack's JSON helpers (see tools/stub/StackCue.h)
+
+// Includes:
+#include <json/json.h>
+
+// Functions:
+bool stack_json_read_string(const char *json_data, Json::Value *result);
+
+#endif
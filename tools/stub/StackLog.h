@@ -0,0 +1,9 @@
+#ifndef _STACKLOG_H_INCLUDED
+#define _STACKLOG_H_INCLUDED
+
+// Minimal stand-in for Stack's logging (see tools/stub/StackCue.h)
+
+// Functions:
+void stack_log(const char *format, ...);
+
+#endif
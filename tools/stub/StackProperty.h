@@ -0,0 +1,51 @@
+#ifndef _STACKPROPERTY_H_INCLUDED
+#define _STACKPROPERTY_H_INCLUDED
+
+// Minimal stand-in for Stack's property API, just enough to host the MagicQ
+// plugin outside of Stack (see tools/stack-magicq-bench.cpp)
+
+// Includes:
+#include <cstdint>
+
+// The two versions of every property: as saved, and as used while playing
+enum StackPropertyVersion
+{
+	STACK_PROPERTY_VERSION_DEFINED,
+	STACK_PROPERTY_VERSION_LIVE,
+};
+
+// The types of property that the plugin uses
+enum StackPropertyType
+{
+	STACK_PROPERTY_TYPE_BOOL,
+	STACK_PROPERTY_TYPE_INT16,
+	STACK_PROPERTY_TYPE_INT64,
+	STACK_PROPERTY_TYPE_STRING,
+};
+
+// Opaque property types
+struct StackProperty;
+struct StackPropertyInt16;
+
+// Callbacks
+typedef void (*stack_property_changed_t)(StackProperty *property, StackPropertyVersion version, void *user_data);
+typedef void *stack_property_validator_t;
+
+// Functions:
+StackProperty *stack_property_create(const char *name, StackPropertyType type);
+void stack_property_destroy(StackProperty *property);
+const char *stack_property_get_name(StackProperty *property);
+void stack_property_set_changed_callback(StackProperty *property, stack_property_changed_t callback, void *user_data);
+void stack_property_set_validator(StackProperty *property, stack_property_validator_t validator, void *user_data);
+void stack_property_pause_change_callback(StackProperty *property, bool pause);
+void stack_property_copy_defined_to_live(StackProperty *property);
+bool stack_property_get_bool(StackProperty *property, StackPropertyVersion version, bool *value);
+bool stack_property_set_bool(StackProperty *property, StackPropertyVersion version, bool value);
+bool stack_property_get_int16(StackProperty *property, StackPropertyVersion version, int16_t *value);
+bool stack_property_set_int16(StackProperty *property, StackPropertyVersion version, int16_t value);
+bool stack_property_get_int64(StackProperty *property, StackPropertyVersion version, int64_t *value);
+bool stack_property_set_int64(StackProperty *property, StackPropertyVersion version, int64_t value);
+bool stack_property_get_string(StackProperty *property, StackPropertyVersion version, char **value);
+bool stack_property_set_string(StackProperty *property, StackPropertyVersion version, const char *value);
+
+#endif
@@ -0,0 +1,436 @@
+// Minimal stand-in for the parts of Stack that the MagicQ plugin uses, so that
+// the plugin can be driven without the Stack application (see
+// tools/stack-magicq-bench.cpp). Only the behaviour the plugin relies on is
+// implemented: typed properties with defined and live versions, and a base cue
+// that runs its pre-wait, action and post-wait against the clock
+
+// Includes:
+#include "StackCue.h"
+#include "StackLog.h"
+#include "StackJson.h"
+#include "StackGtkHelper.h"
+#include <atomic>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// A single version of a property's value
+struct StackStubValue
+{
+	bool bool_value;
+	int16_t int16_value;
+	int64_t int64_value;
+	std::string string_value;
+};
+
+struct StackProperty
+{
+	std::string name;
+	StackPropertyType type;
+	StackStubValue defined;
+	StackStubValue live;
+
+	stack_property_changed_t changed_callback;
+	void *changed_user_data;
+	stack_property_validator_t validator;
+	void *validator_user_data;
+	bool callback_paused;
+};
+
+// The validator signature for int16 properties
+typedef int16_t (*stack_stub_int16_validator_t)(StackPropertyInt16 *property, StackPropertyVersion version, const int16_t value, void *user_data);
+
+// Global: Every cue class that has been registered
+static std::vector<StackCueClass*> stub_cue_classes;
+
+// Global: The next cue UID to hand out
+static std::atomic<cue_uid_t> stub_next_uid(1);
+
+// Global: Serialises log lines from different threads
+static std::mutex stub_log_mutex;
+
+////////////////////////////////////////////////////////////////////////////////
+// PROPERTIES
+
+static StackStubValue *stack_stub_get_value(StackProperty *property, StackPropertyVersion version)
+{
+	return version == STACK_PROPERTY_VERSION_DEFINED ? &property->defined : &property->live;
+}
+
+static void stack_stub_notify(StackProperty *property, StackPropertyVersion version)
+{
+	if (property->changed_callback != NULL && !property->callback_paused)
+	{
+		property->changed_callback(property, version, property->changed_user_data);
+	}
+}
+
+StackProperty *stack_property_create(const char *name, StackPropertyType type)
+{
+	StackProperty *property = new StackProperty();
+	property->name = name;
+	property->type = type;
+	property->defined = StackStubValue{ false, 0, 0, "" };
+	property->live = property->defined;
+	property->changed_callback = NULL;
+	property->changed_user_data = NULL;
+	property->validator = NULL;
+	property->validator_user_data = NULL;
+	property->callback_paused = false;
+	return property;
+}
+
+void stack_property_destroy(StackProperty *property)
+{
+	delete property;
+}
+
+const char *stack_property_get_name(StackProperty *property)
+{
+	return property->name.c_str();
+}
+
+void stack_property_set_changed_callback(StackProperty *property, stack_property_changed_t callback, void *user_data)
+{
+	property->changed_callback = callback;
+	property->changed_user_data = user_data;
+}
+
+void stack_property_set_validator(StackProperty *property, stack_property_validator_t validator, void *user_data)
+{
+	property->validator = validator;
+	property->validator_user_data = user_data;
+}
+
+void stack_property_pause_change_callback(StackProperty *property, bool pause)
+{
+	property->callback_paused = pause;
+}
+
+void stack_property_copy_defined_to_live(StackProperty *property)
+{
+	property->live = property->defined;
+	stack_stub_notify(property, STACK_PROPERTY_VERSION_LIVE);
+}
+
+bool stack_property_get_bool(StackProperty *property, StackPropertyVersion version, bool *value)
+{
+	if (property == NULL || property->type != STACK_PROPERTY_TYPE_BOOL)
+	{
+		return false;
+	}
+	*value = stack_stub_get_value(property, version)->bool_value;
+	return true;
+}
+
+bool stack_property_set_bool(StackProperty *property, StackPropertyVersion version, bool value)
+{
+	if (property == NULL || property->type != STACK_PROPERTY_TYPE_BOOL)
+	{
+		return false;
+	}
+	stack_stub_get_value(property, version)->bool_value = value;
+	stack_stub_notify(property, version);
+	return true;
+}
+
+bool stack_property_get_int16(StackProperty *property, StackPropertyVersion version, int16_t *value)
+{
+	if (property == NULL || property->type != STACK_PROPERTY_TYPE_INT16)
+	{
+		return false;
+	}
+	*value = stack_stub_get_value(property, version)->int16_value;
+	return true;
+}
+
+bool stack_property_set_int16(StackProperty *property, StackPropertyVersion version, int16_t value)
+{
+	if (property == NULL || property->type != STACK_PROPERTY_TYPE_INT16)
+	{
+		return false;
+	}
+	if (property->validator != NULL)
+	{
+		value = ((stack_stub_int16_validator_t)property->validator)((StackPropertyInt16*)property, version, value, property->validator_user_data);
+	}
+	stack_stub_get_value(property, version)->int16_value = value;
+	stack_stub_notify(property, version);
+	return true;
+}
+
+bool stack_property_get_int64(StackProperty *property, StackPropertyVersion version, int64_t *value)
+{
+	if (property == NULL || property->type != STACK_PROPERTY_TYPE_INT64)
+	{
+		return false;
+	}
+	*value = stack_stub_get_value(property, version)->int64_value;
+	return true;
+}
+
+bool stack_property_set_int64(StackProperty *property, StackPropertyVersion version, int64_t value)
+{
+	if (property == NULL || property->type != STACK_PROPERTY_TYPE_INT64)
+	{
+		return false;
+	}
+	stack_stub_get_value(property, version)->int64_value = value;
+	stack_stub_notify(property, version);
+	return true;
+}
+
+bool stack_property_get_string(StackProperty *property, StackPropertyVersion version, char **value)
+{
+	if (property == NULL || property->type != STACK_PROPERTY_TYPE_STRING)
+	{
+		return false;
+	}
+	*value = (char*)stack_stub_get_value(property, version)->string_value.c_str();
+	return true;
+}
+
+bool stack_property_set_string(StackProperty *property, StackPropertyVersion version, const char *value)
+{
+	if (property == NULL || property->type != STACK_PROPERTY_TYPE_STRING)
+	{
+		return false;
+	}
+	stack_stub_get_value(property, version)->string_value = value != NULL ? value : "";
+	stack_stub_notify(property, version);
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// BASE CUE
+
+stack_time_t stack_get_clock_time()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (stack_time_t)now.tv_sec * NANOSECS_PER_SEC + now.tv_nsec;
+}
+
+static stack_time_t stack_stub_get_time(StackCue *cue, const char *name)
+{
+	int64_t value = 0;
+	stack_property_get_int64(stack_cue_get_property(cue, name), STACK_PROPERTY_VERSION_LIVE, &value);
+	return value;
+}
+
+void stack_cue_init(StackCue *cue, StackCueList *cue_list)
+{
+	cue->_class_name = "StackCue";
+	cue->parent = cue_list;
+	cue->uid = stub_next_uid.fetch_add(1);
+	cue->state = STACK_CUE_STATE_STOPPED;
+	cue->start_time = 0;
+	cue->pause_time = 0;
+	cue->paused_time = 0;
+	cue->property_count = 0;
+
+	stack_cue_add_property(cue, stack_property_create("name", STACK_PROPERTY_TYPE_STRING));
+	stack_cue_add_property(cue, stack_property_create("pre_time", STACK_PROPERTY_TYPE_INT64));
+	stack_cue_add_property(cue, stack_property_create("action_time", STACK_PROPERTY_TYPE_INT64));
+	stack_cue_add_property(cue, stack_property_create("post_time", STACK_PROPERTY_TYPE_INT64));
+}
+
+void stack_cue_destroy_base(StackCue *cue)
+{
+	for (size_t i = 0; i < cue->property_count; i++)
+	{
+		stack_property_destroy(cue->properties[i]);
+	}
+	cue->property_count = 0;
+}
+
+void stack_cue_set_state(StackCue *cue, StackCueState state)
+{
+	cue->state = state;
+}
+
+void stack_cue_set_name(StackCue *cue, const char *name)
+{
+	stack_property_set_string(stack_cue_get_property(cue, "name"), STACK_PROPERTY_VERSION_DEFINED, name);
+}
+
+void stack_cue_set_action_time(StackCue *cue, stack_time_t action_time)
+{
+	stack_property_set_int64(stack_cue_get_property(cue, "action_time"), STACK_PROPERTY_VERSION_DEFINED, action_time);
+}
+
+void stack_cue_add_property(StackCue *cue, StackProperty *property)
+{
+	if (cue->property_count < STACK_CUE_MAX_PROPERTIES)
+	{
+		cue->properties[cue->property_count++] = property;
+	}
+}
+
+StackProperty *stack_cue_get_property(StackCue *cue, const char *name)
+{
+	for (size_t i = 0; i < cue->property_count; i++)
+	{
+		if (cue->properties[i]->name == name)
+		{
+			return cue->properties[i];
+		}
+	}
+
+	return NULL;
+}
+
+bool stack_cue_play_base(StackCue *cue)
+{
+	// Resuming carries on from where the cue was paused
+	if (cue->state == STACK_CUE_STATE_PAUSED)
+	{
+		cue->paused_time += stack_get_clock_time() - cue->pause_time;
+		cue->pause_time = 0;
+		cue->state = STACK_CUE_STATE_PLAYING_PRE;
+		stack_cue_pulse_base(cue, stack_get_clock_time());
+		return true;
+	}
+
+	if (cue->state != STACK_CUE_STATE_STOPPED && cue->state != STACK_CUE_STATE_PREPARED)
+	{
+		return false;
+	}
+
+	stack_property_copy_defined_to_live(stack_cue_get_property(cue, "pre_time"));
+	stack_property_copy_defined_to_live(stack_cue_get_property(cue, "action_time"));
+	stack_property_copy_defined_to_live(stack_cue_get_property(cue, "post_time"));
+	cue->start_time = stack_get_clock_time();
+	cue->pause_time = 0;
+	cue->paused_time = 0;
+	cue->state = STACK_CUE_STATE_PLAYING_PRE;
+
+	return true;
+}
+
+void stack_cue_pause_base(StackCue *cue)
+{
+	if (cue->state >= STACK_CUE_STATE_PLAYING_PRE)
+	{
+		cue->pause_time = stack_get_clock_time();
+		cue->state = STACK_CUE_STATE_PAUSED;
+	}
+}
+
+void stack_cue_stop_base(StackCue *cue)
+{
+	cue->state = STACK_CUE_STATE_STOPPED;
+}
+
+void stack_cue_get_running_times(StackCue *cue, stack_time_t clocktime, stack_time_t *pre, stack_time_t *action, stack_time_t *post, stack_time_t *paused, stack_time_t *real, stack_time_t *total)
+{
+	const stack_time_t pre_time = stack_stub_get_time(cue, "pre_time");
+	const stack_time_t action_time = stack_stub_get_time(cue, "action_time");
+	const stack_time_t post_time = stack_stub_get_time(cue, "post_time");
+	stack_time_t elapsed = clocktime - cue->start_time - cue->paused_time;
+	if (elapsed < 0)
+	{
+		elapsed = 0;
+	}
+
+	*pre = elapsed < pre_time ? elapsed : pre_time;
+	elapsed -= *pre;
+	*action = elapsed < action_time ? elapsed : action_time;
+	elapsed -= *action;
+	*post = elapsed < post_time ? elapsed : post_time;
+	*paused = cue->paused_time;
+	*real = clocktime - cue->start_time;
+	*total = *real;
+}
+
+void stack_cue_pulse_base(StackCue *cue, stack_time_t clocktime)
+{
+	if (cue->state < STACK_CUE_STATE_PLAYING_PRE)
+	{
+		return;
+	}
+
+	const stack_time_t pre_time = stack_stub_get_time(cue, "pre_time");
+	const stack_time_t action_time = stack_stub_get_time(cue, "action_time");
+	const stack_time_t post_time = stack_stub_get_time(cue, "post_time");
+	const stack_time_t elapsed = clocktime - cue->start_time - cue->paused_time;
+
+	if (elapsed < pre_time)
+	{
+		cue->state = STACK_CUE_STATE_PLAYING_PRE;
+	}
+	else if (elapsed < pre_time + action_time)
+	{
+		cue->state = STACK_CUE_STATE_PLAYING_ACTION;
+	}
+	else if (elapsed < pre_time + action_time + post_time)
+	{
+		cue->state = STACK_CUE_STATE_PLAYING_POST;
+	}
+	else
+	{
+		cue->state = STACK_CUE_STATE_STOPPED;
+	}
+}
+
+const char *stack_cue_get_field_base(StackCue *cue, const char *field)
+{
+	return "";
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// CUE LISTS AND CLASSES
+
+void stack_cue_list_changed(StackCueList *cue_list, StackCue *cue, StackProperty *property)
+{
+	// There's no cue list to mark as changed
+}
+
+void stack_register_cue_class(StackCueClass *cue_class)
+{
+	stub_cue_classes.push_back(cue_class);
+}
+
+const StackCueClass *stack_get_cue_class(const char *class_name)
+{
+	for (StackCueClass *cue_class : stub_cue_classes)
+	{
+		if (strcmp(cue_class->class_name, class_name) == 0)
+		{
+			return cue_class;
+		}
+	}
+
+	return NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// HELPERS
+
+void stack_log(const char *format, ...)
+{
+	std::lock_guard<std::mutex> lock(stub_log_mutex);
+	va_list args;
+	va_start(args, format);
+	vfprintf(stderr, format, args);
+	va_end(args);
+}
+
+bool stack_json_read_string(const char *json_data, Json::Value *result)
+{
+	Json::CharReaderBuilder builder;
+	Json::CharReader *reader = builder.newCharReader();
+	std::string errors;
+	bool success = reader->parse(json_data, json_data + strlen(json_data), result, &errors);
+	delete reader;
+	return success;
+}
+
+void stack_limit_gtk_entry_int(GtkEntry *entry, bool allow_negative)
+{
+	// There's no UI
+}